@@ -1,5 +1,4 @@
-#include <stdio.h>
-#include <stdlib.h>
+#include "euclid.h"
 
 // gcd() - Euclidean algorithm
 int gcd(int a, int b)
@@ -57,175 +56,120 @@ int mul_inv(int a, int m)
         return 0;
 }
 
-// umul_inv() - computes multiplicative inverse a^-1 mod m
-uint64_t umul_inv(uint64_t a, uint64_t m)
+/*
+ * inv_pow2() - computes a^-1 mod 2^k by Newton (Hensel) iteration, 1 <= k <= 64
+ *
+ * For odd a, x = 3a xor 2 is correct to 5 bits and every x = x*(2 - a*x)
+ * doubles that, so four steps reach 64 bits. It returns 0 if a is even.
+ */
+uint64_t inv_pow2(uint64_t a, int k)
 {
-    unsigned long long int x0 = 1, x1= 0, t;
-    unsigned long long int d0 = a, d1 = m, q, swap;
-    while(d1 > 1){
-        q = d0 / d1;
-        swap = d0 - q*d1;
-        d0 = d1;
-        d1 = swap;
-        
-        t = q*x1;
-        if(x0 < t){
-            while(m < t){
-                t = t - m;
-            }
-            swap = m - t + x0; 
-        }
-        else
-            swap = x0 - t;
-        x0 = x1;
-        x1 = swap;
-    }
-    uint64_t r = x1;
-    if(d1==1)
-        return r;
-    else
+    uint64_t x;
+
+    if((a&1) == 0)
         return 0;
+    x = (3*a) ^ 2;       // 5 bits
+    x *= 2 - a*x;        // 10 bits
+    x *= 2 - a*x;        // 20 bits
+    x *= 2 - a*x;        // 40 bits
+    x *= 2 - a*x;        // 80 bits
+    return k < 64 ? x & (((uint64_t)1 << k) - 1) : x;
 }
 
-// gf8_mul(a, b) - a * b mod x^8+x^4+x^3+x+1.
-uint8_t gf8_mul(uint8_t a, uint8_t b)
+// inv_pow2_128() - computes a^-1 mod 2^k for 1 <= k <= 128, 0 if a is even
+unsigned __int128 inv_pow2_128(unsigned __int128 a, int k)
 {
-    uint8_t r = 0;
+    unsigned __int128 x;
 
-    while(b>0){
-        if(b&1)
-            r = r^a;
-        b = b>>1;
-        a = (a<<1) ^ ((a>>7)&1 ? 0x1B : 0);// xtime(a) 
-    }
-    return r;
+    if((a&1) == 0)
+        return 0;
+    x = inv_pow2((uint64_t)a, 64);   // 64 bits
+    x *= 2 - a*x;                    // 128 bits
+    return k < 128 ? x & (((unsigned __int128)1 << k) - 1) : x;
 }
 
-// gf8_pow(a,b) - a^b mod x^8+x^4+x^3+x+1
-uint8_t gf8_pow(uint8_t a, uint8_t b)
+/*
+ * umul_inv() - computes multiplicative inverse a^-1 mod m
+ * A power of two modulus is handed to inv_pow2(), any other to xgcd64(),
+ * whose cofactor is already reduced to |x| <= m/2.
+ */
+uint64_t umul_inv(uint64_t a, uint64_t m)
 {
-    uint8_t r = 1;
-    while(b>0){
-        if(b&1)
-            r = gf8_mul(r, a);
-        b = b >> 1;
-        a = gf8_mul(a, a);
-    }
-    return r;
+    int64_t x, y;
+
+    if(m > 1 && (m & (m-1)) == 0)
+        return inv_pow2(a, __builtin_ctzll(m));
+    if(m < 2 || xgcd64(a, m, &x, &y) != 1)
+        return 0;
+    return x < 0 ? (uint64_t)x + m : (uint64_t)x;
 }
 
-// gf8_inv(a) - a^-1 mod x^8+x^4+x^3+x+1
-uint8_t gf8_inv(uint8_t a)
+/*
+ * gcd64() - binary (Stein) gcd of 64-bit operands
+ * Removes all factors of two with ctz and replaces the compare/swap of
+ * the subtraction step with masks, so the loop body has no branch other
+ * than the exit test and no division.
+ */
+uint64_t gcd64(uint64_t a, uint64_t b)
 {
-    return gf8_pow(a, 0xfe);
+    int k;
+    uint64_t d, m;
+
+    if(a==0 || b==0)
+        return a|b;
+    k = __builtin_ctzll(a|b);
+    a >>= __builtin_ctzll(a);
+    while(b != 0){
+        b >>= __builtin_ctzll(b);
+        d = b - a;
+        m = -(uint64_t)(b < a);
+        a += d & m;           // a = min(a, b)
+        b = (d ^ m) - m;      // b = |b - a|
+    }
+    return a << k;
 }
 
-int main(void)
+/*
+ * xgcd64() - extended Euclid of 64-bit operands
+ *
+ * Returns d = gcd(a,b) and x, y with a*x + b*y = d exactly.
+ * Steps take a 64-bit division only while the operands need more than 32
+ * bits, then switch to 32-bit divisions, which are several times cheaper.
+ * (A Lehmer version that simulated the steps on leading 31-bit digits was
+ * slower than this on every operand size: the quotient checks and the
+ * 2x2 cosequence updates cost more than the divisions they saved.)
+ * Cofactors are kept modulo 2^64; since |x| <= b/2d and |y| <= a/2d the
+ * final values are exact as int64_t.
+ */
+uint64_t xgcd64(uint64_t a, uint64_t b, int64_t *x, int64_t *y)
 {
-    int a, b, x, y, d, count;
-    uint64_t m, ai;
-    
-    // gcd test
-    printf("--- gcd test ---\n");
-    a = 28; b = 0;
-    printf("gcd(%d,%d) = %d\n", a, b, gcd(a,b));
-    a = 0; b = 32;
-    printf("gcd(%d,%d) = %d\n", a, b, gcd(a,b));
-    a = 41370; b = 22386;
-    printf("gcd(%d,%d) = %d\n", a, b, gcd(a,b));
-    a = 22386; b = 41371;
-    printf("gcd(%d,%d) = %d\n", a, b, gcd(a,b));
-    
-    // xgcd, mul_inv test
-    printf("--- xgcd, mul_inv test ---\n");
-    a = 41370; b = 22386;
-    d = xgcd(a, b, &x, &y);
-    printf("%d = %d * %d + %d * %d\n", d, a, x, b, y);
-    printf("%d^-1 mod %d = %d, %d^-1 mod %d = %d\n", a, b, mul_inv(a,b), b, a, mul_inv(b,a));
-    a = 41371; b = 22386;
-    d = xgcd(a, b, &x, &y);
-    printf("%d = %d * %d + %d * %d\n", d, a, x, b, y);
-    printf("%d^-1 mod %d = %d, %d^-1 mod %d = %d\n", a, b, mul_inv(a,b), b, a, mul_inv(b,a));
-    
-    /*
-     * generate random number a, b & compute xgcd
-     * if xgcd == 1, check a^-1 mod b & b^-1 mod a
-     * repeat a lot
-     */
-    printf("--- random mul_inv test ---\n"); fflush(stdout);
-    count = 0;
-    do {
-        arc4random_buf(&a, sizeof(int)); a &= 0x7fffffff;
-        arc4random_buf(&b, sizeof(int)); b &= 0x7fffffff;
-        d = xgcd(a, b, &x, &y);
-        if (d == 1) {
-            if (x < 0)
-                x = x + b;
-            else
-                y = y + a;
-            if (x != mul_inv(a, b) || y != mul_inv(b, a)) {
-                printf("Inversion error\n");
-                exit(1);
-            }
-        }
-        if (++count % 0xffff == 0) {
-            printf(".");
-            fflush(stdout);
-        }
-    } while (count < 0xfffff);
-    printf("No error found\n");
-    
-    printf("--- a*b for GF(2^8)  ---\n");
-    a = 28; b = 7;
-    printf("%d * %d = %d\n", a, b, gf8_mul(a,b));
-    a = 127; b = 68;
-    printf("%d * %d = %d\n", a, b, gf8_mul(a,b));
+    uint64_t x0 = 1, y0 = 0, x1 = 0, y1 = 1, q, t;
+    uint32_t a32, b32, q32, t32;
 
-
-    printf("--- all a*b test for GF(2^8) ---\n");
-    for (a = 1; a < 256; ++a) {
-        if (a == 0) continue;
-        b = gf8_inv(a);
-        if (gf8_mul(a,b) != 1) {
-            printf("Logic error\n");
-            exit(1);
-        }
-        else {
-            printf(".");
-            fflush(stdout);
-        }
+    while(b >> 32){
+        q = a / b;
+        t = a - q*b; a = b; b = t;
+        t = x0 - q*x1; x0 = x1; x1 = t;
+        t = y0 - q*y1; y0 = y1; y1 = t;
     }
-    printf("No error found\n");
-
-    printf("--- umul_inv test ---\n");
-    a = 5; m = 9223372036854775808u;
-    ai = umul_inv(a, m);
-    printf("a = %d, m = %llu, a^-1 mod m = %llu", a, m, ai);
-    if (ai != 5534023222112865485u) {
-        printf(" <- inversion error\n");
-        exit(1);
+    if(b != 0 && (a >> 32)){
+        q = a / b;
+        t = a - q*b; a = b; b = t;
+        t = x0 - q*x1; x0 = x1; x1 = t;
+        t = y0 - q*y1; y0 = y1; y1 = t;
     }
-    else
-        printf(" OK\n");
-    a = 17; m = 9223372036854775808u;
-    ai = umul_inv(a, m);
-    printf("a = %d, m = %llu, a^-1 mod m = %llu", a, m, ai);
-    if (ai != 8138269444283625713u) {
-        printf(" <- inversion error\n");
-        exit(1);
+    if(b == 0){
+        *x = (int64_t)x0, *y = (int64_t)y0;
+        return a;
     }
-    else
-        printf(" OK\n");
-    a = 85; m = 9223372036854775808u;
-    ai = umul_inv(a, m);
-    printf("a = %d, m = %llu, a^-1 mod m = %llu", a, m, ai);
-    if (ai != 9006351518340545789u) {
-        printf(" <- inversion error\n");
-        exit(1);
+    /* both operands fit in 32 bits now */
+    a32 = a, b32 = b;
+    while(b32 != 0){
+        q32 = a32 / b32;
+        t32 = a32 - q32*b32; a32 = b32; b32 = t32;
+        t = x0 - q32*x1; x0 = x1; x1 = t;
+        t = y0 - q32*y1; y0 = y1; y1 = t;
     }
-    else
-        printf(" OK\n");
-
-    printf("Congratulations!\n");
-    return 0;
+    *x = (int64_t)x0, *y = (int64_t)y0;
+    return a32;
 }
@@ -0,0 +1,149 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include "euclid.h"
+
+#define BATCH_MAX_THREADS 64
+
+struct batch_job {
+    uint64_t *out;
+    const uint64_t *in;
+    size_t n;
+    uint64_t m;
+    size_t bad;
+};
+
+static inline uint64_t mulmod(uint64_t a, uint64_t b, uint64_t m)
+{
+    return (unsigned __int128)a * b % m;
+}
+
+/*
+ * batch_inv_run() - Montgomery's trick on the elements not set in bad
+ *
+ * out[i] = in[0]*...*in[i] mod m on the way forward, then a single
+ * inversion of the full product and a backward pass that peels one
+ * factor off per element: 3(n-1) multiplications and one xgcd64.
+ * It returns -1 if the product is not invertible.
+ */
+static int batch_inv_run(uint64_t *out, const uint64_t *in, size_t n, uint64_t m, const uint64_t *bad)
+{
+    uint64_t p = 1, inv, t;
+    int64_t x, y;
+    size_t i;
+
+    for(i=0;i<n;i++){
+        if(bad == 0 || !(bad[i>>6] >> (i&63) & 1))
+            p = mulmod(p, in[i], m);
+        out[i] = p;
+    }
+    if(xgcd64(p, m, &x, &y) != 1)
+        return -1;
+    inv = x < 0 ? (uint64_t)x + m : (uint64_t)x;
+    for(i=n;i-->0;){
+        if(bad && (bad[i>>6] >> (i&63) & 1)){
+            out[i] = 0;
+            continue;
+        }
+        t = i > 0 ? out[i-1] : 1;
+        out[i] = mulmod(inv, t, m);
+        inv = mulmod(inv, in[i], m);
+    }
+    return 0;
+}
+
+/*
+ * batch_inv_split() - batch_inv_run(), halving the range on failure
+ *
+ * A non-invertible element poisons only the halves that contain it, so
+ * one bad element costs about three passes over n instead of a gcd64 per
+ * element. Ranges of at most 64 elements are checked with gcd64() and
+ * rerun with a one-word mask.
+ */
+static size_t batch_inv_split(uint64_t *out, const uint64_t *in, size_t n, uint64_t m)
+{
+    uint64_t bad = 0;
+    size_t i, h, nbad = 0;
+
+    if(n == 0 || batch_inv_run(out, in, n, m, 0) == 0)
+        return 0;
+    if(n > 64){
+        h = n / 2;
+        return batch_inv_split(out, in, h, m) + batch_inv_split(out+h, in+h, n-h, m);
+    }
+    for(i=0;i<n;i++)
+        if(gcd64(in[i] % m, m) != 1){
+            bad |= (uint64_t)1 << i;
+            nbad++;
+        }
+    batch_inv_run(out, in, n, m, &bad);
+    return nbad;
+}
+
+/*
+ * batch_inv() - out[i] = in[i]^-1 mod m for n elements, m > 1
+ *
+ * Non-invertible elements get out[i] = 0 and are counted in the return
+ * value. When the whole product is not invertible, the range is split
+ * until the offending elements are isolated; see batch_inv_split().
+ * out and in must not overlap.
+ */
+size_t batch_inv(uint64_t *out, const uint64_t *in, size_t n, uint64_t m)
+{
+    return batch_inv_split(out, in, n, m);
+}
+
+static void *batch_worker(void *p)
+{
+    struct batch_job *j = p;
+
+    for(size_t off=0;off<j->n;off+=BATCH_BLOCK)
+        j->bad += batch_inv(j->out+off, j->in+off,
+                            j->n-off < BATCH_BLOCK ? j->n-off : BATCH_BLOCK, j->m);
+    return NULL;
+}
+
+/*
+ * batch_inv_mt() - batch_inv() over nthreads threads
+ * Each thread takes a contiguous range and inverts it in cache-sized blocks
+ * of BATCH_BLOCK elements, one xgcd64 per block.
+ */
+size_t batch_inv_mt(uint64_t *out, const uint64_t *in, size_t n, uint64_t m, int nthreads)
+{
+    struct batch_job job[BATCH_MAX_THREADS];
+    pthread_t tid[BATCH_MAX_THREADS];
+    int started[BATCH_MAX_THREADS];
+    size_t per, nbad = 0;
+    int t;
+
+    if(nthreads < 1)
+        nthreads = 1;
+    if(nthreads > BATCH_MAX_THREADS)
+        nthreads = BATCH_MAX_THREADS;
+    if((size_t)nthreads > (n + BATCH_BLOCK - 1) / BATCH_BLOCK)
+        nthreads = (n + BATCH_BLOCK - 1) / BATCH_BLOCK;
+    if(nthreads < 1)
+        return batch_inv(out, in, n, m);
+    /* ceil(n/nthreads) rounded up to whole blocks, so per*nthreads >= n */
+    per = ((n + nthreads - 1) / nthreads + BATCH_BLOCK - 1) / BATCH_BLOCK * BATCH_BLOCK;
+    for(t=0;t<nthreads;t++){
+        size_t off = t*per < n ? t*per : n;
+        job[t].out = out + off;
+        job[t].in = in + off;
+        job[t].n = n - off < per ? n - off : per;
+        job[t].m = m;
+        job[t].bad = 0;
+        started[t] = 0;
+    }
+    for(t=1;t<nthreads;t++)
+        started[t] = pthread_create(&tid[t], NULL, batch_worker, &job[t]) == 0;
+    batch_worker(&job[0]);
+    for(t=1;t<nthreads;t++){
+        if(started[t])
+            pthread_join(tid[t], NULL);
+        else
+            batch_worker(&job[t]);
+    }
+    for(t=0;t<nthreads;t++)
+        nbad += job[t].bad;
+    return nbad;
+}
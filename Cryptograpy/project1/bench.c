@@ -0,0 +1,383 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "euclid.h"
+#include "gf8.h"
+#include "rs.h"
+#include "gf2n.h"
+
+#define NOPS 0x1000000
+#define NOPS_INV 0x100000
+#define REGION_LEN 0x1000000
+#define REGION_REPS 16
+#define NPAIRS 0x1000
+#define GCD_REPS 64
+#define NBATCH 0x100000
+#define RS_K 8
+#define RS_M 4
+#define RS_SHARD 0x400000
+
+/*
+ * Bit-serial reference versions (the original gf8_mul/gf8_pow/gf8_inv),
+ * kept here only as the baseline the table-driven functions are measured
+ * against.
+ */
+static uint8_t ref_gf8_mul(uint8_t a, uint8_t b)
+{
+    uint8_t r = 0;
+
+    while(b>0){
+        if(b&1)
+            r = r^a;
+        b = b>>1;
+        a = (a<<1) ^ ((a>>7)&1 ? 0x1B : 0);// xtime(a)
+    }
+    return r;
+}
+
+static uint8_t ref_gf8_pow(uint8_t a, uint8_t b)
+{
+    uint8_t r = 1;
+    while(b>0){
+        if(b&1)
+            r = ref_gf8_mul(r, a);
+        b = b >> 1;
+        a = ref_gf8_mul(a, a);
+    }
+    return r;
+}
+
+static uint8_t ref_gf8_inv(uint8_t a)
+{
+    return ref_gf8_pow(a, 0xfe);
+}
+
+/*
+ * 64-bit versions of the division-based Euclid loops from Euclid_GF2^8.c
+ * (the same gcd loop as project4/mRSA.c), baseline for gcd64/xgcd64
+ */
+static uint64_t ref_gcd64(uint64_t a, uint64_t b)
+{
+    uint64_t k;
+    while(b!=0){
+        k = a % b;
+        a = b;
+        b = k;
+    }
+    return a;
+}
+
+static uint64_t ref_xgcd64(uint64_t a, uint64_t b, int64_t *x, int64_t *y)
+{
+    uint64_t x0 = 1, y0 = 0, x1= 0, y1=1;
+    uint64_t d0 = a, d1 = b, q, swap;
+    while(d1 != 0){
+        q = d0/d1;
+        swap = d0 - q*d1;
+        d0 = d1;
+        d1 = swap;
+
+        swap = x0 - q*x1;
+        x0 = x1;
+        x1 = swap;
+
+        swap = y0 - q*y1;
+        y0 = y1;
+        y1 = swap;
+    }
+    *x = x0, *y = y0;
+    return d0;
+}
+
+/*
+ * the original umul_inv(), before the power of two dispatch
+ */
+static uint64_t ref_umul_inv(uint64_t a, uint64_t m)
+{
+    unsigned long long int x0 = 1, x1= 0, t;
+    unsigned long long int d0 = a, d1 = m, q, swap;
+    while(d1 > 1){
+        q = d0 / d1;
+        swap = d0 - q*d1;
+        d0 = d1;
+        d1 = swap;
+
+        t = q*x1;
+        if(x0 < t){
+            while(m < t){
+                t = t - m;
+            }
+            swap = m - t + x0;
+        }
+        else
+            swap = x0 - t;
+        x0 = x1;
+        x1 = swap;
+    }
+    uint64_t r = x1;
+    if(d1==1)
+        return r;
+    else
+        return 0;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void report(const char *name, double t, long n)
+{
+    printf("%-16s %8.2f ns/op\n", name, t * 1e9 / n);
+}
+
+/*
+ * Each loop folds its results into sink so the compiler cannot drop the
+ * calls, and operands come from a random buffer so the branchy reference
+ * code sees realistic inputs.
+ */
+#define BENCH_MUL(name, f, n) do { \
+    uint8_t acc = 0; double t = now(); \
+    for (long i = 0; i < (n); ++i) \
+        acc ^= f(buf[i & 0xffff], buf[(i + 1) & 0xffff]); \
+    t = now() - t; sink ^= acc; report(name, t, n); \
+} while (0)
+
+#define BENCH_INV(name, f, n) do { \
+    uint8_t acc = 0; double t = now(); \
+    for (long i = 0; i < (n); ++i) \
+        acc ^= f(buf[i & 0xffff] ^ acc); \
+    t = now() - t; sink ^= acc; report(name, t, n); \
+} while (0)
+
+static void report_bw(const char *name, double t, double bytes)
+{
+    printf("%-16s %8.2f GB/s\n", name, bytes / t * 1e-9);
+}
+
+int main(void)
+{
+    static uint8_t buf[0x10000];
+    volatile uint64_t sink = 0;
+    uint8_t *src, *dst, *sp[RS_K+RS_M], present[RS_K+RS_M];
+    double t;
+    rs_ctx *rs;
+    static uint64_t opa[NPAIRS], opb[NPAIRS];
+    static const int bits[] = {32, 63, 64};
+
+    arc4random_buf(buf, sizeof(buf));
+
+    printf("--- GF(2^8) mul ---\n");
+    BENCH_MUL("bit-serial", ref_gf8_mul, NOPS);
+    BENCH_MUL("table", gf8_mul, NOPS);
+    BENCH_MUL("constant-time", gf8_mul_ct, NOPS);
+    BENCH_MUL("gf2_8", gf2_8_mul, NOPS);
+
+    printf("--- GF(2^n) mul, portable / pclmul ---\n");
+    for (int k = 0; k < 2; ++k) {
+        uint64_t acc = 0, x = 0x0123456789abcdefu;
+        char name[32];
+        if (gf2n_select_pclmul(k) != 0)
+            continue;
+        t = now();
+        for (long i = 0; i < NOPS; ++i)
+            acc ^= gf2_16_mul(acc + i, x);
+        snprintf(name, sizeof(name), "gf2_16 %s", k ? "pclmul" : "sw");
+        report(name, now() - t, NOPS);
+        t = now();
+        for (long i = 0; i < NOPS; ++i)
+            acc ^= gf2_32_mul(acc + i, x);
+        snprintf(name, sizeof(name), "gf2_32 %s", k ? "pclmul" : "sw");
+        report(name, now() - t, NOPS);
+        t = now();
+        for (long i = 0; i < NOPS; ++i)
+            acc ^= gf2_64_mul(acc + i, x);
+        snprintf(name, sizeof(name), "gf2_64 %s", k ? "pclmul" : "sw");
+        report(name, now() - t, NOPS);
+        sink ^= acc;
+    }
+    gf2n_select_pclmul(GF2N_PCLMUL_AUTO);
+
+    printf("--- GF(2^8) inv ---\n");
+    BENCH_INV("bit-serial", ref_gf8_inv, NOPS_INV);
+    BENCH_INV("table", gf8_inv, NOPS_INV);
+    BENCH_INV("constant-time", gf8_inv_ct, NOPS_INV);
+
+    /*
+     * gcd/xgcd over random operand pairs of 32, 63 and 64 bits
+     */
+    for (int w = 0; w < 3; ++w) {
+        printf("--- gcd/xgcd, %d-bit operands ---\n", bits[w]);
+        arc4random_buf(opa, sizeof(opa));
+        arc4random_buf(opb, sizeof(opb));
+        for (int i = 0; i < NPAIRS; ++i) {
+            opa[i] >>= 64 - bits[w];
+            opb[i] >>= 64 - bits[w];
+        }
+        uint64_t acc = 0;
+        int64_t sx, sy;
+        int ix, iy;
+        if (bits[w] == 32) {
+            t = now();
+            for (int r = 0; r < GCD_REPS; ++r)
+                for (int i = 0; i < NPAIRS; ++i)
+                    acc += gcd(opa[i] >> 1, opb[i] >> 1);
+            report("gcd (int)", now() - t, (long)NPAIRS * GCD_REPS);
+            t = now();
+            for (int r = 0; r < GCD_REPS; ++r)
+                for (int i = 0; i < NPAIRS; ++i)
+                    acc += xgcd(opa[i] >> 1, opb[i] >> 1, &ix, &iy) + ix;
+            report("xgcd (int)", now() - t, (long)NPAIRS * GCD_REPS);
+        }
+        t = now();
+        for (int r = 0; r < GCD_REPS; ++r)
+            for (int i = 0; i < NPAIRS; ++i)
+                acc += ref_gcd64(opa[i], opb[i]);
+        report("euclid gcd", now() - t, (long)NPAIRS * GCD_REPS);
+        t = now();
+        for (int r = 0; r < GCD_REPS; ++r)
+            for (int i = 0; i < NPAIRS; ++i)
+                acc += gcd64(opa[i], opb[i]);
+        report("gcd64", now() - t, (long)NPAIRS * GCD_REPS);
+        t = now();
+        for (int r = 0; r < GCD_REPS; ++r)
+            for (int i = 0; i < NPAIRS; ++i)
+                acc += ref_xgcd64(opa[i], opb[i], &sx, &sy) + sx;
+        report("euclid xgcd", now() - t, (long)NPAIRS * GCD_REPS);
+        t = now();
+        for (int r = 0; r < GCD_REPS; ++r)
+            for (int i = 0; i < NPAIRS; ++i)
+                acc += xgcd64(opa[i], opb[i], &sx, &sy) + sx;
+        report("xgcd64", now() - t, (long)NPAIRS * GCD_REPS);
+        sink ^= acc;
+    }
+
+    /*
+     * inverse of random odd a modulo 2^63
+     */
+    printf("--- umul_inv mod 2^63 ---\n");
+    arc4random_buf(opa, sizeof(opa));
+    for (int i = 0; i < NPAIRS; ++i)
+        opa[i] = (opa[i] >> 1) | 1;
+    {
+        uint64_t acc = 0;
+        t = now();
+        for (int i = 0; i < NPAIRS; ++i)
+            acc += ref_umul_inv(opa[i], 0x8000000000000000u);
+        report("euclid", now() - t, NPAIRS);
+        t = now();
+        for (int r = 0; r < GCD_REPS; ++r)
+            for (int i = 0; i < NPAIRS; ++i)
+                acc += umul_inv(opa[i], 0x8000000000000000u);
+        report("umul_inv", now() - t, (long)NPAIRS * GCD_REPS);
+        t = now();
+        for (int r = 0; r < GCD_REPS; ++r)
+            for (int i = 0; i < NPAIRS; ++i)
+                acc += inv_pow2(opa[i], 63);
+        report("inv_pow2", now() - t, (long)NPAIRS * GCD_REPS);
+        sink ^= acc;
+    }
+
+    /*
+     * 1M inverses modulo a fixed 64-bit prime: one xgcd64 per element
+     * against Montgomery's trick, single and multi-threaded. The last row
+     * plants one non-invertible element to time the fallback path.
+     */
+    printf("--- batch inversion, %d elements ---\n", NBATCH);
+    {
+        uint64_t *in = malloc(NBATCH * sizeof(uint64_t)), *out = malloc(NBATCH * sizeof(uint64_t));
+        uint64_t m, acc = 0;
+        int64_t sx, sy;
+        long nt = sysconf(_SC_NPROCESSORS_ONLN);
+        char name[32];
+        m = 0xffffffffffffffc5;     // largest 64-bit prime, every nonzero element invertible
+        arc4random_buf(in, NBATCH * sizeof(uint64_t));
+        for (int i = 0; i < NBATCH; ++i)
+            if (in[i] % m == 0)
+                in[i] = 1;
+        t = now();
+        for (int i = 0; i < NBATCH; ++i) {
+            xgcd64(in[i] % m, m, &sx, &sy);
+            acc += sx;
+        }
+        report("xgcd64 each", now() - t, NBATCH);
+        t = now();
+        batch_inv(out, in, NBATCH, m);
+        report("batch_inv", now() - t, NBATCH);
+        t = now();
+        batch_inv_mt(out, in, NBATCH, m, nt);
+        snprintf(name, sizeof(name), "batch_inv_mt x%ld", nt);
+        report(name, now() - t, NBATCH);
+        in[NBATCH / 3] = m;
+        t = now();
+        batch_inv(out, in, NBATCH, m);
+        report("batch_inv, 1 bad", now() - t, NBATCH);
+        sink ^= acc + out[0];
+        free(in);
+        free(out);
+    }
+
+    /*
+     * dst ^= c * src over a 16 MiB buffer: byte-at-a-time gf8_mul
+     * against each region kernel the CPU supports
+     */
+    printf("--- GF(2^8) region mul_xor ---\n");
+    src = malloc(REGION_LEN);
+    dst = malloc(REGION_LEN);
+    arc4random_buf(src, REGION_LEN);
+    arc4random_buf(dst, REGION_LEN);
+    t = now();
+    for (long i = 0; i < REGION_LEN; ++i)
+        dst[i] ^= gf8_mul(0x57, src[i]);
+    report_bw("gf8_mul loop", now() - t, REGION_LEN);
+    for (int k = GF8_KERNEL_PORTABLE; k <= GF8_KERNEL_AVX2; ++k) {
+        if (gf8_region_select(k) != 0)
+            continue;
+        t = now();
+        for (int r = 0; r < REGION_REPS; ++r)
+            gf8_region_mul_xor(dst, src, 0x57 + r, REGION_LEN);
+        report_bw(gf8_region_name(), now() - t, (double)REGION_LEN * REGION_REPS);
+    }
+    gf8_region_select(GF8_KERNEL_AUTO);
+    sink ^= dst[0];
+    free(src);
+    free(dst);
+
+    /*
+     * 8+4 Reed-Solomon over 4 MiB shards, throughput counted in data bytes;
+     * decode rebuilds two data and two parity shards
+     */
+    printf("--- Reed-Solomon %d+%d ---\n", RS_K, RS_M);
+    rs = rs_new(RS_K, RS_M, RS_CAUCHY);
+    for (int i = 0; i < RS_K+RS_M; ++i) {
+        sp[i] = malloc(RS_SHARD);
+        arc4random_buf(sp[i], RS_SHARD);
+    }
+    memset(present, 1, sizeof(present));
+    present[0] = present[5] = present[RS_K] = present[RS_K+3] = 0;
+    for (int nt = 1; nt <= RS_MAX_THREADS; nt *= 2) {
+        char name[32];
+        rs_set_threads(rs, nt);
+        t = now();
+        for (int r = 0; r < REGION_REPS; ++r)
+            rs_encode(rs, (const uint8_t **)sp, sp+RS_K, RS_SHARD);
+        snprintf(name, sizeof(name), "encode x%d", nt);
+        report_bw(name, now() - t, (double)RS_K * RS_SHARD * REGION_REPS);
+        t = now();
+        for (int r = 0; r < REGION_REPS; ++r)
+            rs_decode(rs, sp, present, RS_SHARD);
+        snprintf(name, sizeof(name), "decode x%d", nt);
+        report_bw(name, now() - t, (double)RS_K * RS_SHARD * REGION_REPS);
+        if (nt >= sysconf(_SC_NPROCESSORS_ONLN))
+            break;
+    }
+    for (int i = 0; i < RS_K+RS_M; ++i)
+        free(sp[i]);
+    rs_free(rs);
+
+    return 0;
+}
@@ -0,0 +1,20 @@
+#ifndef EUCLID_H
+#define EUCLID_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+int gcd(int a, int b);
+int xgcd(int a, int b, int *x, int *y);
+int mul_inv(int a, int m);
+uint64_t umul_inv(uint64_t a, uint64_t m);
+uint64_t inv_pow2(uint64_t a, int k);
+unsigned __int128 inv_pow2_128(unsigned __int128 a, int k);
+uint64_t gcd64(uint64_t a, uint64_t b);
+uint64_t xgcd64(uint64_t a, uint64_t b, int64_t *x, int64_t *y);
+#define BATCH_BLOCK 0x2000       /* elements per block of batch_inv_mt, in + out fit in L2 */
+
+size_t batch_inv(uint64_t *out, const uint64_t *in, size_t n, uint64_t m);
+size_t batch_inv_mt(uint64_t *out, const uint64_t *in, size_t n, uint64_t m, int nthreads);
+
+#endif
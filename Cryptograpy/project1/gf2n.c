@@ -0,0 +1,187 @@
+#include "gf2n.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define GF2N_X86
+#endif
+
+static int use_pclmul;
+
+/*
+ * clmul_sw() - portable carry-less multiply a * b, b of degree < n
+ * Masks instead of branches, so the time does not depend on the operands.
+ */
+static inline void clmul_sw(uint64_t a, uint64_t b, int n, uint64_t *hi, uint64_t *lo)
+{
+    uint64_t h = 0, l = 0, m;
+
+    for(int i=0;i<n;i++){
+        m = -((b>>i)&1);
+        l ^= (a<<i) & m;
+        if(i)
+            h ^= (a>>(64-i)) & m;
+    }
+    *hi = h, *lo = l;
+}
+
+#ifdef GF2N_X86
+__attribute__((target("pclmul,sse2")))
+static inline void clmul_hw(uint64_t a, uint64_t b, int n, uint64_t *hi, uint64_t *lo)
+{
+    __m128i p = _mm_clmulepi64_si128(_mm_cvtsi64_si128(a), _mm_cvtsi64_si128(b), 0);
+
+    (void)n;
+    *lo = _mm_cvtsi128_si64(p);
+    *hi = _mm_cvtsi128_si64(_mm_unpackhi_epi64(p, p));
+}
+#endif
+
+/*
+ * GF2N_MUL_BODY - a * b mod x^N + R with the carry-less multiply CLMUL
+ *
+ * The 2N-bit product H*x^N + L is folded with x^N = R twice. Each fold
+ * shortens the overflow by N - deg R bits, so two folds are enough as
+ * long as deg R < N/2, which GF2N_CLMUL_DEFINE checks at compile time.
+ */
+#define GF2N_MUL_BODY(type, N, R, CLMUL, a, b) do { \
+    const int RBITS = 64 - __builtin_clzll(R); \
+    uint64_t h, l, t, u; \
+    CLMUL(a, b, N, &h, &l); \
+    if(N == 64){ \
+        CLMUL(h, R, RBITS, &t, &u); l ^= u; \
+        CLMUL(t, R, RBITS, &h, &u); l ^= u; \
+    } \
+    else{ \
+        CLMUL(l >> (N & 63), R, RBITS, &h, &u); l = (l & (((uint64_t)1 << (N & 63)) - 1)) ^ u; \
+        CLMUL(l >> (N & 63), R, RBITS, &h, &u); l = (l & (((uint64_t)1 << (N & 63)) - 1)) ^ u; \
+    } \
+    return (type)l; \
+} while(0)
+
+/*
+ * name_pow() and name_inv() shared by every field; a^-1 = a^(2^N - 2)
+ */
+#define GF2N_POW_DEFINE(name, type, N) \
+type name##_pow(type a, uint64_t e) \
+{ \
+    type r = 1; \
+    while(e > 0){ \
+        if(e & 1) \
+            r = name##_mul(r, a); \
+        e = e >> 1; \
+        a = name##_mul(a, a); \
+    } \
+    return r; \
+} \
+type name##_inv(type a) \
+{ \
+    return name##_pow(a, (N == 64 ? 0 : (uint64_t)1 << (N & 63)) - 2); \
+}
+
+#ifdef GF2N_X86
+#define GF2N_CLMUL_HW(name, type, N, R) \
+__attribute__((target("pclmul,sse2"))) \
+static type name##_mul_hw(type a, type b) \
+{ \
+    GF2N_MUL_BODY(type, N, R, clmul_hw, a, b); \
+}
+#define GF2N_CLMUL_DISPATCH(name, a, b) \
+    if(use_pclmul) \
+        return name##_mul_hw(a, b);
+#else
+#define GF2N_CLMUL_HW(name, type, N, R)
+#define GF2N_CLMUL_DISPATCH(name, a, b)
+#endif
+
+/*
+ * GF2N_CLMUL_DEFINE - field GF(2^N) mod x^N + R on carry-less multiplies,
+ * PCLMULQDQ when the CPU has it, clmul_sw() otherwise
+ */
+#define GF2N_CLMUL_DEFINE(name, type, N, R) \
+_Static_assert((uint64_t)(R) < ((uint64_t)1 << (N)/2), #name ": deg R must be < N/2"); \
+static type name##_mul_sw(type a, type b) \
+{ \
+    GF2N_MUL_BODY(type, N, R, clmul_sw, a, b); \
+} \
+GF2N_CLMUL_HW(name, type, N, R) \
+type name##_mul(type a, type b) \
+{ \
+    GF2N_CLMUL_DISPATCH(name, a, b) \
+    return name##_mul_sw(a, b); \
+} \
+GF2N_POW_DEFINE(name, type, N)
+
+/*
+ * GF2N_TABLE_DEFINE - small field GF(2^N) mod P with log/exp tables
+ * The tables are filled at startup from the first generator found, so
+ * P only has to be irreducible, not primitive.
+ */
+#define GF2N_TABLE_DEFINE(name, type, N, P) \
+static type name##_logt[1 << (N)]; \
+static type name##_expt[2 << (N)]; \
+static type name##_xmul(type a, type b) \
+{ \
+    unsigned r = 0, x = a; \
+    while(b > 0){ \
+        if(b & 1) \
+            r ^= x; \
+        b = b >> 1; \
+        x = (x << 1) ^ ((x >> ((N)-1)) & 1 ? (P) : 0); \
+    } \
+    return r; \
+} \
+__attribute__((constructor)) \
+static void name##_init(void) \
+{ \
+    unsigned g, x, i; \
+    for(g=2;g<(1u << (N));g++){ \
+        for(x=g, i=1; x!=1; i++) \
+            x = name##_xmul(x, g); \
+        if(i == (1u << (N)) - 1) \
+            break; \
+    } \
+    for(x=1, i=0; i<(1u << (N))-1; i++){ \
+        name##_expt[i] = name##_expt[i + (1u << (N)) - 1] = x; \
+        name##_logt[x] = i; \
+        x = name##_xmul(x, g); \
+    } \
+} \
+type name##_mul(type a, type b) \
+{ \
+    if(a==0 || b==0) \
+        return 0; \
+    return name##_expt[name##_logt[a] + name##_logt[b]]; \
+} \
+GF2N_POW_DEFINE(name, type, N)
+
+GF2N_TABLE_DEFINE(gf2_8, uint8_t, 8, 0x11B)
+GF2N_CLMUL_DEFINE(gf2_16, uint16_t, 16, 0x2D)
+GF2N_CLMUL_DEFINE(gf2_32, uint32_t, 32, 0x8D)
+GF2N_CLMUL_DEFINE(gf2_64, uint64_t, 64, 0x1B)
+
+/*
+ * gf2n_select_pclmul() - turn the PCLMULQDQ kernels on or off, or back to
+ * the default with GF2N_PCLMUL_AUTO (on if the CPU supports them).
+ * It returns 0 on success, -1 if on is requested but not supported.
+ */
+int gf2n_select_pclmul(int on)
+{
+#ifdef GF2N_X86
+    __builtin_cpu_init();
+    if(on == GF2N_PCLMUL_AUTO)
+        on = __builtin_cpu_supports("pclmul");
+    if(on && !__builtin_cpu_supports("pclmul"))
+        return -1;
+    use_pclmul = on != 0;
+    return 0;
+#else
+    use_pclmul = 0;
+    return on > 0 ? -1 : 0;
+#endif
+}
+
+__attribute__((constructor))
+static void gf2n_init(void)
+{
+    gf2n_select_pclmul(GF2N_PCLMUL_AUTO);
+}
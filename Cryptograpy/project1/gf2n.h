@@ -0,0 +1,31 @@
+#ifndef GF2N_H
+#define GF2N_H
+
+#include <stdint.h>
+
+/*
+ * Binary fields GF(2^n) with a fixed reduction polynomial per instance.
+ * Each field is stamped out from the same code in gf2n.c with the
+ * polynomial as a compile-time constant, so there is no runtime branch on it.
+ *
+ *   gf2_8  : x^8  + x^4 + x^3 + x + 1        (AES, log/exp tables)
+ *   gf2_16 : x^16 + x^5 + x^3 + x^2 + 1      (erasure coding)
+ *   gf2_32 : x^32 + x^7 + x^3 + x^2 + 1
+ *   gf2_64 : x^64 + x^4 + x^3 + x + 1        (GHASH-style 64-bit field)
+ */
+#define GF2N_DECLARE(name, type) \
+    type name##_mul(type a, type b); \
+    type name##_pow(type a, uint64_t e); \
+    type name##_inv(type a);
+
+GF2N_DECLARE(gf2_8, uint8_t)
+GF2N_DECLARE(gf2_16, uint16_t)
+GF2N_DECLARE(gf2_32, uint32_t)
+GF2N_DECLARE(gf2_64, uint64_t)
+
+/* on for gf2n_select_pclmul(): use PCLMULQDQ if the CPU has it (the default) */
+#define GF2N_PCLMUL_AUTO -1
+
+int gf2n_select_pclmul(int on);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef GF8_H
+#define GF8_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+extern const uint8_t gf8_log[256];
+extern const uint8_t gf8_exp[512];
+
+/* table-driven field operations (fast, data-dependent memory access) */
+uint8_t gf8_mul(uint8_t a, uint8_t b);
+uint8_t gf8_pow(uint8_t a, uint8_t b);
+uint8_t gf8_inv(uint8_t a);
+
+/* constant-time field operations (no secret-dependent branches or lookups) */
+uint8_t gf8_mul_ct(uint8_t a, uint8_t b);
+uint8_t gf8_inv_ct(uint8_t a);
+
+/* region kernels for gf8_region_select() */
+#define GF8_KERNEL_AUTO -1
+#define GF8_KERNEL_PORTABLE 0
+#define GF8_KERNEL_SSSE3 1
+#define GF8_KERNEL_AVX2 2
+
+/* bulk operations over byte buffers, dispatched to a SIMD kernel at runtime */
+void gf8_region_mul(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len);
+void gf8_region_mul_xor(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len);
+int gf8_region_select(int k);
+const char *gf8_region_name(void);
+
+#endif
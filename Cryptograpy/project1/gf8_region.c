@@ -0,0 +1,185 @@
+#include <string.h>
+#include "gf8.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GF8_X86
+#endif
+
+/*
+ * Region kernels compute dst[i] = c * src[i] (acc == 0) or
+ * dst[i] ^= c * src[i] (acc != 0) over len bytes.
+ *
+ * The SIMD kernels use the split-nibble method: c * x = lo[x & 0xf] ^ hi[x >> 4]
+ * where lo[i] = c * i and hi[i] = c * (i << 4). Both 16-entry tables fit in
+ * one register and pshufb performs 16 (or 32) lookups per instruction.
+ */
+typedef void (*region_fn)(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len, int acc);
+
+static void region_tail(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len, int acc)
+{
+    if(acc){
+        for(size_t i=0;i<len;i++)
+            dst[i] ^= gf8_mul(c, src[i]);
+    }
+    else{
+        for(size_t i=0;i<len;i++)
+            dst[i] = gf8_mul(c, src[i]);
+    }
+}
+
+static void region_portable(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len, int acc)
+{
+    uint8_t t[256];
+
+    if(len < 256){
+        region_tail(dst, src, c, len, acc);
+        return;
+    }
+    for(int i=0;i<256;i++)
+        t[i] = gf8_mul(c, i);
+    if(acc){
+        for(size_t i=0;i<len;i++)
+            dst[i] ^= t[src[i]];
+    }
+    else{
+        for(size_t i=0;i<len;i++)
+            dst[i] = t[src[i]];
+    }
+}
+
+#ifdef GF8_X86
+static void nibble_tables(uint8_t c, uint8_t *lo, uint8_t *hi)
+{
+    for(int i=0;i<16;i++){
+        lo[i] = gf8_mul(c, i);
+        hi[i] = gf8_mul(c, i<<4);
+    }
+}
+
+__attribute__((target("ssse3")))
+static void region_ssse3(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len, int acc)
+{
+    uint8_t lo[16], hi[16];
+    size_t i = 0;
+
+    nibble_tables(c, lo, hi);
+    __m128i tlo = _mm_loadu_si128((const __m128i *)lo);
+    __m128i thi = _mm_loadu_si128((const __m128i *)hi);
+    __m128i mask = _mm_set1_epi8(0x0f);
+
+    for(;i+16<=len;i+=16){
+        __m128i x = _mm_loadu_si128((const __m128i *)(src+i));
+        __m128i p = _mm_xor_si128(_mm_shuffle_epi8(tlo, _mm_and_si128(x, mask)),
+                                  _mm_shuffle_epi8(thi, _mm_and_si128(_mm_srli_epi64(x, 4), mask)));
+        if(acc)
+            p = _mm_xor_si128(p, _mm_loadu_si128((const __m128i *)(dst+i)));
+        _mm_storeu_si128((__m128i *)(dst+i), p);
+    }
+    region_tail(dst+i, src+i, c, len-i, acc);
+}
+
+__attribute__((target("avx2")))
+static void region_avx2(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len, int acc)
+{
+    uint8_t lo[16], hi[16];
+    size_t i = 0;
+
+    nibble_tables(c, lo, hi);
+    __m256i tlo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)lo));
+    __m256i thi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)hi));
+    __m256i mask = _mm256_set1_epi8(0x0f);
+
+    /* two independent 32-byte lanes per iteration to hide pshufb latency */
+    for(;i+64<=len;i+=64){
+        __m256i x0 = _mm256_loadu_si256((const __m256i *)(src+i));
+        __m256i x1 = _mm256_loadu_si256((const __m256i *)(src+i+32));
+        __m256i p0 = _mm256_xor_si256(_mm256_shuffle_epi8(tlo, _mm256_and_si256(x0, mask)),
+                                      _mm256_shuffle_epi8(thi, _mm256_and_si256(_mm256_srli_epi64(x0, 4), mask)));
+        __m256i p1 = _mm256_xor_si256(_mm256_shuffle_epi8(tlo, _mm256_and_si256(x1, mask)),
+                                      _mm256_shuffle_epi8(thi, _mm256_and_si256(_mm256_srli_epi64(x1, 4), mask)));
+        if(acc){
+            p0 = _mm256_xor_si256(p0, _mm256_loadu_si256((const __m256i *)(dst+i)));
+            p1 = _mm256_xor_si256(p1, _mm256_loadu_si256((const __m256i *)(dst+i+32)));
+        }
+        _mm256_storeu_si256((__m256i *)(dst+i), p0);
+        _mm256_storeu_si256((__m256i *)(dst+i+32), p1);
+    }
+    for(;i+32<=len;i+=32){
+        __m256i x = _mm256_loadu_si256((const __m256i *)(src+i));
+        __m256i p = _mm256_xor_si256(_mm256_shuffle_epi8(tlo, _mm256_and_si256(x, mask)),
+                                     _mm256_shuffle_epi8(thi, _mm256_and_si256(_mm256_srli_epi64(x, 4), mask)));
+        if(acc)
+            p = _mm256_xor_si256(p, _mm256_loadu_si256((const __m256i *)(dst+i)));
+        _mm256_storeu_si256((__m256i *)(dst+i), p);
+    }
+    region_tail(dst+i, src+i, c, len-i, acc);
+}
+#endif
+
+static const char *kernel_name[] = {"portable", "ssse3", "avx2"};
+static int kernel_id;
+static region_fn kernel = region_portable;
+
+/*
+ * gf8_region_select() - force a region kernel (GF8_KERNEL_*),
+ * or pick the best one the CPU supports with GF8_KERNEL_AUTO.
+ * It returns 0 on success, -1 if the CPU does not support the kernel.
+ */
+int gf8_region_select(int k)
+{
+#ifdef GF8_X86
+    __builtin_cpu_init();
+    if(k == GF8_KERNEL_AUTO)
+        k = __builtin_cpu_supports("avx2") ? GF8_KERNEL_AVX2 :
+            __builtin_cpu_supports("ssse3") ? GF8_KERNEL_SSSE3 : GF8_KERNEL_PORTABLE;
+    if(k == GF8_KERNEL_AVX2 && __builtin_cpu_supports("avx2"))
+        kernel = region_avx2;
+    else if(k == GF8_KERNEL_SSSE3 && __builtin_cpu_supports("ssse3"))
+        kernel = region_ssse3;
+    else if(k == GF8_KERNEL_PORTABLE)
+        kernel = region_portable;
+    else
+        return -1;
+#else
+    if(k == GF8_KERNEL_AUTO)
+        k = GF8_KERNEL_PORTABLE;
+    if(k != GF8_KERNEL_PORTABLE)
+        return -1;
+    kernel = region_portable;
+#endif
+    kernel_id = k;
+    return 0;
+}
+
+// gf8_region_name() - name of the region kernel currently in use
+const char *gf8_region_name(void)
+{
+    return kernel_name[kernel_id];
+}
+
+__attribute__((constructor))
+static void gf8_region_init(void)
+{
+    gf8_region_select(GF8_KERNEL_AUTO);
+}
+
+// gf8_region_mul() - dst = c * src over len bytes (dst may equal src)
+void gf8_region_mul(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len)
+{
+    if(c == 0)
+        memset(dst, 0, len);
+    else if(c == 1){
+        if(dst != src)
+            memmove(dst, src, len);
+    }
+    else
+        kernel(dst, src, c, len, 0);
+}
+
+// gf8_region_mul_xor() - dst ^= c * src over len bytes
+void gf8_region_mul_xor(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len)
+{
+    if(c != 0)
+        kernel(dst, src, c, len, 1);
+}
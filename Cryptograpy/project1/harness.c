@@ -0,0 +1,299 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "euclid.h"
+#include "gf8.h"
+
+/*
+ * Parallel property-test and throughput harness
+ *
+ * usage: harness [-t threads] [-n cases] [-s seed]
+ *
+ * Every primitive is checked on n random cases split evenly over the
+ * threads. Each thread draws its operands from its own xoshiro256**
+ * generator seeded from (seed, thread id) and takes n/threads cases, so
+ * a failing run is replayed by passing the printed seed with -s and the
+ * same thread count with -t. Throughput is measured in a separate pass
+ * that reruns only the primitive on the operands each block of checks
+ * drew, and is summed over the threads.
+ */
+#define MAX_THREADS 256
+#define TIME_BLOCK 1024     /* cases checked, then timed, per round */
+
+typedef struct {
+    uint64_t s[4];
+} rng_t;
+
+struct failure {
+    int found;
+    uint64_t a, b;
+};
+
+struct property {
+    const char *name;
+    int (*check)(rng_t *r, uint64_t *a, uint64_t *b);
+    uint64_t (*op)(uint64_t a, uint64_t b);
+};
+
+struct worker {
+    const struct property *p;
+    uint64_t seed, n, fails, sink;
+    double busy;
+    struct failure first;
+};
+
+static uint64_t splitmix64(uint64_t *x)
+{
+    uint64_t z = (*x += 0x9e3779b97f4a7c15u);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9u;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebu;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t rotl(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+// rng_next() - xoshiro256**
+static inline uint64_t rng_next(rng_t *r)
+{
+    uint64_t *s = r->s, v = rotl(s[1] * 5, 7) * 9, t = s[1] << 17;
+
+    s[2] ^= s[0]; s[3] ^= s[1]; s[1] ^= s[2]; s[0] ^= s[3];
+    s[2] ^= t; s[3] = rotl(s[3], 45);
+    return v;
+}
+
+/* random operand of random bit length, so small and edge-sized inputs show up */
+static inline uint64_t rng_bits(rng_t *r)
+{
+    uint64_t v = rng_next(r);
+    return v >> (v & 63);
+}
+
+/*
+ * Properties: each draws its own operands, stores them in a, b and
+ * returns nonzero if the primitive got them wrong
+ */
+static int check_gcd(rng_t *r, uint64_t *a, uint64_t *b)
+{
+    int x = (*a = rng_next(r) & 0x7fffffff), y = (*b = rng_next(r) & 0x7fffffff);
+    int d = gcd(x, y);
+
+    if(d == 0)
+        return x != 0 || y != 0;
+    return x % d != 0 || y % d != 0 || gcd(x/d, y/d) != 1;
+}
+
+static int check_xgcd(rng_t *r, uint64_t *a, uint64_t *b)
+{
+    int x = (*a = rng_next(r) & 0x7fffffff), y = (*b = rng_next(r) & 0x7fffffff), s, t;
+    int d = xgcd(x, y, &s, &t);
+
+    return (int64_t)x*s + (int64_t)y*t != d || d != gcd(x, y);
+}
+
+static int check_mul_inv(rng_t *r, uint64_t *a, uint64_t *b)
+{
+    int x = (*a = rng_next(r) & 0x7fffffff), m = (*b = (rng_next(r) & 0x7fffffff) | 2);
+    int i = mul_inv(x, m);
+
+    if(gcd(x, m) != 1)
+        return i != 0;
+    return i <= 0 || i >= m || (int64_t)x*i % m != 1;
+}
+
+static int check_umul_inv(rng_t *r, uint64_t *a, uint64_t *b)
+{
+    uint64_t m = rng_next(r) >> 1, x, i;
+
+    /* half of the cases use a power of two modulus */
+    if(m & 1)
+        m = (uint64_t)1 << (m % 63 + 1);
+    m |= 2;
+    *a = x = rng_next(r) % m;
+    *b = m;
+    i = umul_inv(x, m);
+    if(gcd64(x, m) != 1)
+        return i != 0;
+    return i >= m || (unsigned __int128)x*i % m != 1;
+}
+
+static int check_gcd64(rng_t *r, uint64_t *a, uint64_t *b)
+{
+    uint64_t x = (*a = rng_bits(r)), y = (*b = rng_bits(r)), d = gcd64(x, y);
+
+    if(d == 0)
+        return x != 0 || y != 0;
+    return x % d != 0 || y % d != 0 || gcd64(x/d, y/d) != 1;
+}
+
+static int check_xgcd64(rng_t *r, uint64_t *a, uint64_t *b)
+{
+    uint64_t x = (*a = rng_bits(r)), y = (*b = rng_bits(r));
+    int64_t s, t;
+    uint64_t d = xgcd64(x, y, &s, &t);
+
+    return (__int128)x*s + (__int128)y*t != d || d != gcd64(x, y);
+}
+
+static int check_gf8_mul(rng_t *r, uint64_t *a, uint64_t *b)
+{
+    uint64_t v = rng_next(r);
+    uint8_t x = v, y = v >> 8, z = v >> 16;
+
+    *a = x, *b = y;
+    return gf8_mul(x, y) != gf8_mul(y, x) ||
+           gf8_mul(x, y ^ z) != (gf8_mul(x, y) ^ gf8_mul(x, z)) ||
+           gf8_mul(gf8_mul(x, y), z) != gf8_mul(x, gf8_mul(y, z)) ||
+           gf8_mul(x, y) != gf8_mul_ct(x, y);
+}
+
+static int check_gf8_inv(rng_t *r, uint64_t *a, uint64_t *b)
+{
+    uint8_t x = rng_next(r);
+
+    *a = x, *b = 0;
+    if(x == 0)
+        return gf8_inv(x) != 0 || gf8_inv_ct(x) != 0;
+    return gf8_mul(x, gf8_inv(x)) != 1 || gf8_inv_ct(x) != gf8_inv(x) ||
+           gf8_pow(x, 0xfe) != gf8_inv(x);
+}
+
+/* Primitives alone, replayed on the operands a check drew */
+static uint64_t op_gcd(uint64_t a, uint64_t b) { return gcd(a, b); }
+static uint64_t op_xgcd(uint64_t a, uint64_t b) { int s, t; return xgcd(a, b, &s, &t) + s; }
+static uint64_t op_mul_inv(uint64_t a, uint64_t b) { return mul_inv(a, b); }
+static uint64_t op_umul_inv(uint64_t a, uint64_t b) { return umul_inv(a, b); }
+static uint64_t op_gcd64(uint64_t a, uint64_t b) { return gcd64(a, b); }
+static uint64_t op_xgcd64(uint64_t a, uint64_t b) { int64_t s, t; return xgcd64(a, b, &s, &t) + s; }
+static uint64_t op_gf8_mul(uint64_t a, uint64_t b) { return gf8_mul(a, b); }
+static uint64_t op_gf8_inv(uint64_t a, uint64_t b) { (void)b; return gf8_inv(a); }
+
+static const struct property props[] = {
+    {"gcd", check_gcd, op_gcd},
+    {"xgcd", check_xgcd, op_xgcd},
+    {"mul_inv", check_mul_inv, op_mul_inv},
+    {"umul_inv", check_umul_inv, op_umul_inv},
+    {"gcd64", check_gcd64, op_gcd64},
+    {"xgcd64", check_xgcd64, op_xgcd64},
+    {"gf8_mul", check_gf8_mul, op_gf8_mul},
+    {"gf8_inv", check_gf8_inv, op_gf8_inv},
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * run_worker() - check w->n cases, then time the primitive alone
+ * Each round checks up to TIME_BLOCK cases, keeping their operands, and
+ * replays just p->op on them; only the replay counts towards w->busy.
+ */
+static void *run_worker(void *p)
+{
+    struct worker *w = p;
+    uint64_t sm = w->seed, a[TIME_BLOCK], b[TIME_BLOCK], acc = 0;
+    uint64_t (*op)(uint64_t, uint64_t) = w->p->op;
+    double t;
+    rng_t r;
+
+    for(int i=0;i<4;i++)
+        r.s[i] = splitmix64(&sm);
+    for(uint64_t done=0;done<w->n;){
+        uint64_t k = w->n - done < TIME_BLOCK ? w->n - done : TIME_BLOCK;
+        for(uint64_t i=0;i<k;i++){
+            if(w->p->check(&r, &a[i], &b[i])){
+                if(w->fails++ == 0){
+                    w->first.found = 1;
+                    w->first.a = a[i];
+                    w->first.b = b[i];
+                }
+            }
+        }
+        t = now();
+        for(uint64_t i=0;i<k;i++)
+            acc += op(a[i], b[i]);
+        w->busy += now() - t;
+        done += k;
+    }
+    w->sink = acc;
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    static struct worker w[MAX_THREADS];
+    pthread_t tid[MAX_THREADS];
+    uint64_t n = 1 << 24, seed, fails, total_fails = 0;
+    int nt = sysconf(_SC_NPROCESSORS_ONLN), opt, t;
+    double mops;
+
+    arc4random_buf(&seed, sizeof(seed));
+    while((opt = getopt(argc, argv, "t:n:s:")) != -1){
+        switch(opt){
+        case 't': nt = atoi(optarg); break;
+        case 'n': n = strtoull(optarg, NULL, 0); break;
+        case 's': seed = strtoull(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "usage: %s [-t threads] [-n cases] [-s seed]\n", argv[0]);
+            return 2;
+        }
+    }
+    if(nt < 1)
+        nt = 1;
+    if(nt > MAX_THREADS)
+        nt = MAX_THREADS;
+
+    printf("seed 0x%016llx, %d threads, %llu cases per primitive\n",
+           (unsigned long long)seed, nt, (unsigned long long)n);
+    printf("%-10s %14s %10s %12s\n", "primitive", "cases", "failures", "Mops/s");
+    for(size_t p=0;p<sizeof(props)/sizeof(props[0]);p++){
+        for(t=0;t<nt;t++){
+            memset(&w[t], 0, sizeof(w[t]));
+            w[t].p = &props[p];
+            w[t].seed = seed ^ ((uint64_t)p << 56) ^ (uint64_t)t << 32;
+            w[t].n = n/nt + (t < (int)(n%nt));
+        }
+        for(t=1;t<nt;t++)
+            if(pthread_create(&tid[t], NULL, run_worker, &w[t]) != 0){
+                run_worker(&w[t]);
+                tid[t] = 0;
+            }
+        run_worker(&w[0]);
+        for(t=1;t<nt;t++)
+            if(tid[t])
+                pthread_join(tid[t], NULL);
+
+        fails = 0;
+        mops = 0;
+        for(t=0;t<nt;t++){
+            fails += w[t].fails;
+            if(w[t].busy > 0)
+                mops += w[t].n / w[t].busy * 1e-6;
+        }
+        printf("%-10s %14llu %10llu %12.2f\n", props[p].name, (unsigned long long)n,
+               (unsigned long long)fails, mops);
+        for(t=0;t<nt;t++)
+            if(w[t].first.found){
+                printf("  first failure: a = %llu, b = %llu, replay with -s 0x%016llx -t %d\n",
+                       (unsigned long long)w[t].first.a, (unsigned long long)w[t].first.b,
+                       (unsigned long long)seed, nt);
+                break;
+            }
+        total_fails += fails;
+    }
+    if(total_fails){
+        printf("Logic error\n");
+        return 1;
+    }
+    printf("No error found\n");
+    return 0;
+}
@@ -0,0 +1,294 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "gf8.h"
+#include "rs.h"
+
+#define RS_CHUNK 0x4000             /* bytes of each output row kept hot while k inputs stream by */
+
+struct rs_cache_entry {
+    int valid;
+    uint8_t mask[RS_MAX_SHARDS/8];  /* present shards of the erasure pattern */
+    uint8_t *mat;                   /* (missing shards) x k decode matrix */
+};
+
+struct rs_ctx {
+    int k, m, nthreads;
+    uint8_t *enc;                   /* (k+m) x k encoding matrix, top k rows = identity */
+    struct rs_cache_entry cache[RS_CACHE_SIZE];
+    int next;                       /* round-robin victim */
+    pthread_mutex_t lock;
+};
+
+struct rs_job {
+    const uint8_t *mat;
+    int rows, cols;
+    const uint8_t **in;
+    uint8_t **out;
+    size_t off, len;
+};
+
+/*
+ * matrix_mul() - c = a * b over GF(2^8), a is n x k, b is k x p
+ */
+static void matrix_mul(const uint8_t *a, const uint8_t *b, uint8_t *c, int n, int k, int p)
+{
+    for(int i=0;i<n;i++){
+        memset(c+i*p, 0, p);
+        for(int j=0;j<k;j++)
+            gf8_region_mul_xor(c+i*p, b+j*p, a[i*k+j], p);
+    }
+}
+
+/*
+ * matrix_invert() - inv = a^-1 over GF(2^8) by Gauss-Jordan elimination
+ * a is n x n and left untouched. It returns 0 on success, -1 if a is singular.
+ */
+static int matrix_invert(const uint8_t *a, uint8_t *inv, int n)
+{
+    uint8_t *w = malloc(n*n), *t = malloc(n);
+    int r, c, p;
+
+    memcpy(w, a, n*n);
+    memset(inv, 0, n*n);
+    for(r=0;r<n;r++)
+        inv[r*n+r] = 1;
+    for(c=0;c<n;c++){
+        for(p=c;p<n && w[p*n+c]==0;p++)
+            ;
+        if(p==n){
+            free(w); free(t);
+            return -1;
+        }
+        if(p!=c){
+            memcpy(t, w+p*n, n); memcpy(w+p*n, w+c*n, n); memcpy(w+c*n, t, n);
+            memcpy(t, inv+p*n, n); memcpy(inv+p*n, inv+c*n, n); memcpy(inv+c*n, t, n);
+        }
+        uint8_t s = gf8_inv(w[c*n+c]);
+        gf8_region_mul(w+c*n, w+c*n, s, n);
+        gf8_region_mul(inv+c*n, inv+c*n, s, n);
+        for(r=0;r<n;r++){
+            uint8_t f = w[r*n+c];
+            if(r==c || f==0)
+                continue;
+            gf8_region_mul_xor(w+r*n, w+c*n, f, n);
+            gf8_region_mul_xor(inv+r*n, inv+c*n, f, n);
+        }
+    }
+    free(w); free(t);
+    return 0;
+}
+
+/*
+ * rs_new() - creates a k+m code with a Cauchy or Vandermonde based matrix
+ *
+ * Cauchy:      parity row i, column j = 1 / ((k+i) + j)
+ * Vandermonde: V[r][j] = r^j for r < k+m, made systematic as V * (top k rows of V)^-1
+ *
+ * Every k x k submatrix of either matrix is invertible, so any k shards suffice.
+ * It returns NULL if k < 1, m < 0 or k+m > RS_MAX_SHARDS.
+ */
+rs_ctx *rs_new(int k, int m, int type)
+{
+    rs_ctx *rs;
+    int n = k+m;
+
+    if(k < 1 || m < 0 || n > RS_MAX_SHARDS)
+        return NULL;
+    rs = calloc(1, sizeof(rs_ctx));
+    rs->k = k;
+    rs->m = m;
+    rs->enc = malloc(n*k);
+    if(type == RS_VANDERMONDE){
+        uint8_t *v = calloc(n, k), *top = malloc(k*k);
+        for(int r=0;r<n;r++)
+            for(int j=0;j<k;j++)
+                v[r*k+j] = gf8_pow(r, j);
+        matrix_invert(v, top, k);
+        matrix_mul(v, top, rs->enc, n, k, k);
+        free(v); free(top);
+    }
+    else{
+        memset(rs->enc, 0, k*k);
+        for(int j=0;j<k;j++)
+            rs->enc[j*k+j] = 1;
+        for(int i=0;i<m;i++)
+            for(int j=0;j<k;j++)
+                rs->enc[(k+i)*k+j] = gf8_inv((k+i) ^ j);
+    }
+    rs_set_threads(rs, sysconf(_SC_NPROCESSORS_ONLN));
+    pthread_mutex_init(&rs->lock, NULL);
+    return rs;
+}
+
+void rs_free(rs_ctx *rs)
+{
+    if(rs == NULL)
+        return;
+    for(int i=0;i<RS_CACHE_SIZE;i++)
+        free(rs->cache[i].mat);
+    pthread_mutex_destroy(&rs->lock);
+    free(rs->enc);
+    free(rs);
+}
+
+// rs_set_threads() - number of threads a large encode/decode is striped over
+void rs_set_threads(rs_ctx *rs, int nthreads)
+{
+    if(nthreads < 1)
+        nthreads = 1;
+    if(nthreads > RS_MAX_THREADS)
+        nthreads = RS_MAX_THREADS;
+    rs->nthreads = nthreads;
+}
+
+/*
+ * rs_apply() - out[r] = sum mat[r][c] * in[c] on bytes [off, off+len)
+ * Works in RS_CHUNK pieces so each output chunk stays in cache while
+ * all inputs are folded into it.
+ */
+static void rs_apply(const struct rs_job *j)
+{
+    size_t end = j->off + j->len, n;
+
+    for(size_t off=j->off;off<end;off+=n){
+        n = end-off < RS_CHUNK ? end-off : RS_CHUNK;
+        for(int r=0;r<j->rows;r++){
+            const uint8_t *row = j->mat + r*j->cols;
+            gf8_region_mul(j->out[r]+off, j->in[0]+off, row[0], n);
+            for(int c=1;c<j->cols;c++)
+                gf8_region_mul_xor(j->out[r]+off, j->in[c]+off, row[c], n);
+        }
+    }
+}
+
+static void *rs_worker(void *p)
+{
+    rs_apply(p);
+    return NULL;
+}
+
+/*
+ * rs_run() - applies mat to the shards, striping the byte range over threads
+ * Each thread owns a 64-byte aligned slice of every shard, so no two threads
+ * ever write the same cache line.
+ */
+static void rs_run(rs_ctx *rs, const uint8_t *mat, int rows, const uint8_t **in, uint8_t **out, size_t len)
+{
+    struct rs_job job[RS_MAX_THREADS];
+    pthread_t tid[RS_MAX_THREADS];
+    int started[RS_MAX_THREADS];
+    size_t stripe;
+    int nt = rs->nthreads, t;
+
+    if(len / RS_MIN_PER_THREAD < (size_t)nt)
+        nt = len / RS_MIN_PER_THREAD;
+    if(nt < 1)
+        nt = 1;
+    /* ceil(len/nt) rounded up to a cache line, so nt*stripe >= len */
+    stripe = ((len + nt - 1)/nt + 63) & ~(size_t)63;
+    for(t=0;t<nt;t++){
+        job[t].mat = mat;
+        job[t].rows = rows;
+        job[t].cols = rs->k;
+        job[t].in = in;
+        job[t].out = out;
+        job[t].off = t*stripe < len ? t*stripe : len;
+        job[t].len = len - job[t].off < stripe ? len - job[t].off : stripe;
+        started[t] = 0;
+    }
+    for(t=1;t<nt;t++)
+        started[t] = pthread_create(&tid[t], NULL, rs_worker, &job[t]) == 0;
+    rs_apply(&job[0]);
+    for(t=1;t<nt;t++){
+        if(started[t])
+            pthread_join(tid[t], NULL);
+        else
+            rs_apply(&job[t]);
+    }
+}
+
+/*
+ * rs_encode() - computes m parity shards of len bytes from k data shards
+ */
+int rs_encode(rs_ctx *rs, const uint8_t **data, uint8_t **parity, size_t len)
+{
+    if(rs->m > 0)
+        rs_run(rs, rs->enc + rs->k*rs->k, rs->m, data, parity, len);
+    return 0;
+}
+
+/*
+ * rs_decode() - rebuilds every shard i with present[i] == 0 in place
+ *
+ * shards holds all k+m buffers (data first, then parity); missing ones
+ * must still point to writable memory of len bytes. The decode matrix of
+ * an erasure pattern is cached, so repeated failures of the same shards
+ * skip the matrix inversion. It returns 0 on success, -1 if fewer than k
+ * shards are present.
+ */
+int rs_decode(rs_ctx *rs, uint8_t **shards, const uint8_t *present, size_t len)
+{
+    const uint8_t *in[RS_MAX_SHARDS];
+    uint8_t *out[RS_MAX_SHARDS], mask[RS_MAX_SHARDS/8], rows[RS_MAX_SHARDS];
+    uint8_t *mat, *sub, *dec;
+    int k = rs->k, n = rs->k + rs->m, nin = 0, nmiss = 0, i, hit = 0;
+
+    memset(mask, 0, sizeof(mask));
+    for(i=0;i<n;i++){
+        if(present[i]){
+            mask[i>>3] |= 1<<(i&7);
+            if(nin < k){
+                rows[nin] = i;
+                in[nin++] = shards[i];
+            }
+        }
+        else
+            out[nmiss++] = shards[i];
+    }
+    if(nin < k)
+        return -1;
+    if(nmiss == 0)
+        return 0;
+
+    mat = malloc(nmiss*k);
+    pthread_mutex_lock(&rs->lock);
+    for(i=0;i<RS_CACHE_SIZE;i++){
+        if(rs->cache[i].valid && memcmp(rs->cache[i].mask, mask, sizeof(mask)) == 0){
+            memcpy(mat, rs->cache[i].mat, nmiss*k);
+            hit = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&rs->lock);
+
+    if(!hit){
+        /* row for missing shard i = enc[i] * (rows of enc for the shards we read)^-1 */
+        sub = malloc(k*k);
+        dec = malloc(k*k);
+        for(i=0;i<k;i++)
+            memcpy(sub+i*k, rs->enc+rows[i]*k, k);
+        matrix_invert(sub, dec, k);
+        nmiss = 0;
+        for(i=0;i<n;i++)
+            if(!present[i])
+                matrix_mul(rs->enc+i*k, dec, mat+(nmiss++)*k, 1, k, k);
+        free(sub);
+        free(dec);
+
+        pthread_mutex_lock(&rs->lock);
+        struct rs_cache_entry *e = &rs->cache[rs->next];
+        rs->next = (rs->next+1) % RS_CACHE_SIZE;
+        free(e->mat);
+        e->mat = malloc(nmiss*k);
+        memcpy(e->mat, mat, nmiss*k);
+        memcpy(e->mask, mask, sizeof(mask));
+        e->valid = 1;
+        pthread_mutex_unlock(&rs->lock);
+    }
+
+    rs_run(rs, mat, nmiss, in, out, len);
+    free(mat);
+    return 0;
+}
@@ -0,0 +1,27 @@
+#ifndef RS_H
+#define RS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Systematic Reed-Solomon erasure code over GF(2^8)
+ * k data shards + m parity shards, any k of the k+m shards rebuild the rest.
+ */
+#define RS_MAX_SHARDS 256
+#define RS_CACHE_SIZE 16
+#define RS_MAX_THREADS 64
+#define RS_MIN_PER_THREAD 0x10000   /* below this a stripe is not worth a thread */
+
+#define RS_CAUCHY 0
+#define RS_VANDERMONDE 1
+
+typedef struct rs_ctx rs_ctx;
+
+rs_ctx *rs_new(int k, int m, int type);
+void rs_free(rs_ctx *rs);
+void rs_set_threads(rs_ctx *rs, int nthreads);
+int rs_encode(rs_ctx *rs, const uint8_t **data, uint8_t **parity, size_t len);
+int rs_decode(rs_ctx *rs, uint8_t **shards, const uint8_t *present, size_t len);
+
+#endif
@@ -0,0 +1,422 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "euclid.h"
+#include "gf8.h"
+#include "rs.h"
+#include "gf2n.h"
+
+#define RS_K 8
+#define RS_M 4
+#define RS_LEN 100003
+#define NBATCH 50001
+
+/*
+ * shift/xor reference multiply in GF(2^n) mod x^n + r, independent of the
+ * carry-less kernels in gf2n.c
+ */
+static uint64_t ref_gf2n_mul(uint64_t a, uint64_t b, int n, uint64_t r)
+{
+    uint64_t p = 0, top = (uint64_t)1 << (n-1), mask = top | (top-1);
+
+    while (b > 0) {
+        if (b & 1)
+            p ^= a;
+        b = b >> 1;
+        a = ((a << 1) & mask) ^ ((a & top) ? r : 0);
+    }
+    return p;
+}
+
+int main(void)
+{
+    static uint8_t src[4099], dst[4099], ref[4099];
+    static uint8_t shard[RS_K+RS_M][RS_LEN], orig[RS_K+RS_M][RS_LEN];
+    uint8_t *sp[RS_K+RS_M], present[RS_K+RS_M];
+    int a, b, x, y, d, k, count;
+    uint64_t m, ai, ua, ub, ud;
+    int64_t sx, sy;
+    static uint64_t bin[NBATCH], bout[NBATCH];
+    size_t nbad;
+    rs_ctx *rs;
+    
+    // gcd test
+    printf("--- gcd test ---\n");
+    a = 28; b = 0;
+    printf("gcd(%d,%d) = %d\n", a, b, gcd(a,b));
+    a = 0; b = 32;
+    printf("gcd(%d,%d) = %d\n", a, b, gcd(a,b));
+    a = 41370; b = 22386;
+    printf("gcd(%d,%d) = %d\n", a, b, gcd(a,b));
+    a = 22386; b = 41371;
+    printf("gcd(%d,%d) = %d\n", a, b, gcd(a,b));
+    
+    // xgcd, mul_inv test
+    printf("--- xgcd, mul_inv test ---\n");
+    a = 41370; b = 22386;
+    d = xgcd(a, b, &x, &y);
+    printf("%d = %d * %d + %d * %d\n", d, a, x, b, y);
+    printf("%d^-1 mod %d = %d, %d^-1 mod %d = %d\n", a, b, mul_inv(a,b), b, a, mul_inv(b,a));
+    a = 41371; b = 22386;
+    d = xgcd(a, b, &x, &y);
+    printf("%d = %d * %d + %d * %d\n", d, a, x, b, y);
+    printf("%d^-1 mod %d = %d, %d^-1 mod %d = %d\n", a, b, mul_inv(a,b), b, a, mul_inv(b,a));
+    
+    /*
+     * generate random number a, b & compute xgcd
+     * if xgcd == 1, check a^-1 mod b & b^-1 mod a
+     * repeat a lot
+     */
+    printf("--- random mul_inv test ---\n"); fflush(stdout);
+    count = 0;
+    do {
+        arc4random_buf(&a, sizeof(int)); a &= 0x7fffffff;
+        arc4random_buf(&b, sizeof(int)); b &= 0x7fffffff;
+        d = xgcd(a, b, &x, &y);
+        if (d == 1) {
+            if (x < 0)
+                x = x + b;
+            else
+                y = y + a;
+            if (x != mul_inv(a, b) || y != mul_inv(b, a)) {
+                printf("Inversion error\n");
+                exit(1);
+            }
+        }
+        if (++count % 0xffff == 0) {
+            printf(".");
+            fflush(stdout);
+        }
+    } while (count < 0xfffff);
+    printf("No error found\n");
+    
+    /*
+     * gcd64 must agree with gcd on 31-bit inputs, and xgcd64 must return
+     * the gcd with an exact Bezout identity on full 64-bit inputs
+     * (checked in 128 bits), including operands of very different sizes
+     */
+    printf("--- random gcd64, xgcd64 test ---\n"); fflush(stdout);
+    count = 0;
+    do {
+        arc4random_buf(&a, sizeof(int)); a &= 0x7fffffff;
+        arc4random_buf(&b, sizeof(int)); b &= 0x7fffffff;
+        if (gcd64(a, b) != gcd(a, b)) {
+            printf("Logic error\n");
+            exit(1);
+        }
+        arc4random_buf(&ua, sizeof(uint64_t)); ua >>= arc4random_uniform(64);
+        arc4random_buf(&ub, sizeof(uint64_t)); ub >>= arc4random_uniform(64);
+        ud = xgcd64(ua, ub, &sx, &sy);
+        if (ud != gcd64(ua, ub) || (__int128)ua*sx + (__int128)ub*sy != ud ||
+            (ud != 0 && (ua % ud != 0 || ub % ud != 0))) {
+            printf("Logic error\n");
+            exit(1);
+        }
+        if (++count % 0xffff == 0) {
+            printf(".");
+            fflush(stdout);
+        }
+    } while (count < 0xfffff);
+    printf("No error found\n");
+
+    printf("--- a*b for GF(2^8)  ---\n");
+    a = 28; b = 7;
+    printf("%d * %d = %d\n", a, b, gf8_mul(a,b));
+    a = 127; b = 68;
+    printf("%d * %d = %d\n", a, b, gf8_mul(a,b));
+
+
+    printf("--- all a*b test for GF(2^8) ---\n");
+    for (a = 1; a < 256; ++a) {
+        if (a == 0) continue;
+        b = gf8_inv(a);
+        if (gf8_mul(a,b) != 1) {
+            printf("Logic error\n");
+            exit(1);
+        }
+        else {
+            printf(".");
+            fflush(stdout);
+        }
+    }
+    printf("No error found\n");
+
+    /*
+     * table-driven and constant-time paths must agree on every pair
+     */
+    printf("--- table vs constant-time test for GF(2^8) ---\n");
+    for (a = 0; a < 256; ++a) {
+        for (b = 0; b < 256; ++b)
+            if (gf8_mul(a,b) != gf8_mul_ct(a,b)) {
+                printf("Logic error\n");
+                exit(1);
+            }
+        if (gf8_inv(a) != gf8_inv_ct(a) || gf8_pow(a,0xfe) != gf8_inv(a)) {
+            printf("Logic error\n");
+            exit(1);
+        }
+    }
+    printf("No error found\n");
+
+    /*
+     * every region kernel the CPU supports must match gf8_mul byte by byte,
+     * including unaligned starts and lengths that leave a scalar tail
+     */
+    printf("--- region mul/mul_xor test for GF(2^8) ---\n");
+    for (k = GF8_KERNEL_PORTABLE; k <= GF8_KERNEL_AVX2; ++k) {
+        if (gf8_region_select(k) != 0)
+            continue;
+        printf("%s ", gf8_region_name());
+        for (count = 0; count < 256; ++count) {
+            arc4random_buf(src, sizeof(src));
+            arc4random_buf(dst, sizeof(dst));
+            a = arc4random_uniform(16);
+            b = arc4random_uniform(sizeof(src) - a);
+            for (x = 0; x < b; ++x)
+                ref[x] = dst[a+x] ^ gf8_mul(count, src[a+x]);
+            gf8_region_mul_xor(dst+a, src+a, count, b);
+            for (x = 0; x < b; ++x)
+                if (dst[a+x] != ref[x]) {
+                    printf("Logic error\n");
+                    exit(1);
+                }
+            gf8_region_mul(dst+a, src+a, count, b);
+            for (x = 0; x < b; ++x)
+                if (dst[a+x] != gf8_mul(count, src[a+x])) {
+                    printf("Logic error\n");
+                    exit(1);
+                }
+        }
+    }
+    gf8_region_select(GF8_KERNEL_AUTO);
+    printf("No error found\n");
+
+    /*
+     * 8+4 Reed-Solomon: encode, erase up to 4 random shards, rebuild them.
+     * Every pattern is decoded twice so the cached decode matrix is used too.
+     */
+    printf("--- Reed-Solomon %d+%d erasure test ---\n", RS_K, RS_M);
+    for (k = RS_CAUCHY; k <= RS_VANDERMONDE; ++k) {
+        rs = rs_new(RS_K, RS_M, k);
+        rs_set_threads(rs, 4);
+        for (x = 0; x < RS_K+RS_M; ++x)
+            sp[x] = shard[x];
+        for (x = 0; x < RS_K; ++x)
+            arc4random_buf(shard[x], RS_LEN);
+        rs_encode(rs, (const uint8_t **)sp, sp+RS_K, RS_LEN);
+        memcpy(orig, shard, sizeof(shard));
+        for (count = 0; count < 64; ++count) {
+            memset(present, 1, sizeof(present));
+            for (x = arc4random_uniform(RS_M+1); x > 0; --x)
+                present[arc4random_uniform(RS_K+RS_M)] = 0;
+            for (y = 0; y < 2; ++y) {
+                for (x = 0; x < RS_K+RS_M; ++x)
+                    if (!present[x])
+                        memset(shard[x], 0, RS_LEN);
+                if (rs_decode(rs, sp, present, RS_LEN) != 0 ||
+                    memcmp(orig, shard, sizeof(shard)) != 0) {
+                    printf("Logic error\n");
+                    exit(1);
+                }
+            }
+            printf(".");
+            fflush(stdout);
+        }
+        memset(present, 0, RS_M+1);
+        if (rs_decode(rs, sp, present, RS_LEN) != -1) {
+            printf("Logic error\n");
+            exit(1);
+        }
+        rs_free(rs);
+    }
+    /* striped over 4 threads, with a tail byte past 4 * RS_MIN_PER_THREAD */
+    {
+        size_t len = 4 * RS_MIN_PER_THREAD + 1;
+        uint8_t *big[RS_K+RS_M], *want = malloc((RS_K+RS_M) * len);
+
+        for (x = 0; x < RS_K+RS_M; ++x)
+            big[x] = malloc(len);
+        for (x = 0; x < RS_K; ++x)
+            arc4random_buf(big[x], len);
+        rs = rs_new(RS_K, RS_M, RS_CAUCHY);
+        rs_encode(rs, (const uint8_t **)big, big+RS_K, len);
+        for (x = 0; x < RS_K+RS_M; ++x)
+            memcpy(want + x*len, big[x], len);
+        rs_set_threads(rs, 4);
+        for (x = RS_K; x < RS_K+RS_M; ++x)
+            memset(big[x], 0, len);
+        rs_encode(rs, (const uint8_t **)big, big+RS_K, len);
+        memset(present, 1, sizeof(present));
+        present[0] = present[RS_K-1] = present[RS_K] = present[RS_K+RS_M-1] = 0;
+        for (x = 0; x < RS_K+RS_M; ++x)
+            if (!present[x])
+                memset(big[x], 0, len);
+        if (rs_decode(rs, big, present, len) != 0) {
+            printf("Logic error\n");
+            exit(1);
+        }
+        for (x = 0; x < RS_K+RS_M; ++x)
+            if (memcmp(big[x], want + x*len, len) != 0) {
+                printf("Logic error\n");
+                exit(1);
+            }
+        for (x = 0; x < RS_K+RS_M; ++x)
+            free(big[x]);
+        free(want);
+        rs_free(rs);
+    }
+    printf("No error found\n");
+
+    printf("--- umul_inv test ---\n");
+    a = 5; m = 9223372036854775808u;
+    ai = umul_inv(a, m);
+    printf("a = %d, m = %llu, a^-1 mod m = %llu", a, m, ai);
+    if (ai != 5534023222112865485u) {
+        printf(" <- inversion error\n");
+        exit(1);
+    }
+    else
+        printf(" OK\n");
+    a = 17; m = 9223372036854775808u;
+    ai = umul_inv(a, m);
+    printf("a = %d, m = %llu, a^-1 mod m = %llu", a, m, ai);
+    if (ai != 8138269444283625713u) {
+        printf(" <- inversion error\n");
+        exit(1);
+    }
+    else
+        printf(" OK\n");
+    a = 85; m = 9223372036854775808u;
+    ai = umul_inv(a, m);
+    printf("a = %d, m = %llu, a^-1 mod m = %llu", a, m, ai);
+    if (ai != 9006351518340545789u) {
+        printf(" <- inversion error\n");
+        exit(1);
+    }
+    else
+        printf(" OK\n");
+
+    /*
+     * inv_pow2: a * a^-1 == 1 mod 2^k for random odd a and every k,
+     * and umul_inv must dispatch to it for power of two moduli
+     */
+    printf("--- inv_pow2 test ---\n");
+    for (count = 0; count < 0xffff; ++count) {
+        unsigned __int128 wa, wi;
+        arc4random_buf(&ua, sizeof(uint64_t)); ua |= 1;
+        arc4random_buf(&ub, sizeof(uint64_t));
+        for (k = 1; k <= 64; ++k) {
+            m = k < 64 ? ((uint64_t)1 << k) - 1 : ~(uint64_t)0;
+            ai = inv_pow2(ua, k);
+            if (ai > m || ((ua * ai) & m) != 1) {
+                printf("Logic error\n");
+                exit(1);
+            }
+            if (k < 64 && umul_inv(ua & m, m + 1) != ai) {
+                printf("Logic error\n");
+                exit(1);
+            }
+        }
+        if (inv_pow2(ua - 1, 64) != 0) {
+            printf("Logic error\n");
+            exit(1);
+        }
+        wa = ((unsigned __int128)ub << 64) | ua;
+        wi = inv_pow2_128(wa, 128);
+        if (wa * wi != 1 || inv_pow2_128(wa, 100) != (wi & (((unsigned __int128)1 << 100) - 1))) {
+            printf("Logic error\n");
+            exit(1);
+        }
+    }
+    printf("No error found\n");
+
+    /*
+     * batch_inv against one xgcd64 per element, for a random odd and a
+     * random even modulus, with and without non-invertible elements
+     */
+    printf("--- batch_inv test ---\n");
+    for (count = 0; count < 8; ++count) {
+        arc4random_buf(&m, sizeof(uint64_t));
+        m = (count & 1) ? m | 1 : m & ~(uint64_t)1;
+        arc4random_buf(bin, sizeof(bin));
+        if (count & 2)
+            for (x = 0; x < 100; ++x) {
+                y = arc4random_uniform(NBATCH);
+                bin[y] = (count & 4) ? 0 : bin[y] / 6 * 6;
+            }
+        nbad = (count & 4) ? batch_inv_mt(bout, bin, NBATCH, m, 4) : batch_inv(bout, bin, NBATCH, m);
+        for (x = 0; x < NBATCH; ++x) {
+            ud = xgcd64(bin[x] % m, m, &sx, &sy);
+            ai = ud != 1 ? 0 : sx < 0 ? (uint64_t)sx + m : (uint64_t)sx;
+            if (bout[x] != ai) {
+                printf("Logic error\n");
+                exit(1);
+            }
+            nbad -= ud != 1;
+        }
+        if (nbad != 0) {
+            printf("Logic error\n");
+            exit(1);
+        }
+        printf(".");
+        fflush(stdout);
+    }
+    /* n = k*BATCH_BLOCK + 1: the last element must not be dropped by the thread split */
+    m = 0xffffffffffffffc5;     // prime
+    for (x = 0; x < NBATCH; ++x)
+        bin[x] = x + 1;
+    for (count = 2; count <= 4; ++count) {
+        y = 2 * BATCH_BLOCK + 1;
+        memset(bout, 0, y * sizeof(uint64_t));
+        if (batch_inv_mt(bout, bin, y, m, count) != 0) {
+            printf("Logic error\n");
+            exit(1);
+        }
+        for (x = 0; x < y; ++x)
+            if ((unsigned __int128)bout[x] * bin[x] % m != 1) {
+                printf("Logic error\n");
+                exit(1);
+            }
+    }
+    printf("No error found\n");
+
+    /*
+     * GF(2^n) fields: gf2_8 against gf8_mul on every pair, the others
+     * against the shift/xor reference with PCLMULQDQ on and off, plus
+     * a * a^-1 == 1
+     */
+    printf("--- GF(2^n) test ---\n");
+    for (a = 0; a < 256; ++a)
+        for (b = 0; b < 256; ++b)
+            if (gf2_8_mul(a, b) != gf8_mul(a, b) || gf2_8_inv(a) != gf8_inv(a)) {
+                printf("Logic error\n");
+                exit(1);
+            }
+    for (k = 0; k < 2; ++k) {
+        if (gf2n_select_pclmul(k) != 0)
+            continue;
+        for (count = 0; count < 0xffff; ++count) {
+            arc4random_buf(&ua, sizeof(uint64_t));
+            arc4random_buf(&ub, sizeof(uint64_t));
+            if (gf2_16_mul(ua, ub) != ref_gf2n_mul(ua & 0xffff, ub & 0xffff, 16, 0x2D) ||
+                gf2_32_mul(ua, ub) != ref_gf2n_mul(ua & 0xffffffff, ub & 0xffffffff, 32, 0x8D) ||
+                gf2_64_mul(ua, ub) != ref_gf2n_mul(ua, ub, 64, 0x1B)) {
+                printf("Logic error\n");
+                exit(1);
+            }
+            if ((count & 0xff) == 0 && ua != 0 &&
+                (gf2_16_mul(ua, gf2_16_inv(ua)) != ((uint16_t)ua != 0) ||
+                 gf2_32_mul(ua, gf2_32_inv(ua)) != ((uint32_t)ua != 0) ||
+                 gf2_64_mul(ua, gf2_64_inv(ua)) != 1)) {
+                printf("Logic error\n");
+                exit(1);
+            }
+        }
+        printf("%s ", k ? "pclmul" : "portable");
+    }
+    gf2n_select_pclmul(GF2N_PCLMUL_AUTO);
+    printf("No error found\n");
+
+    printf("Congratulations!\n");
+    return 0;
+}
@@ -2,6 +2,11 @@
 #include <string.h>
 #include "aes.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define AES_X86
+#endif
+
 static const uint8_t sbox[256] = {
   0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
   0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
@@ -44,37 +49,41 @@ static const uint8_t M[16] = {2, 3, 1, 1, 1, 2, 3, 1, 1, 1, 2, 3, 3, 1, 1, 2};
 
 static const uint8_t IM[16] = {0x0e, 0x0b, 0x0d, 0x09, 0x09, 0x0e, 0x0b, 0x0d, 0x0d, 0x09, 0x0e, 0x0b, 0x0b, 0x0d, 0x09, 0x0e};
 
+static inline uint32_t SubWord(uint32_t w)
+{
+    return sbox[w & 0xff] | sbox[(w >> 8) & 0xff] << 8 |
+           sbox[(w >> 16) & 0xff] << 16 | (uint32_t)sbox[w >> 24] << 24;
+}
+
 /*
- * Generate an AES key schedule
+ * aes_expand_key() - FIPS-197 key expansion of an nk-word key into
+ * Nb*(nk+7) round key words, for nk = 4, 6 or 8
  */
-void KeyExpansion(const uint8_t *key, uint32_t *roundKey)
+static void aes_expand_key(const uint8_t *key, int nk, uint32_t *roundKey)
 {
-    uint8_t temp[4];
-    uint8_t *k;
-    for(int i=0;i<Nk;i++)
-        roundKey[i] = key[4*i+3]<<24 ^ key[4*i+2]<<16 ^ key[4*i+1]<<8 ^ key[4*i+0];
-    uint8_t t = Nk;
-    while(t<RNDKEYSIZE){
-        /* RotWord [0 1 2 3] -> [1 2 3 0] */
-        k = (uint8_t *)(roundKey+t-1);
-        temp[0] = k[1];
-        temp[1] = k[2];
-        temp[2] = k[3];
-        temp[3] = k[0];
-        /* subword */
-        for(int i=0;i<Nk;i++)
-            temp[i] = sbox[temp[i]];
-        /* xor Rcon */
-        temp[0] = temp[0]^Rcon[t/Nk];
-        /* ex) w4 = w0 (xor) z1  */
-        roundKey[t] = roundKey[t-Nb] ^ (temp[3]<<24 ^ temp[2]<<16 ^ temp[1]<<8 ^ temp[0]);
-        /* ex) w5 = w4 (xor) w1, ... ,w7 = w6 (xor) w3 */
-        for(int i=1;i<4;i++)
-            roundKey[t+i] = roundKey[t+i-1] ^ roundKey[t+i-Nb];
-        t += Nk;
+    uint32_t temp;
+
+    for(int i=0;i<nk;i++)
+        roundKey[i] = (uint32_t)key[4*i+3]<<24 ^ key[4*i+2]<<16 ^ key[4*i+1]<<8 ^ key[4*i+0];
+    for(int i=nk;i<Nb*(nk+7);i++){
+        temp = roundKey[i-1];
+        if(i%nk == 0)
+            /* RotWord [0 1 2 3] -> [1 2 3 0], SubWord, xor Rcon */
+            temp = SubWord(temp >> 8 | temp << 24) ^ Rcon[i/nk];
+        else if(nk > 6 && i%nk == 4)
+            temp = SubWord(temp);
+        roundKey[i] = roundKey[i-nk] ^ temp;
     }
 }
 
+/*
+ * Generate an AES key schedule
+ */
+static void KeyExpansion_sw(const uint8_t *key, uint32_t *roundKey)
+{
+    aes_expand_key(key, Nk, roundKey);
+}
+
 void MixColumns(uint8_t *state, int mode);
 
 void AddRoundKey(uint8_t round, uint8_t *state, const uint32_t *roundKey, int mode){
@@ -184,10 +193,10 @@ void MixColumns(uint8_t *state, int mode){
 
 
 /*
- * AES cipher function
+ * Reference AES cipher function, byte-oriented as in FIPS-197
  * If mode is nonzero, then do encryption, otherwise do decryption.
  */
-void Cipher(uint8_t *state, const uint32_t *roundKey, int mode)
+static void Cipher_ref(uint8_t *state, const uint32_t *roundKey, int mode)
 {
     AddRoundKey(0,state,roundKey,mode);
     for(int i=1;i<Nr;i++){
@@ -201,3 +210,600 @@ void Cipher(uint8_t *state, const uint32_t *roundKey, int mode)
     ShiftRows(state,mode);
     AddRoundKey(Nr,state,roundKey,mode);
 }
+
+/*
+ * Reference decryption schedule: the round keys in reverse order with
+ * InvMixColumns applied to all but the first and the last one.
+ */
+static void InvKeyExpansion_ref(const uint32_t *roundKey, uint32_t *invRoundKey)
+{
+    uint8_t w[BLOCKLEN];
+
+    for(int r=0;r<=Nr;r++){
+        memcpy(w, roundKey + (Nr-r)*Nb, BLOCKLEN);
+        if(r>0 && r<Nr)
+            MixColumns(w,DECRYPT);
+        memcpy(invRoundKey + r*Nb, w, BLOCKLEN);
+    }
+}
+
+/*
+ * ref_enc(), ref_dec() - reference rounds for nr rounds
+ * Every round key is a plain xor; ref_dec() is the equivalent inverse
+ * cipher (FIPS-197 5.3.5) and takes the schedule from InvKeyExpansion().
+ */
+static inline __attribute__((always_inline))
+void ref_enc(uint8_t *state, const uint32_t *roundKey, int nr)
+{
+    AddRoundKey(0,state,roundKey,ENCRYPT);
+    for(int i=1;i<nr;i++){
+        SubBytes(state,ENCRYPT);
+        ShiftRows(state,ENCRYPT);
+        MixColumns(state,ENCRYPT);
+        AddRoundKey(i,state,roundKey,ENCRYPT);
+    }
+    SubBytes(state,ENCRYPT);
+    ShiftRows(state,ENCRYPT);
+    AddRoundKey(nr,state,roundKey,ENCRYPT);
+}
+
+static inline __attribute__((always_inline))
+void ref_dec(uint8_t *state, const uint32_t *invRoundKey, int nr)
+{
+    AddRoundKey(0,state,invRoundKey,ENCRYPT);
+    for(int i=1;i<nr;i++){
+        SubBytes(state,DECRYPT);
+        ShiftRows(state,DECRYPT);
+        MixColumns(state,DECRYPT);
+        AddRoundKey(i,state,invRoundKey,ENCRYPT);
+    }
+    SubBytes(state,DECRYPT);
+    ShiftRows(state,DECRYPT);
+    AddRoundKey(nr,state,invRoundKey,ENCRYPT);
+}
+
+static void InvCipher_ref(uint8_t *state, const uint32_t *invRoundKey)
+{
+    ref_dec(state, invRoundKey, Nr);
+}
+
+/*
+ * 32-bit T-table implementation
+ *
+ * The state is kept as four little-endian column words, the same layout
+ * as the round key words, so AddRoundKey is a plain xor. One round is
+ * 16 table lookups: Te0..Te3 fold SubBytes, ShiftRows and MixColumns
+ * for a byte of row 0..3 into one word, Td0..Td3 do the same for the
+ * inverse cipher. Te_r and Td_r are Te0 and Td0 rotated by 8r bits.
+ */
+static uint32_t Te0[256], Te1[256], Te2[256], Te3[256];
+static uint32_t Td0[256], Td1[256], Td2[256], Td3[256];
+
+#define ROTL8(x) (((x) << 8) | ((x) >> 24))
+
+__attribute__((constructor))
+static void aes_tables_init(void)
+{
+    for(int i=0;i<256;i++){
+        uint8_t s = sbox[i], is = isbox[i];
+        Te0[i] = gf8_mul(s,2) | s<<8 | s<<16 | (uint32_t)gf8_mul(s,3)<<24;
+        Td0[i] = gf8_mul(is,0x0e) | gf8_mul(is,0x09)<<8 | gf8_mul(is,0x0d)<<16 | (uint32_t)gf8_mul(is,0x0b)<<24;
+        Te1[i] = ROTL8(Te0[i]); Te2[i] = ROTL8(Te1[i]); Te3[i] = ROTL8(Te2[i]);
+        Td1[i] = ROTL8(Td0[i]); Td2[i] = ROTL8(Td1[i]); Td3[i] = ROTL8(Td2[i]);
+    }
+}
+
+/* InvMixColumns of one round key word: Td_r[sbox[x]] is InvMixColumns of x in row r */
+static inline uint32_t InvMixWord(uint32_t w)
+{
+    return Td0[sbox[w & 0xff]] ^ Td1[sbox[(w >> 8) & 0xff]] ^
+           Td2[sbox[(w >> 16) & 0xff]] ^ Td3[sbox[w >> 24]];
+}
+
+/*
+ * aes_invert_key() - decryption schedule of the equivalent inverse cipher
+ * (FIPS-197 5.3.5) for nr rounds: round keys in reverse order, the middle
+ * ones passed through InvMixColumns, so decryption walks it forward like
+ * encryption.
+ */
+static void aes_invert_key(const uint32_t *roundKey, int nr, uint32_t *invRoundKey)
+{
+    for(int j=0;j<Nb;j++){
+        invRoundKey[j] = roundKey[nr*Nb+j];
+        invRoundKey[nr*Nb+j] = roundKey[j];
+    }
+    for(int r=1;r<nr;r++)
+        for(int j=0;j<Nb;j++)
+            invRoundKey[r*Nb+j] = InvMixWord(roundKey[(nr-r)*Nb+j]);
+}
+
+static void InvKeyExpansion_sw(const uint32_t *roundKey, uint32_t *invRoundKey)
+{
+    aes_invert_key(roundKey, Nr, invRoundKey);
+}
+
+/*
+ * ttable_enc(), ttable_dec() - T-table rounds for nr rounds
+ * Always inlined so that every caller with a constant nr gets its own
+ * round loop with a fixed trip count.
+ */
+static inline __attribute__((always_inline))
+void ttable_dec(uint8_t *state, const uint32_t *invRoundKey, int nr)
+{
+    uint32_t s0, s1, s2, s3, t0, t1, t2, t3;
+    const uint32_t *rk = invRoundKey;
+
+    memcpy(&s0, state, 4); memcpy(&s1, state+4, 4);
+    memcpy(&s2, state+8, 4); memcpy(&s3, state+12, 4);
+    s0 ^= rk[0]; s1 ^= rk[1]; s2 ^= rk[2]; s3 ^= rk[3];
+    for(int r=1;r<nr;r++){
+        rk += Nb;
+        t0 = Td0[s0 & 0xff] ^ Td1[(s3 >> 8) & 0xff] ^ Td2[(s2 >> 16) & 0xff] ^ Td3[s1 >> 24] ^ rk[0];
+        t1 = Td0[s1 & 0xff] ^ Td1[(s0 >> 8) & 0xff] ^ Td2[(s3 >> 16) & 0xff] ^ Td3[s2 >> 24] ^ rk[1];
+        t2 = Td0[s2 & 0xff] ^ Td1[(s1 >> 8) & 0xff] ^ Td2[(s0 >> 16) & 0xff] ^ Td3[s3 >> 24] ^ rk[2];
+        t3 = Td0[s3 & 0xff] ^ Td1[(s2 >> 8) & 0xff] ^ Td2[(s1 >> 16) & 0xff] ^ Td3[s0 >> 24] ^ rk[3];
+        s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+    }
+    rk += Nb;
+    t0 = (isbox[s0 & 0xff] | isbox[(s3 >> 8) & 0xff] << 8 | isbox[(s2 >> 16) & 0xff] << 16 | (uint32_t)isbox[s1 >> 24] << 24) ^ rk[0];
+    t1 = (isbox[s1 & 0xff] | isbox[(s0 >> 8) & 0xff] << 8 | isbox[(s3 >> 16) & 0xff] << 16 | (uint32_t)isbox[s2 >> 24] << 24) ^ rk[1];
+    t2 = (isbox[s2 & 0xff] | isbox[(s1 >> 8) & 0xff] << 8 | isbox[(s0 >> 16) & 0xff] << 16 | (uint32_t)isbox[s3 >> 24] << 24) ^ rk[2];
+    t3 = (isbox[s3 & 0xff] | isbox[(s2 >> 8) & 0xff] << 8 | isbox[(s1 >> 16) & 0xff] << 16 | (uint32_t)isbox[s0 >> 24] << 24) ^ rk[3];
+    memcpy(state, &t0, 4); memcpy(state+4, &t1, 4);
+    memcpy(state+8, &t2, 4); memcpy(state+12, &t3, 4);
+}
+
+static inline __attribute__((always_inline))
+void ttable_enc(uint8_t *state, const uint32_t *roundKey, int nr)
+{
+    uint32_t s0, s1, s2, s3, t0, t1, t2, t3;
+    const uint32_t *rk = roundKey;
+
+    memcpy(&s0, state, 4); memcpy(&s1, state+4, 4);
+    memcpy(&s2, state+8, 4); memcpy(&s3, state+12, 4);
+    s0 ^= rk[0]; s1 ^= rk[1]; s2 ^= rk[2]; s3 ^= rk[3];
+    for(int r=1;r<nr;r++){
+        rk += Nb;
+        t0 = Te0[s0 & 0xff] ^ Te1[(s1 >> 8) & 0xff] ^ Te2[(s2 >> 16) & 0xff] ^ Te3[s3 >> 24] ^ rk[0];
+        t1 = Te0[s1 & 0xff] ^ Te1[(s2 >> 8) & 0xff] ^ Te2[(s3 >> 16) & 0xff] ^ Te3[s0 >> 24] ^ rk[1];
+        t2 = Te0[s2 & 0xff] ^ Te1[(s3 >> 8) & 0xff] ^ Te2[(s0 >> 16) & 0xff] ^ Te3[s1 >> 24] ^ rk[2];
+        t3 = Te0[s3 & 0xff] ^ Te1[(s0 >> 8) & 0xff] ^ Te2[(s1 >> 16) & 0xff] ^ Te3[s2 >> 24] ^ rk[3];
+        s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+    }
+    rk += Nb;
+    t0 = (sbox[s0 & 0xff] | sbox[(s1 >> 8) & 0xff] << 8 | sbox[(s2 >> 16) & 0xff] << 16 | (uint32_t)sbox[s3 >> 24] << 24) ^ rk[0];
+    t1 = (sbox[s1 & 0xff] | sbox[(s2 >> 8) & 0xff] << 8 | sbox[(s3 >> 16) & 0xff] << 16 | (uint32_t)sbox[s0 >> 24] << 24) ^ rk[1];
+    t2 = (sbox[s2 & 0xff] | sbox[(s3 >> 8) & 0xff] << 8 | sbox[(s0 >> 16) & 0xff] << 16 | (uint32_t)sbox[s1 >> 24] << 24) ^ rk[2];
+    t3 = (sbox[s3 & 0xff] | sbox[(s0 >> 8) & 0xff] << 8 | sbox[(s1 >> 16) & 0xff] << 16 | (uint32_t)sbox[s2 >> 24] << 24) ^ rk[3];
+    memcpy(state, &t0, 4); memcpy(state+4, &t1, 4);
+    memcpy(state+8, &t2, 4); memcpy(state+12, &t3, 4);
+}
+
+static void InvCipher_ttable(uint8_t *state, const uint32_t *invRoundKey)
+{
+    ttable_dec(state, invRoundKey, Nr);
+}
+
+static void Cipher_ttable(uint8_t *state, const uint32_t *roundKey, int mode)
+{
+    if(!mode){
+        /* no decryption schedule given: derive it for this block */
+        uint32_t invRoundKey[RNDKEYSIZE];
+        InvKeyExpansion_sw(roundKey, invRoundKey);
+        ttable_dec(state, invRoundKey, Nr);
+    }
+    else
+        ttable_enc(state, roundKey, Nr);
+}
+
+
+/*
+ * Round loops specialized per (key size, direction)
+ *
+ * AES_SPECIALIZE(impl, nr, attr) instantiates impl##_enc and impl##_dec
+ * with a constant round count, the C counterpart of a template on nr.
+ * aes_ctx_init() picks one pair per context, so aes_encrypt() and
+ * aes_decrypt() run a fixed loop with no key size or mode test per block.
+ */
+#define AES_SPECIALIZE(impl, nr, attr) \
+    attr static void impl##_enc##nr(uint8_t *state, const uint32_t *roundKey) \
+    { impl##_enc(state, roundKey, nr); } \
+    attr static void impl##_dec##nr(uint8_t *state, const uint32_t *invRoundKey) \
+    { impl##_dec(state, invRoundKey, nr); }
+
+AES_SPECIALIZE(ref, 10, )
+AES_SPECIALIZE(ref, 12, )
+AES_SPECIALIZE(ref, 14, )
+AES_SPECIALIZE(ttable, 10, )
+AES_SPECIALIZE(ttable, 12, )
+AES_SPECIALIZE(ttable, 14, )
+
+#ifdef AES_X86
+/*
+ * AES-NI implementation
+ *
+ * The round key words are stored in byte order, so each 4-word round key
+ * loads straight into an xmm register. AESDEC expects the equivalent
+ * inverse cipher, so decryption runs AESIMC on the middle round keys.
+ */
+__attribute__((target("aes,sse2")))
+static inline __m128i aesni_expand(__m128i k, __m128i kg)
+{
+    kg = _mm_shuffle_epi32(kg, 0xff);
+    k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+    k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+    k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+    return _mm_xor_si128(k, kg);
+}
+
+#define AESNI_EXPAND(i, rcon) \
+    k = aesni_expand(k, _mm_aeskeygenassist_si128(k, rcon)); \
+    _mm_storeu_si128((__m128i *)(roundKey + (i)*Nb), k)
+
+__attribute__((target("aes,sse2")))
+static void aesni_expand128(const uint8_t *key, uint32_t *roundKey)
+{
+    __m128i k = _mm_loadu_si128((const __m128i *)key);
+
+    _mm_storeu_si128((__m128i *)roundKey, k);
+    AESNI_EXPAND(1, 0x01); AESNI_EXPAND(2, 0x02); AESNI_EXPAND(3, 0x04);
+    AESNI_EXPAND(4, 0x08); AESNI_EXPAND(5, 0x10); AESNI_EXPAND(6, 0x20);
+    AESNI_EXPAND(7, 0x40); AESNI_EXPAND(8, 0x80); AESNI_EXPAND(9, 0x1b);
+    AESNI_EXPAND(10, 0x36);
+}
+
+static void KeyExpansion_aesni(const uint8_t *key, uint32_t *roundKey)
+{
+#if Nk == 4
+    aesni_expand128(key, roundKey);
+#else
+    KeyExpansion_sw(key, roundKey);
+#endif
+}
+
+__attribute__((target("aes,sse2")))
+static void aesni_invert_key(const uint32_t *roundKey, int nr, uint32_t *invRoundKey)
+{
+    const __m128i *rk = (const __m128i *)roundKey;
+    __m128i *dk = (__m128i *)invRoundKey;
+
+    _mm_storeu_si128(dk, _mm_loadu_si128(rk + nr));
+    for(int r=1;r<nr;r++)
+        _mm_storeu_si128(dk + r, _mm_aesimc_si128(_mm_loadu_si128(rk + nr - r)));
+    _mm_storeu_si128(dk + nr, _mm_loadu_si128(rk));
+}
+
+static void InvKeyExpansion_aesni(const uint32_t *roundKey, uint32_t *invRoundKey)
+{
+    aesni_invert_key(roundKey, Nr, invRoundKey);
+}
+
+/* aesni_enc(), aesni_dec() - AES-NI rounds for nr rounds, see ttable_enc() */
+static inline __attribute__((always_inline, target("aes,sse2")))
+void aesni_enc(uint8_t *state, const uint32_t *roundKey, int nr)
+{
+    const __m128i *rk = (const __m128i *)roundKey;
+    __m128i s = _mm_loadu_si128((const __m128i *)state);
+
+    s = _mm_xor_si128(s, _mm_loadu_si128(rk));
+    for(int r=1;r<nr;r++)
+        s = _mm_aesenc_si128(s, _mm_loadu_si128(rk + r));
+    s = _mm_aesenclast_si128(s, _mm_loadu_si128(rk + nr));
+    _mm_storeu_si128((__m128i *)state, s);
+}
+
+static inline __attribute__((always_inline, target("aes,sse2")))
+void aesni_dec(uint8_t *state, const uint32_t *invRoundKey, int nr)
+{
+    const __m128i *dk = (const __m128i *)invRoundKey;
+    __m128i s = _mm_loadu_si128((const __m128i *)state);
+
+    s = _mm_xor_si128(s, _mm_loadu_si128(dk));
+    for(int r=1;r<nr;r++)
+        s = _mm_aesdec_si128(s, _mm_loadu_si128(dk + r));
+    s = _mm_aesdeclast_si128(s, _mm_loadu_si128(dk + nr));
+    _mm_storeu_si128((__m128i *)state, s);
+}
+
+__attribute__((target("aes,sse2")))
+static void Cipher_aesni(uint8_t *state, const uint32_t *roundKey, int mode)
+{
+    if(mode){
+        aesni_enc(state, roundKey, Nr);
+        return;
+    }
+    const __m128i *rk = (const __m128i *)roundKey;
+    __m128i s = _mm_loadu_si128((const __m128i *)state);
+
+    s = _mm_xor_si128(s, _mm_loadu_si128(rk + Nr));
+    for(int r=Nr-1;r>0;r--)
+        s = _mm_aesdec_si128(s, _mm_aesimc_si128(_mm_loadu_si128(rk + r)));
+    s = _mm_aesdeclast_si128(s, _mm_loadu_si128(rk));
+    _mm_storeu_si128((__m128i *)state, s);
+}
+
+__attribute__((target("aes,sse2")))
+static void InvCipher_aesni(uint8_t *state, const uint32_t *invRoundKey)
+{
+    aesni_dec(state, invRoundKey, Nr);
+}
+
+AES_SPECIALIZE(aesni, 10, __attribute__((target("aes,sse2"))))
+AES_SPECIALIZE(aesni, 12, __attribute__((target("aes,sse2"))))
+AES_SPECIALIZE(aesni, 14, __attribute__((target("aes,sse2"))))
+
+/*
+ * Key-agile encryption: KA_LANES blocks under KA_LANES different keys
+ *
+ * Each lane derives its round keys on the fly, one round ahead of its
+ * block, so no schedule is stored. AESKEYGENASSIST is microcoded with a
+ * throughput of one per 10-30 cycles, so it is replaced by PSHUFB, which
+ * broadcasts RotWord(w3) to all four columns, and AESENCLAST with Rcon
+ * as the round key: with equal columns ShiftRows is the identity and
+ * only SubWord and the Rcon xor remain. The lanes are independent, so
+ * the key chain of one lane overlaps the AESENC of the others.
+ */
+#define KA_LANES 8
+
+#define KA_EACH(stmt) \
+    stmt(0); stmt(1); stmt(2); stmt(3); stmt(4); stmt(5); stmt(6); stmt(7)
+
+/* next 4 key words from k and kg = SubWord(...) ^ Rcon in every column */
+__attribute__((target("aes,ssse3")))
+static inline __m128i ka_next(__m128i k, __m128i kg)
+{
+    k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+    k = _mm_xor_si128(k, _mm_slli_si128(k, 8));
+    return _mm_xor_si128(k, kg);
+}
+
+#define KA_ROT _mm_set1_epi32(0x0c0f0e0d)    /* RotWord(w3) in every column */
+#define KA_SUB _mm_set1_epi32(0x0f0e0d0c)    /* w3 in every column */
+#define KA_STORE(j) _mm_storeu_si128((__m128i *)(blocks + (j)*BLOCKLEN), b##j)
+
+#define KA_LOAD128(j) \
+    k##j = _mm_loadu_si128((const __m128i *)(keys + (j)*16)); \
+    b##j = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(blocks + (j)*BLOCKLEN)), k##j)
+#define KA_KEY128(j) k##j = ka_next(k##j, _mm_aesenclast_si128(_mm_shuffle_epi8(k##j, rot), rc))
+#define KA_ENC128(j) KA_KEY128(j); b##j = _mm_aesenc_si128(b##j, k##j)
+#define KA_LAST128(j) KA_KEY128(j); b##j = _mm_aesenclast_si128(b##j, k##j)
+
+__attribute__((target("aes,ssse3")))
+static void aesni_keys128(const uint8_t *keys, uint8_t *blocks)
+{
+    __m128i k0, k1, k2, k3, k4, k5, k6, k7;
+    __m128i b0, b1, b2, b3, b4, b5, b6, b7;
+    __m128i rot = KA_ROT, rc;
+
+    KA_EACH(KA_LOAD128);
+    for(int r=1;r<10;r++){
+        rc = _mm_set1_epi32(Rcon[r]);
+        KA_EACH(KA_ENC128);
+    }
+    rc = _mm_set1_epi32(Rcon[10]);
+    KA_EACH(KA_LAST128);
+    KA_EACH(KA_STORE);
+}
+
+/*
+ * AES-256 keeps the last two round keys of each lane, a for the even
+ * rounds and c for the odd ones; the odd step is SubWord(w3) with no
+ * RotWord or Rcon. 24 live vectors spill a few on x86-64.
+ */
+#define KA_LOAD256(j) \
+    a##j = _mm_loadu_si128((const __m128i *)(keys + (j)*32)); \
+    c##j = _mm_loadu_si128((const __m128i *)(keys + (j)*32 + 16)); \
+    b##j = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(blocks + (j)*BLOCKLEN)), a##j); \
+    b##j = _mm_aesenc_si128(b##j, c##j)
+#define KA_KEYA(j) a##j = ka_next(a##j, _mm_aesenclast_si128(_mm_shuffle_epi8(c##j, rot), rc))
+#define KA_KEYC(j) c##j = ka_next(c##j, _mm_aesenclast_si128(_mm_shuffle_epi8(a##j, sub), zero))
+#define KA_ENC256(j) \
+    KA_KEYA(j); b##j = _mm_aesenc_si128(b##j, a##j); \
+    KA_KEYC(j); b##j = _mm_aesenc_si128(b##j, c##j)
+#define KA_LAST256(j) KA_KEYA(j); b##j = _mm_aesenclast_si128(b##j, a##j)
+
+__attribute__((target("aes,ssse3")))
+static void aesni_keys256(const uint8_t *keys, uint8_t *blocks)
+{
+    __m128i a0, a1, a2, a3, a4, a5, a6, a7;
+    __m128i c0, c1, c2, c3, c4, c5, c6, c7;
+    __m128i b0, b1, b2, b3, b4, b5, b6, b7;
+    __m128i rot = KA_ROT, sub = KA_SUB, zero = _mm_setzero_si128(), rc;
+
+    KA_EACH(KA_LOAD256);
+    for(int r=1;r<7;r++){
+        rc = _mm_set1_epi32(Rcon[r]);
+        KA_EACH(KA_ENC256);
+    }
+    rc = _mm_set1_epi32(Rcon[7]);
+    KA_EACH(KA_LAST256);
+    KA_EACH(KA_STORE);
+}
+#endif
+
+static void (*keyexp_impl)(const uint8_t *, uint32_t *) = KeyExpansion_sw;
+static void (*cipher_impl)(uint8_t *, const uint32_t *, int) = Cipher_ttable;
+static void (*invkeyexp_impl)(const uint32_t *, uint32_t *) = InvKeyExpansion_sw;
+static void (*invcipher_impl)(uint8_t *, const uint32_t *) = InvCipher_ttable;
+static int cur_impl = AES_TTABLE;
+
+/* [impl][(nr-10)/2] */
+static const aes_block_fn enc_table[AES_NIMPL][3] = {
+    {ref_enc10, ref_enc12, ref_enc14},
+    {ttable_enc10, ttable_enc12, ttable_enc14},
+#ifdef AES_X86
+    {aesni_enc10, aesni_enc12, aesni_enc14},
+#endif
+};
+static const aes_block_fn dec_table[AES_NIMPL][3] = {
+    {ref_dec10, ref_dec12, ref_dec14},
+    {ttable_dec10, ttable_dec12, ttable_dec14},
+#ifdef AES_X86
+    {aesni_dec10, aesni_dec12, aesni_dec14},
+#endif
+};
+
+/*
+ * aes_select() - chooses the implementation behind KeyExpansion(), Cipher(),
+ * InvKeyExpansion() and InvCipher()
+ * AES_REF is the byte-oriented reference code, AES_TTABLE the T-table
+ * code and AES_AESNI the AES-NI instructions. AES_AUTO picks AES-NI if
+ * CPUID reports it, T-tables otherwise; that is done once at startup.
+ * It returns 0 on success, -1 if impl is unknown or unsupported here.
+ */
+int aes_select(int impl)
+{
+#ifdef AES_X86
+    __builtin_cpu_init();
+    if(impl == AES_AUTO)
+        impl = __builtin_cpu_supports("aes") ? AES_AESNI : AES_TTABLE;
+#else
+    if(impl == AES_AUTO)
+        impl = AES_TTABLE;
+#endif
+    switch(impl){
+    case AES_REF:
+        keyexp_impl = KeyExpansion_sw;
+        cipher_impl = Cipher_ref;
+        invkeyexp_impl = InvKeyExpansion_ref;
+        invcipher_impl = InvCipher_ref;
+        break;
+    case AES_TTABLE:
+        keyexp_impl = KeyExpansion_sw;
+        cipher_impl = Cipher_ttable;
+        invkeyexp_impl = InvKeyExpansion_sw;
+        invcipher_impl = InvCipher_ttable;
+        break;
+#ifdef AES_X86
+    case AES_AESNI:
+        if(!__builtin_cpu_supports("aes"))
+            return -1;
+        keyexp_impl = KeyExpansion_aesni;
+        cipher_impl = Cipher_aesni;
+        invkeyexp_impl = InvKeyExpansion_aesni;
+        invcipher_impl = InvCipher_aesni;
+        break;
+#endif
+    default:
+        return -1;
+    }
+    cur_impl = impl;
+    return 0;
+}
+
+__attribute__((constructor))
+static void aes_init(void)
+{
+    aes_select(AES_AUTO);
+}
+
+/*
+ * Generate an AES key schedule
+ */
+void KeyExpansion(const uint8_t *key, uint32_t *roundKey)
+{
+    keyexp_impl(key, roundKey);
+}
+
+/*
+ * AES cipher function
+ * If mode is nonzero, then do encryption, otherwise do decryption.
+ */
+void Cipher(uint8_t *state, const uint32_t *roundKey, int mode)
+{
+    cipher_impl(state, roundKey, mode);
+}
+
+/*
+ * Generate the decryption key schedule from an encryption key schedule
+ * Done once per key, it moves the InvMixColumns of the round keys out of
+ * the per-block decryption path.
+ */
+void InvKeyExpansion(const uint32_t *roundKey, uint32_t *invRoundKey)
+{
+    invkeyexp_impl(roundKey, invRoundKey);
+}
+
+/*
+ * AES inverse cipher function using a schedule from InvKeyExpansion()
+ * Same result as Cipher(state, roundKey, DECRYPT).
+ */
+void InvCipher(uint8_t *state, const uint32_t *invRoundKey)
+{
+    invcipher_impl(state, invRoundKey);
+}
+
+/*
+ * aes_ctx_init() - expand a 128, 192 or 256-bit key into ctx
+ * Both schedules are computed here and the round loops of the
+ * implementation chosen by aes_select() are bound to the context.
+ * Returns 0 on success, -1 if keybits is not supported.
+ */
+int aes_ctx_init(aes_ctx *ctx, const uint8_t *key, int keybits)
+{
+    if(keybits != 128 && keybits != 192 && keybits != 256)
+        return -1;
+    ctx->nk = keybits / 32;
+    ctx->nr = ctx->nk + 6;
+    ctx->impl = cur_impl;
+    ctx->encrypt = enc_table[cur_impl][(ctx->nr-10)/2];
+    ctx->decrypt = dec_table[cur_impl][(ctx->nr-10)/2];
+#ifdef AES_X86
+    if(cur_impl == AES_AESNI){
+        if(ctx->nk == 4)
+            aesni_expand128(key, ctx->roundKey);
+        else
+            aes_expand_key(key, ctx->nk, ctx->roundKey);
+        aesni_invert_key(ctx->roundKey, ctx->nr, ctx->invRoundKey);
+        return 0;
+    }
+#endif
+    aes_expand_key(key, ctx->nk, ctx->roundKey);
+    aes_invert_key(ctx->roundKey, ctx->nr, ctx->invRoundKey);
+    return 0;
+}
+
+/*
+ * aes_encrypt_keys() - blocks[i] = E(keys[i], blocks[i]) for i < n
+ * Every block has its own key (keybits/8 bytes each, packed), as with
+ * per-record or per-connection keys. No aes_ctx is built: with AES-NI
+ * the schedules of 8 keys are derived inside the 8-way round loop for
+ * 128 and 256-bit keys; otherwise only the encryption schedule is
+ * expanded, into a stack buffer. Returns 0, or -1 if keybits is not
+ * supported.
+ */
+int aes_encrypt_keys(const uint8_t *keys, int keybits, uint8_t *blocks, size_t n)
+{
+    uint32_t rk[Nb*(AES_MAXNR+1)];
+    int nk = keybits / 32, nr = nk + 6, klen = keybits / 8;
+    size_t i = 0;
+
+    if(keybits != 128 && keybits != 192 && keybits != 256)
+        return -1;
+#ifdef AES_X86
+    if(cur_impl == AES_AESNI && keybits != 192 && __builtin_cpu_supports("ssse3")){
+        uint8_t kbuf[KA_LANES*32], bbuf[KA_LANES*BLOCKLEN];
+        void (*lanes)(const uint8_t *, uint8_t *) = keybits == 128 ? aesni_keys128 : aesni_keys256;
+
+        for(;i+KA_LANES<=n;i+=KA_LANES)
+            lanes(keys + i*klen, blocks + i*BLOCKLEN);
+        if(i < n){
+            /* pad the last group with zero keys rather than a scalar loop */
+            memset(kbuf, 0, sizeof(kbuf));
+            memcpy(kbuf, keys + i*klen, (n - i)*klen);
+            memset(bbuf, 0, sizeof(bbuf));
+            memcpy(bbuf, blocks + i*BLOCKLEN, (n - i)*BLOCKLEN);
+            lanes(kbuf, bbuf);
+            memcpy(blocks + i*BLOCKLEN, bbuf, (n - i)*BLOCKLEN);
+            memset(kbuf, 0, sizeof(kbuf));
+        }
+        return 0;
+    }
+#endif
+    for(;i<n;i++){
+        aes_expand_key(keys + i*klen, nk, rk);
+        enc_table[cur_impl][(nr-10)/2](blocks + i*BLOCKLEN, rk);
+    }
+    memset(rk, 0, sizeof(rk));
+    return 0;
+}
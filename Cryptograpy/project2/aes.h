@@ -2,6 +2,7 @@
 #define AES_H
 
 #include <stdint.h>
+#include <stddef.h>
 /*
  * AES128 (128 bits key, 10 rounds): Nb = 4, Nk = 4, Nr = 10
  * AES192 (192 bits key, 12 rounds): Nb = 4, Nk = 6, Nr = 12
@@ -20,7 +21,58 @@
 #define ENCRYPT 1
 #define DECRYPT 0
 
+/* implementations for aes_select() */
+#define AES_AUTO -1
+#define AES_REF 0
+#define AES_TTABLE 1
+#define AES_AESNI 2
+#define AES_NIMPL 3
+
+/*
+ * Key schedule for any of the three key sizes, independent of Nk/Nr above
+ * encrypt and decrypt are the round loops for this key size, selected
+ * by aes_ctx_init(); they are called through aes_encrypt()/aes_decrypt().
+ */
+#define AES_MAXNR 14
+
+typedef void (*aes_block_fn)(uint8_t *state, const uint32_t *roundKey);
+
+typedef struct {
+    int nk, nr;          /* key words, rounds */
+    int impl;            /* AES_REF, AES_TTABLE or AES_AESNI */
+    aes_block_fn encrypt;
+    aes_block_fn decrypt;
+    uint32_t roundKey[Nb*(AES_MAXNR+1)];
+    uint32_t invRoundKey[Nb*(AES_MAXNR+1)];   /* equivalent inverse cipher */
+} aes_ctx;
+
+/*
+ * Bitsliced encryption of 8 blocks at once, with no table lookups
+ * rk holds one 8-register bitsliced round key per round.
+ */
+typedef struct {
+    int nr;
+    uint8_t rk[(AES_MAXNR+1)*8*BLOCKLEN] __attribute__((aligned(16)));
+} aes_bs_ctx;
+
 void KeyExpansion(const uint8_t *key, uint32_t *roundKey);
 void Cipher(uint8_t *state, const uint32_t *roundKey, int mode);
+void InvKeyExpansion(const uint32_t *roundKey, uint32_t *invRoundKey);
+void InvCipher(uint8_t *state, const uint32_t *invRoundKey);
+int aes_select(int impl);
+int aes_ctx_init(aes_ctx *ctx, const uint8_t *key, int keybits);
+int aes_encrypt_keys(const uint8_t *keys, int keybits, uint8_t *blocks, size_t n);
+int aes_bs_init(aes_bs_ctx *bs, const uint32_t *roundKey, int nr);
+void aes_bs_encrypt8(const aes_bs_ctx *bs, uint8_t *blocks);
+
+static inline void aes_encrypt(const aes_ctx *ctx, uint8_t *state)
+{
+    ctx->encrypt(state, ctx->roundKey);
+}
+
+static inline void aes_decrypt(const aes_ctx *ctx, uint8_t *state)
+{
+    ctx->decrypt(state, ctx->invRoundKey);
+}
 
 #endif
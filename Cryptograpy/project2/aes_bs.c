@@ -0,0 +1,295 @@
+#include <string.h>
+#include "aes.h"
+
+/*
+ * Bitsliced AES, 8 blocks at a time (Kasper-Schwabe layout)
+ *
+ * The 128 bytes of 8 blocks are held in 8 xmm registers, one per bit:
+ * byte p of register b holds bit b of state byte p of all 8 blocks, one
+ * block per bit. ShiftRows and the row rotations of MixColumns are then
+ * byte shuffles applied to every register, and SubBytes is a Boolean
+ * circuit (Boyar-Peralta) evaluated on the 8 registers. There are no
+ * table lookups and no data dependent branches or addresses.
+ */
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+#define BS_ATTR __attribute__((target("ssse3")))
+
+/* t = ((b >> n) ^ a) & m: bit c of a <-> bit c+n of b where m is set */
+#define SWAPMOVE(a, b, m, n) do { \
+    __m128i t_ = _mm_and_si128(_mm_xor_si128(_mm_srli_epi64(b, n), a), m); \
+    a = _mm_xor_si128(a, t_); \
+    b = _mm_xor_si128(b, _mm_slli_epi64(t_, n)); \
+} while(0)
+
+/*
+ * bs_transpose() - 8x8 bit transpose inside every byte lane
+ * Before: x[j] is block j. After: bit j of byte p of x[b] is bit b of
+ * byte p of block j. The transform is its own inverse.
+ */
+BS_ATTR static inline void bs_transpose(__m128i *x)
+{
+    const __m128i m1 = _mm_set1_epi8(0x55);
+    const __m128i m2 = _mm_set1_epi8(0x33);
+    const __m128i m4 = _mm_set1_epi8(0x0f);
+
+    SWAPMOVE(x[1], x[0], m1, 1); SWAPMOVE(x[3], x[2], m1, 1);
+    SWAPMOVE(x[5], x[4], m1, 1); SWAPMOVE(x[7], x[6], m1, 1);
+    SWAPMOVE(x[2], x[0], m2, 2); SWAPMOVE(x[3], x[1], m2, 2);
+    SWAPMOVE(x[6], x[4], m2, 2); SWAPMOVE(x[7], x[5], m2, 2);
+    SWAPMOVE(x[4], x[0], m4, 4); SWAPMOVE(x[5], x[1], m4, 4);
+    SWAPMOVE(x[6], x[2], m4, 4); SWAPMOVE(x[7], x[3], m4, 4);
+}
+
+/*
+ * bs_sbox() - SubBytes on the bit registers
+ * Boyar-Peralta circuit: 32 AND, 83 XOR/XNOR; x0 is the msb.
+ */
+BS_ATTR static inline void bs_sbox(__m128i *q)
+{
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7;
+    __m128i y1, y2, y3, y4, y5, y6, y7, y8, y9, y10, y11, y12;
+    __m128i y13, y14, y15, y16, y17, y18, y19, y20, y21;
+    __m128i z0, z1, z2, z3, z4, z5, z6, z7, z8, z9, z10, z11, z12;
+    __m128i z13, z14, z15, z16, z17;
+    __m128i t0, t1, t2, t3, t4, t5, t6, t7, t8, t9, t10, t11, t12;
+    __m128i t13, t14, t15, t16, t17, t18, t19, t20, t21, t22, t23;
+    __m128i t24, t25, t26, t27, t28, t29, t30, t31, t32, t33, t34;
+    __m128i t35, t36, t37, t38, t39, t40, t41, t42, t43, t44, t45;
+    __m128i t46, t47, t48, t49, t50, t51, t52, t53, t54, t55, t56;
+    __m128i t57, t58, t59, t60, t61, t62, t63, t64, t65, t66, t67;
+    const __m128i ones = _mm_set1_epi32(-1);
+
+#define XOR _mm_xor_si128
+#define AND _mm_and_si128
+    x0 = q[7]; x1 = q[6]; x2 = q[5]; x3 = q[4];
+    x4 = q[3]; x5 = q[2]; x6 = q[1]; x7 = q[0];
+
+    /* top linear transformation */
+    y14 = XOR(x3, x5);
+    y13 = XOR(x0, x6);
+    y9 = XOR(x0, x3);
+    y8 = XOR(x0, x5);
+    t0 = XOR(x1, x2);
+    y1 = XOR(t0, x7);
+    y4 = XOR(y1, x3);
+    y12 = XOR(y13, y14);
+    y2 = XOR(y1, x0);
+    y5 = XOR(y1, x6);
+    y3 = XOR(y5, y8);
+    t1 = XOR(x4, y12);
+    y15 = XOR(t1, x5);
+    y20 = XOR(t1, x1);
+    y6 = XOR(y15, x7);
+    y10 = XOR(y15, t0);
+    y11 = XOR(y20, y9);
+    y7 = XOR(x7, y11);
+    y17 = XOR(y10, y11);
+    y19 = XOR(y10, y8);
+    y16 = XOR(t0, y11);
+    y21 = XOR(y13, y16);
+    y18 = XOR(x0, y16);
+
+    /* non-linear section */
+    t2 = AND(y12, y15);
+    t3 = AND(y3, y6);
+    t4 = XOR(t3, t2);
+    t5 = AND(y4, x7);
+    t6 = XOR(t5, t2);
+    t7 = AND(y13, y16);
+    t8 = AND(y5, y1);
+    t9 = XOR(t8, t7);
+    t10 = AND(y2, y7);
+    t11 = XOR(t10, t7);
+    t12 = AND(y9, y11);
+    t13 = AND(y14, y17);
+    t14 = XOR(t13, t12);
+    t15 = AND(y8, y10);
+    t16 = XOR(t15, t12);
+    t17 = XOR(t4, t14);
+    t18 = XOR(t6, t16);
+    t19 = XOR(t9, t14);
+    t20 = XOR(t11, t16);
+    t21 = XOR(t17, y20);
+    t22 = XOR(t18, y19);
+    t23 = XOR(t19, y21);
+    t24 = XOR(t20, y18);
+
+    t25 = XOR(t21, t22);
+    t26 = AND(t21, t23);
+    t27 = XOR(t24, t26);
+    t28 = AND(t25, t27);
+    t29 = XOR(t28, t22);
+    t30 = XOR(t23, t24);
+    t31 = XOR(t22, t26);
+    t32 = AND(t31, t30);
+    t33 = XOR(t32, t24);
+    t34 = XOR(t23, t33);
+    t35 = XOR(t27, t33);
+    t36 = AND(t24, t35);
+    t37 = XOR(t36, t34);
+    t38 = XOR(t27, t36);
+    t39 = AND(t29, t38);
+    t40 = XOR(t25, t39);
+
+    t41 = XOR(t40, t37);
+    t42 = XOR(t29, t33);
+    t43 = XOR(t29, t40);
+    t44 = XOR(t33, t37);
+    t45 = XOR(t42, t41);
+    z0 = AND(t44, y15);
+    z1 = AND(t37, y6);
+    z2 = AND(t33, x7);
+    z3 = AND(t43, y16);
+    z4 = AND(t40, y1);
+    z5 = AND(t29, y7);
+    z6 = AND(t42, y11);
+    z7 = AND(t45, y17);
+    z8 = AND(t41, y10);
+    z9 = AND(t44, y12);
+    z10 = AND(t37, y3);
+    z11 = AND(t33, y4);
+    z12 = AND(t43, y13);
+    z13 = AND(t40, y5);
+    z14 = AND(t29, y2);
+    z15 = AND(t42, y9);
+    z16 = AND(t45, y14);
+    z17 = AND(t41, y8);
+
+    /* bottom linear transformation */
+    t46 = XOR(z15, z16);
+    t47 = XOR(z10, z11);
+    t48 = XOR(z5, z13);
+    t49 = XOR(z9, z10);
+    t50 = XOR(z2, z12);
+    t51 = XOR(z2, z5);
+    t52 = XOR(z7, z8);
+    t53 = XOR(z0, z3);
+    t54 = XOR(z6, z7);
+    t55 = XOR(z16, z17);
+    t56 = XOR(z12, t48);
+    t57 = XOR(t50, t53);
+    t58 = XOR(z4, t46);
+    t59 = XOR(z3, t54);
+    t60 = XOR(t46, t57);
+    t61 = XOR(z14, t57);
+    t62 = XOR(t52, t58);
+    t63 = XOR(t49, t58);
+    t64 = XOR(z4, t59);
+    t65 = XOR(t61, t62);
+    t66 = XOR(z1, t63);
+    q[7] = XOR(t59, t63);
+    q[1] = XOR(t56, XOR(t62, ones));
+    q[0] = XOR(t48, XOR(t60, ones));
+    t67 = XOR(t64, t65);
+    q[4] = XOR(t53, t66);
+    q[3] = XOR(t51, t66);
+    q[2] = XOR(t47, t65);
+    q[6] = XOR(t64, XOR(q[4], ones));
+    q[5] = XOR(t55, XOR(t67, ones));
+#undef XOR
+#undef AND
+}
+
+/* byte p of the state is byte 4*col+row; ShiftRows: (r, c) <- (r, c+r) */
+#define BS_SHIFTROWS _mm_setr_epi8(0, 5, 10, 15, 4, 9, 14, 3, 8, 13, 2, 7, 12, 1, 6, 11)
+/* rotate the rows of each column up by one: (r, c) <- (r+1, c) */
+#define BS_ROT1 _mm_setr_epi8(1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12)
+#define BS_ROT2 _mm_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13)
+
+/*
+ * bs_mixcolumns() - out_r = 2(a_r ^ a_r+1) ^ a_r+1 ^ (a_r+2 ^ a_r+3)
+ * Multiplying by 2 moves bit b to bit b+1 and folds bit 7 back in as 0x1b.
+ */
+BS_ATTR static inline void bs_mixcolumns(__m128i *q)
+{
+    const __m128i rot1 = BS_ROT1, rot2 = BS_ROT2;
+    __m128i r[8], u[8];
+
+    for(int b=0;b<8;b++){
+        r[b] = _mm_shuffle_epi8(q[b], rot1);
+        u[b] = _mm_xor_si128(q[b], r[b]);
+    }
+    for(int b=0;b<8;b++)
+        q[b] = _mm_xor_si128(r[b], _mm_shuffle_epi8(u[b], rot2));
+    /* xtime(u) */
+    q[0] = _mm_xor_si128(q[0], u[7]);
+    q[1] = _mm_xor_si128(q[1], _mm_xor_si128(u[0], u[7]));
+    q[2] = _mm_xor_si128(q[2], u[1]);
+    q[3] = _mm_xor_si128(q[3], _mm_xor_si128(u[2], u[7]));
+    q[4] = _mm_xor_si128(q[4], _mm_xor_si128(u[3], u[7]));
+    q[5] = _mm_xor_si128(q[5], u[4]);
+    q[6] = _mm_xor_si128(q[6], u[5]);
+    q[7] = _mm_xor_si128(q[7], u[6]);
+}
+
+BS_ATTR static inline void bs_addroundkey(__m128i *q, const __m128i *rk)
+{
+    for(int b=0;b<8;b++)
+        q[b] = _mm_xor_si128(q[b], _mm_load_si128(rk + b));
+}
+
+/*
+ * aes_bs_init() - convert an expanded key to bitsliced form
+ * roundKey is KeyExpansion() or aes_ctx output for nr rounds. Every key
+ * bit becomes a byte of all zeros or all ones, so one round key takes
+ * 8 registers. Returns 0, or -1 if nr is not 10, 12 or 14 or the CPU
+ * has no SSSE3.
+ */
+int aes_bs_init(aes_bs_ctx *bs, const uint32_t *roundKey, int nr)
+{
+    const uint8_t *k = (const uint8_t *)roundKey;
+
+    __builtin_cpu_init();
+    if((nr != 10 && nr != 12 && nr != 14) || !__builtin_cpu_supports("ssse3"))
+        return -1;
+    bs->nr = nr;
+    for(int r=0;r<=nr;r++)
+        for(int b=0;b<8;b++)
+            for(int p=0;p<BLOCKLEN;p++)
+                bs->rk[(r*8+b)*BLOCKLEN+p] = -((k[r*BLOCKLEN+p] >> b) & 1);
+    return 0;
+}
+
+/*
+ * aes_bs_encrypt8() - encrypt 8 consecutive blocks (128 bytes) in place
+ */
+BS_ATTR void aes_bs_encrypt8(const aes_bs_ctx *bs, uint8_t *blocks)
+{
+    const __m128i sr = BS_SHIFTROWS;
+    const __m128i *rk = (const __m128i *)bs->rk;
+    __m128i q[8];
+
+    for(int j=0;j<8;j++)
+        q[j] = _mm_loadu_si128((const __m128i *)(blocks + j*BLOCKLEN));
+    bs_transpose(q);
+    bs_addroundkey(q, rk);
+    for(int r=1;r<bs->nr;r++){
+        bs_sbox(q);
+        for(int b=0;b<8;b++)
+            q[b] = _mm_shuffle_epi8(q[b], sr);
+        bs_mixcolumns(q);
+        bs_addroundkey(q, rk + r*8);
+    }
+    bs_sbox(q);
+    for(int b=0;b<8;b++)
+        q[b] = _mm_shuffle_epi8(q[b], sr);
+    bs_addroundkey(q, rk + bs->nr*8);
+    bs_transpose(q);
+    for(int j=0;j<8;j++)
+        _mm_storeu_si128((__m128i *)(blocks + j*BLOCKLEN), q[j]);
+}
+
+#else
+
+int aes_bs_init(aes_bs_ctx *bs, const uint32_t *roundKey, int nr)
+{
+    return -1;
+}
+
+void aes_bs_encrypt8(const aes_bs_ctx *bs, uint8_t *blocks)
+{
+}
+
+#endif
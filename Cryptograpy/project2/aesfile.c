@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "filecrypt.h"
+
+/*
+ * aesfile - encrypt or decrypt a file of any size with chunked AES-GCM
+ * See filecrypt.h for the format. Input and output default to stdin and
+ * stdout; "-" also names them.
+ */
+static void usage(void)
+{
+    fprintf(stderr,
+            "usage: aesfile -e|-d (-k hexkey | -K keyfile) [-t threads] [-c chunk_shift] [in [out]]\n"
+            "  key is 16, 24 or 32 bytes; chunk_shift is %d..%d (default %d)\n",
+            FC_MIN_SHIFT, FC_MAX_SHIFT, FC_CHUNK_SHIFT);
+    exit(2);
+}
+
+/* hex string to bytes; returns the number of bytes, or -1 */
+static int parse_hex(const char *s, uint8_t *key, int max)
+{
+    int n = 0;
+    unsigned int b;
+
+    if(strlen(s) % 2)
+        return -1;
+    for(;*s;s+=2){
+        if(n == max || sscanf(s, "%2x", &b) != 1)
+            return -1;
+        key[n++] = b;
+    }
+    return n;
+}
+
+static int read_keyfile(const char *path, uint8_t *key, int max)
+{
+    FILE *f = fopen(path, "rb");
+    int n;
+
+    if(!f)
+        return -1;
+    n = fread(key, 1, max + 1, f);
+    fclose(f);
+    return n > max ? -1 : n;
+}
+
+int main(int argc, char *argv[])
+{
+    uint8_t key[33];
+    const char *inpath = "-", *outpath = "-";
+    int mode = 0, keylen = -1, shift = FC_CHUNK_SHIFT, nthreads, c, infd, outfd, err;
+
+    nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    while((c = getopt(argc, argv, "edk:K:t:c:")) != -1){
+        switch(c){
+        case 'e':
+        case 'd':
+            mode = c;
+            break;
+        case 'k':
+            keylen = parse_hex(optarg, key, 32);
+            break;
+        case 'K':
+            keylen = read_keyfile(optarg, key, 32);
+            break;
+        case 't':
+            nthreads = atoi(optarg);
+            break;
+        case 'c':
+            shift = atoi(optarg);
+            break;
+        default:
+            usage();
+        }
+    }
+    if(!mode || (keylen != 16 && keylen != 24 && keylen != 32) || argc - optind > 2)
+        usage();
+    if(shift < FC_MIN_SHIFT || shift > FC_MAX_SHIFT)
+        usage();
+    if(optind < argc)
+        inpath = argv[optind];
+    if(optind + 1 < argc)
+        outpath = argv[optind + 1];
+
+    infd = strcmp(inpath, "-") ? open(inpath, O_RDONLY) : STDIN_FILENO;
+    if(infd < 0){
+        perror(inpath);
+        return 1;
+    }
+    outfd = strcmp(outpath, "-") ? open(outpath, O_WRONLY | O_CREAT | O_TRUNC, 0600) : STDOUT_FILENO;
+    if(outfd < 0){
+        perror(outpath);
+        return 1;
+    }
+    if(mode == 'e')
+        err = aes_file_encrypt(infd, outfd, key, keylen * 8, shift, nthreads);
+    else
+        err = aes_file_decrypt(infd, outfd, key, keylen * 8, nthreads);
+    memset(key, 0, sizeof(key));
+    if(outfd != STDOUT_FILENO && close(outfd) != 0 && !err)
+        err = FC_EIO;
+    if(err){
+        fprintf(stderr, "aesfile: %s\n", err == FC_EAUTH ? "authentication failed" :
+                err == FC_EFORMAT ? "not an aesfile stream or truncated" : "I/O error");
+        /* never leave unauthenticated plain text behind */
+        if(mode == 'd' && outfd != STDOUT_FILENO)
+            unlink(outpath);
+        return 1;
+    }
+    return 0;
+}
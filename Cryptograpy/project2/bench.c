@@ -0,0 +1,270 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "aes.h"
+#include "modes.h"
+#include "../project5/sha2.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define cycles() __rdtsc()
+#else
+#define cycles() 0ULL
+#endif
+
+#define NBLOCKS 0x40000
+
+static const char *impl_name[] = {"reference", "t-table", "aes-ni"};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void report(const char *name, double t, double bytes)
+{
+    printf("%-24s %8.2f MB/s %8.2f ns/block\n", name, bytes / t * 1e-6, t * 1e9 / (bytes / BLOCKLEN));
+}
+
+/*
+ * single-block Cipher(), InvCipher() and aes_ctx throughput of every implementation, in place
+ * over a 4 MiB buffer so each block is independent
+ */
+int main(void)
+{
+    uint32_t roundKey[RNDKEYSIZE], invRoundKey[RNDKEYSIZE];
+    uint8_t key[32], *buf;
+    aes_ctx ctx;
+    aes_bs_ctx bs;
+    char name[64];
+    double t;
+    long n;
+
+    buf = malloc((size_t)NBLOCKS * BLOCKLEN);
+    arc4random_buf(key, sizeof(key));
+    arc4random_buf(buf, (size_t)NBLOCKS * BLOCKLEN);
+    KeyExpansion(key, roundKey);
+    for (int impl = AES_REF; impl < AES_NIMPL; ++impl) {
+        if (aes_select(impl) != 0)
+            continue;
+        for (int mode = ENCRYPT; mode >= DECRYPT; --mode) {
+            n = impl == AES_REF ? NBLOCKS / 64 : NBLOCKS;
+            t = now();
+            for (long i = 0; i < n; ++i)
+                Cipher(buf + i * BLOCKLEN, roundKey, mode);
+            snprintf(name, sizeof(name), "%s %s", impl_name[impl], mode ? "encrypt" : "decrypt");
+            report(name, now() - t, (double)n * BLOCKLEN);
+        }
+        /* decryption with the schedule from InvKeyExpansion() */
+        InvKeyExpansion(roundKey, invRoundKey);
+        t = now();
+        for (long i = 0; i < n; ++i)
+            InvCipher(buf + i * BLOCKLEN, invRoundKey);
+        snprintf(name, sizeof(name), "%s InvCipher", impl_name[impl]);
+        report(name, now() - t, (double)n * BLOCKLEN);
+        /* aes_ctx round loops, one per key size */
+        for (int bits = 128; bits <= 256; bits += 64) {
+            aes_ctx_init(&ctx, key, bits);
+            t = now();
+            for (long i = 0; i < n; ++i)
+                aes_encrypt(&ctx, buf + i * BLOCKLEN);
+            snprintf(name, sizeof(name), "%s ctx%d encrypt", impl_name[impl], bits);
+            report(name, now() - t, (double)n * BLOCKLEN);
+            t = now();
+            for (long i = 0; i < n; ++i)
+                aes_decrypt(&ctx, buf + i * BLOCKLEN);
+            snprintf(name, sizeof(name), "%s ctx%d decrypt", impl_name[impl], bits);
+            report(name, now() - t, (double)n * BLOCKLEN);
+        }
+    }
+    aes_select(AES_AUTO);
+
+    /*
+     * cycles/byte of the constant-time bitsliced code against the
+     * byte-oriented reference Cipher() and the T-table Cipher()
+     */
+    aes_ctx_init(&ctx, key, 128);
+    if (aes_bs_init(&bs, ctx.roundKey, ctx.nr) == 0) {
+        unsigned long long c;
+        n = NBLOCKS / 64;
+        for (int impl = AES_REF; impl <= AES_TTABLE; ++impl) {
+            aes_select(impl);
+            c = cycles();
+            for (long i = 0; i < n; ++i)
+                Cipher(buf + i * BLOCKLEN, roundKey, ENCRYPT);
+            printf("%-24s %8.2f cycles/byte\n", impl_name[impl], (double)(cycles() - c) / (n * BLOCKLEN));
+        }
+        aes_select(AES_AUTO);
+        c = cycles();
+        for (long i = 0; i < n; i += 8)
+            aes_bs_encrypt8(&bs, buf + i * BLOCKLEN);
+        printf("%-24s %8.2f cycles/byte\n", "bitsliced x8", (double)(cycles() - c) / (n * BLOCKLEN));
+        n = NBLOCKS;
+        t = now();
+        for (long i = 0; i < n; i += 8)
+            aes_bs_encrypt8(&bs, buf + i * BLOCKLEN);
+        report("bitsliced x8 encrypt", now() - t, (double)n * BLOCKLEN);
+    }
+
+    /*
+     * one block per key: KeyExpansion() + Cipher() as in the random test,
+     * aes_ctx_init() + aes_encrypt(), and the key-agile batch
+     */
+    {
+        uint8_t *keys = malloc((size_t)NBLOCKS * 32);
+        arc4random_buf(keys, (size_t)NBLOCKS * 32);
+        for (int impl = AES_TTABLE; impl < AES_NIMPL; ++impl) {
+            if (aes_select(impl) != 0)
+                continue;
+            n = NBLOCKS;
+            t = now();
+            for (long i = 0; i < n; ++i) {
+                KeyExpansion(keys + i * KEYLEN, roundKey);
+                Cipher(buf + i * BLOCKLEN, roundKey, ENCRYPT);
+            }
+            snprintf(name, sizeof(name), "%s keyexp+cipher", impl_name[impl]);
+            report(name, now() - t, (double)n * BLOCKLEN);
+            for (int bits = 128; bits <= 256; bits += 128) {
+                t = now();
+                for (long i = 0; i < n; ++i) {
+                    aes_ctx_init(&ctx, keys + i * 32, bits);
+                    aes_encrypt(&ctx, buf + i * BLOCKLEN);
+                }
+                snprintf(name, sizeof(name), "%s ctx%d per key", impl_name[impl], bits);
+                report(name, now() - t, (double)n * BLOCKLEN);
+                t = now();
+                aes_encrypt_keys(keys, bits, buf, n);
+                snprintf(name, sizeof(name), "%s keys%d batch", impl_name[impl], bits);
+                report(name, now() - t, (double)n * BLOCKLEN);
+            }
+        }
+        aes_select(AES_AUTO);
+        aes_ctx_init(&ctx, key, 128);
+        free(keys);
+    }
+
+    /* CTR over a 64 MiB buffer, per implementation, then threaded */
+    {
+        size_t len = (size_t)64 << 20;
+        uint8_t iv[BLOCKLEN] = {0}, *big = malloc(len);
+        memset(big, 0x5a, len);
+        for (int impl = AES_REF; impl < AES_NIMPL; ++impl) {
+            if (aes_select(impl) != 0)
+                continue;
+            aes_ctx_init(&ctx, key, 128);
+            size_t l = impl == AES_REF ? len / 256 : len;
+            t = now();
+            aes_ctr(&ctx, iv, big, big, l);
+            snprintf(name, sizeof(name), "%s ctr", impl_name[impl]);
+            report(name, now() - t, (double)l);
+        }
+        aes_select(AES_AUTO);
+        aes_ctx_init(&ctx, key, 128);
+        for (int nt = 2; nt <= 8; nt *= 2) {
+            t = now();
+            aes_ctr_mt(&ctx, iv, big, big, len, nt);
+            snprintf(name, sizeof(name), "ctr %d threads", nt);
+            report(name, now() - t, (double)len);
+        }
+        /* CBC: serial encryption, 8-way and threaded decryption */
+        {
+            uint8_t cbciv[BLOCKLEN] = {0};
+            t = now();
+            aes_cbc_encrypt(&ctx, cbciv, big, big, len);
+            report("cbc encrypt", now() - t, (double)len);
+            t = now();
+            aes_cbc_decrypt(&ctx, cbciv, big, big, len);
+            report("cbc decrypt", now() - t, (double)len);
+            for (int nt = 2; nt <= 8; nt *= 2) {
+                t = now();
+                aes_cbc_decrypt_mt(&ctx, cbciv, big, big, len, nt);
+                snprintf(name, sizeof(name), "cbc decrypt %d threads", nt);
+                report(name, now() - t, (double)len);
+            }
+        }
+        /* XTS: 4096-byte sectors, one thread against the threaded batch */
+        {
+            xts_ctx *xts = malloc(sizeof(*xts));
+            uint8_t xkey[32] = {0};
+            aes_xts_init(xts, xkey, 128);
+            for (int nt = 1; nt <= 8; nt *= 2) {
+                t = now();
+                aes_xts_encrypt_sectors(xts, 0, big, big, 4096, len / 4096, nt);
+                snprintf(name, sizeof(name), "xts encrypt %d threads", nt);
+                report(name, now() - t, (double)len);
+            }
+            t = now();
+            aes_xts_decrypt_sectors(xts, 0, big, big, 4096, len / 4096, 1);
+            report("xts decrypt", now() - t, (double)len);
+            free(xts);
+        }
+        /*
+         * CTR + HMAC-SHA-256: aes_ctr() then a second sha2.c pass, aes_ctr()
+         * then etm_mac() with the same SHA code as etm_seal(), and etm_seal()
+         * sliced (sha2.c) and stitched (SHA-NI). The stitching gain is the
+         * "etm seal stitched" row against "ctr, then sha-ni hmac".
+         */
+        {
+            etm_ctx *etm = malloc(sizeof(*etm));
+            uint8_t mac[ETM_TAGLEN], k0[SHA256_BLOCK_SIZE];
+            sha256_ctx sc;
+            size_t l = len / 4;
+            etm_init(etm, key, 128, key, 32);
+            t = now();
+            aes_ctr(&ctx, iv, big, big, l);
+            memset(k0, 0x36, sizeof(k0));
+            sha256_init(&sc);
+            sha256_update(&sc, k0, sizeof(k0));
+            sha256_update(&sc, big, l);
+            sha256_final(&sc, mac);
+            memset(k0, 0x5c, sizeof(k0));
+            sha256_init(&sc);
+            sha256_update(&sc, k0, sizeof(k0));
+            sha256_update(&sc, mac, sizeof(mac));
+            sha256_final(&sc, mac);
+            report("ctr, then sha2.c hmac", now() - t, (double)l);
+            for (int ni = 0; ni <= 1; ++ni) {
+                if (etm_select_shani(ni) != 0)
+                    continue;
+                t = now();
+                aes_ctr(&ctx, iv, big, big, l);
+                etm_mac(etm, iv, NULL, 0, big, l, mac);
+                report(ni ? "ctr, then sha-ni hmac" : "ctr, then etm_mac sha2.c", now() - t, (double)l);
+                t = now();
+                etm_seal(etm, iv, NULL, 0, big, big, l, mac);
+                report(ni ? "etm seal stitched" : "etm seal sliced", now() - t, (double)l);
+                t = now();
+                etm_open(etm, iv, NULL, 0, big, big, l, mac);
+                report(ni ? "etm open stitched" : "etm open sliced", now() - t, (double)l);
+            }
+            free(etm);
+        }
+        /* GCM against the raw CTR numbers above */
+        {
+            gcm_ctx *gcm = malloc(sizeof(*gcm));
+            uint8_t tag[GCM_TAGLEN];
+            for (int pcl = 1; pcl >= 0; --pcl) {
+                if (gcm_select_pclmul(pcl) != 0)
+                    continue;
+                gcm_init(gcm, key, 128);
+                size_t l = pcl ? len : len / 16;
+                t = now();
+                gcm_seal(gcm, iv, 12, NULL, 0, big, big, l, tag);
+                snprintf(name, sizeof(name), "gcm seal %s", pcl ? "pclmul" : "4-bit table");
+                report(name, now() - t, (double)l);
+                t = now();
+                gcm_open(gcm, iv, 12, NULL, 0, big, big, l, tag);
+                snprintf(name, sizeof(name), "gcm open %s", pcl ? "pclmul" : "4-bit table");
+                report(name, now() - t, (double)l);
+            }
+            gcm_select_pclmul(1);
+            free(gcm);
+        }
+        free(big);
+    }
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,187 @@
+#include <string.h>
+#include <pthread.h>
+#include "modes.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define AES_X86
+#endif
+
+#define CBC_PAR 8       /* blocks decrypted per iteration */
+
+struct cbc_job {
+    const aes_ctx *ctx;
+    uint8_t iv[BLOCKLEN];
+    const uint8_t *in;
+    uint8_t *out;
+    size_t len;
+};
+
+/*
+ * aes_cbc_encrypt() - CBC encryption of len bytes, len a multiple of 16
+ * iv is updated to the last cipher text block, so a stream can be
+ * encrypted in pieces. No padding is applied. Returns 0, or -1 if len
+ * is not a whole number of blocks.
+ */
+int aes_cbc_encrypt(const aes_ctx *ctx, uint8_t *iv, const uint8_t *in, uint8_t *out, size_t len)
+{
+    uint8_t c[BLOCKLEN];
+
+    if(len % BLOCKLEN)
+        return -1;
+    memcpy(c, iv, BLOCKLEN);
+    for(size_t off=0;off<len;off+=BLOCKLEN){
+        for(int i=0;i<BLOCKLEN;i++)
+            c[i] ^= in[off+i];
+        aes_encrypt(ctx, c);
+        memcpy(out + off, c, BLOCKLEN);
+    }
+    memcpy(iv, c, BLOCKLEN);
+    return 0;
+}
+
+/*
+ * cbc_blocks_sw() - CBC decryption through ctx->decrypt
+ * Blocks go CBC_PAR at a time: all are decrypted before any is chained,
+ * so their decryptions are independent. The cipher text of the batch is
+ * kept aside first, which makes in == out work.
+ */
+static void cbc_blocks_sw(const aes_ctx *ctx, uint8_t *iv, const uint8_t *in, uint8_t *out, size_t nblocks)
+{
+    uint8_t c[(CBC_PAR+1)*BLOCKLEN];
+    size_t n;
+
+    while(nblocks){
+        n = nblocks < CBC_PAR ? nblocks : CBC_PAR;
+        memcpy(c, iv, BLOCKLEN);
+        memcpy(c + BLOCKLEN, in, n*BLOCKLEN);
+        memmove(out, in, n*BLOCKLEN);
+        for(size_t j=0;j<n;j++)
+            aes_decrypt(ctx, out + j*BLOCKLEN);
+        for(size_t i=0;i<n*BLOCKLEN;i++)
+            out[i] ^= c[i];
+        memcpy(iv, c + n*BLOCKLEN, BLOCKLEN);
+        in += n*BLOCKLEN;
+        out += n*BLOCKLEN;
+        nblocks -= n;
+    }
+}
+
+#ifdef AES_X86
+#define CBC_EACH(op) \
+    b0 = op(b0, k); b1 = op(b1, k); b2 = op(b2, k); b3 = op(b3, k); \
+    b4 = op(b4, k); b5 = op(b5, k); b6 = op(b6, k); b7 = op(b7, k)
+
+#define CBC_LOAD(j) _mm_loadu_si128((const __m128i *)in + (j))
+#define CBC_STORE(j, b, prev) _mm_storeu_si128((__m128i *)out + (j), _mm_xor_si128(b, prev))
+
+/*
+ * cbc_blocks_aesni() - 8 AESDEC streams interleaved, as in ctr.c
+ * The cipher text blocks stay in c0..c7 for the chaining xor, so the
+ * buffer may be decrypted in place.
+ */
+__attribute__((target("aes,sse2")))
+static void cbc_blocks_aesni(const aes_ctx *ctx, uint8_t *iv, const uint8_t *in, uint8_t *out, size_t nblocks)
+{
+    const __m128i *dk = (const __m128i *)ctx->invRoundKey;
+    __m128i b0, b1, b2, b3, b4, b5, b6, b7, k, prev;
+    __m128i c0, c1, c2, c3, c4, c5, c6, c7;
+    int nr = ctx->nr;
+
+    prev = _mm_loadu_si128((const __m128i *)iv);
+    for(;nblocks>=CBC_PAR;nblocks-=CBC_PAR){
+        b0 = c0 = CBC_LOAD(0); b1 = c1 = CBC_LOAD(1); b2 = c2 = CBC_LOAD(2); b3 = c3 = CBC_LOAD(3);
+        b4 = c4 = CBC_LOAD(4); b5 = c5 = CBC_LOAD(5); b6 = c6 = CBC_LOAD(6); b7 = c7 = CBC_LOAD(7);
+        k = _mm_loadu_si128(dk);
+        CBC_EACH(_mm_xor_si128);
+        for(int r=1;r<nr;r++){
+            k = _mm_loadu_si128(dk + r);
+            CBC_EACH(_mm_aesdec_si128);
+        }
+        k = _mm_loadu_si128(dk + nr);
+        CBC_EACH(_mm_aesdeclast_si128);
+        CBC_STORE(0, b0, prev); CBC_STORE(1, b1, c0); CBC_STORE(2, b2, c1); CBC_STORE(3, b3, c2);
+        CBC_STORE(4, b4, c3); CBC_STORE(5, b5, c4); CBC_STORE(6, b6, c5); CBC_STORE(7, b7, c6);
+        prev = c7;
+        in += CBC_PAR*BLOCKLEN;
+        out += CBC_PAR*BLOCKLEN;
+    }
+    _mm_storeu_si128((__m128i *)iv, prev);
+    if(nblocks)
+        cbc_blocks_sw(ctx, iv, in, out, nblocks);
+}
+#endif
+
+/*
+ * aes_cbc_decrypt() - CBC decryption of len bytes, len a multiple of 16
+ * Every plain text block only needs two cipher text blocks, so blocks
+ * are decrypted CBC_PAR at a time. iv is updated as in
+ * aes_cbc_encrypt(). in and out may be the same buffer.
+ */
+int aes_cbc_decrypt(const aes_ctx *ctx, uint8_t *iv, const uint8_t *in, uint8_t *out, size_t len)
+{
+    if(len % BLOCKLEN)
+        return -1;
+#ifdef AES_X86
+    if(ctx->impl == AES_AESNI){
+        cbc_blocks_aesni(ctx, iv, in, out, len / BLOCKLEN);
+        return 0;
+    }
+#endif
+    cbc_blocks_sw(ctx, iv, in, out, len / BLOCKLEN);
+    return 0;
+}
+
+static void *cbc_worker(void *p)
+{
+    struct cbc_job *j = p;
+
+    aes_cbc_decrypt(j->ctx, j->iv, j->in, j->out, j->len);
+    return NULL;
+}
+
+/*
+ * aes_cbc_decrypt_mt() - aes_cbc_decrypt() over nthreads threads
+ * Each thread takes a contiguous range; its IV is the cipher text block
+ * just before the range, copied out before any thread starts so that
+ * in-place decryption cannot overwrite it. Buffers shorter than
+ * CBC_MT_MIN stay on the calling thread.
+ */
+int aes_cbc_decrypt_mt(const aes_ctx *ctx, uint8_t *iv, const uint8_t *in, uint8_t *out, size_t len, int nthreads)
+{
+    struct cbc_job job[AES_MAX_THREADS];
+    pthread_t tid[AES_MAX_THREADS];
+    int started[AES_MAX_THREADS];
+    size_t per;
+    int t;
+
+    if(len % BLOCKLEN)
+        return -1;
+    if(nthreads > AES_MAX_THREADS)
+        nthreads = AES_MAX_THREADS;
+    if((size_t)nthreads > len / (CBC_MT_MIN / 2))
+        nthreads = len / (CBC_MT_MIN / 2);
+    if(nthreads < 2 || len < CBC_MT_MIN)
+        return aes_cbc_decrypt(ctx, iv, in, out, len);
+    per = (len / BLOCKLEN + nthreads - 1) / nthreads * BLOCKLEN;
+    for(t=0;t<nthreads;t++){
+        size_t off = t*per < len ? t*per : len;
+        job[t].ctx = ctx;
+        memcpy(job[t].iv, off ? in + off - BLOCKLEN : iv, BLOCKLEN);
+        job[t].in = in + off;
+        job[t].out = out + off;
+        job[t].len = len - off < per ? len - off : per;
+        started[t] = 0;
+    }
+    memcpy(iv, in + len - BLOCKLEN, BLOCKLEN);
+    for(t=1;t<nthreads;t++)
+        started[t] = pthread_create(&tid[t], NULL, cbc_worker, &job[t]) == 0;
+    cbc_worker(&job[0]);
+    for(t=1;t<nthreads;t++){
+        if(started[t])
+            pthread_join(tid[t], NULL);
+        else
+            cbc_worker(&job[t]);
+    }
+    return 0;
+}
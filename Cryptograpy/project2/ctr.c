@@ -0,0 +1,216 @@
+#include <string.h>
+#include <pthread.h>
+#include "modes.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define AES_X86
+#endif
+
+#define CTR_PAR 8       /* counter blocks in flight per iteration */
+
+struct ctr_job {
+    const aes_ctx *ctx;
+    uint64_t hi, lo;
+    const uint8_t *in;
+    uint8_t *out;
+    size_t len;
+};
+
+static inline uint64_t load_be64(const uint8_t *p)
+{
+    uint64_t x;
+    memcpy(&x, p, 8);
+    return __builtin_bswap64(x);
+}
+
+static inline void store_be64(uint8_t *p, uint64_t x)
+{
+    x = __builtin_bswap64(x);
+    memcpy(p, &x, 8);
+}
+
+/* (hi, lo) += n */
+static inline void ctr_inc(uint64_t *hi, uint64_t *lo, uint64_t n)
+{
+    *lo += n;
+    *hi += *lo < n;
+}
+
+/*
+ * aes_ctr_add() - ctr += n, ctr being a 128-bit big-endian counter block
+ * Gives the counter block of block n of a stream started at ctr.
+ */
+void aes_ctr_add(uint8_t *ctr, uint64_t n)
+{
+    uint64_t hi = load_be64(ctr), lo = load_be64(ctr + 8);
+
+    ctr_inc(&hi, &lo, n);
+    store_be64(ctr, hi);
+    store_be64(ctr + 8, lo);
+}
+
+/*
+ * ctr_blocks_sw() - nblocks full blocks through ctx->encrypt
+ * CTR_PAR counter blocks are encrypted back to back before the xor, so
+ * the independent block encryptions can overlap in the pipeline.
+ */
+static void ctr_blocks_sw(const aes_ctx *ctx, uint64_t *hi, uint64_t *lo,
+                          const uint8_t *in, uint8_t *out, size_t nblocks)
+{
+    uint8_t ks[CTR_PAR*BLOCKLEN];
+    size_t n;
+
+    while(nblocks){
+        n = nblocks < CTR_PAR ? nblocks : CTR_PAR;
+        for(size_t j=0;j<n;j++){
+            store_be64(ks + j*BLOCKLEN, *hi);
+            store_be64(ks + j*BLOCKLEN + 8, *lo);
+            ctr_inc(hi, lo, 1);
+        }
+        for(size_t j=0;j<n;j++)
+            aes_encrypt(ctx, ks + j*BLOCKLEN);
+        for(size_t j=0;j<n*BLOCKLEN;j++)
+            out[j] = in[j] ^ ks[j];
+        in += n*BLOCKLEN;
+        out += n*BLOCKLEN;
+        nblocks -= n;
+    }
+}
+
+#ifdef AES_X86
+/* counter block (hi, lo) + j in byte order */
+#define CTR_BLOCK(j) \
+    (l_ = *lo + (j), _mm_set_epi64x(__builtin_bswap64(l_), __builtin_bswap64(*hi + (l_ < *lo))))
+
+#define CTR_EACH(op) \
+    b0 = op(b0, k); b1 = op(b1, k); b2 = op(b2, k); b3 = op(b3, k); \
+    b4 = op(b4, k); b5 = op(b5, k); b6 = op(b6, k); b7 = op(b7, k)
+
+#define CTR_XOR(j, b) \
+    _mm_storeu_si128((__m128i *)out + (j), \
+                     _mm_xor_si128(b, _mm_loadu_si128((const __m128i *)in + (j))))
+
+/*
+ * ctr_blocks_aesni() - 8 counter blocks per iteration, interleaved
+ * AESENC has a latency of several cycles but a throughput of one per
+ * cycle, so each round key is applied to all 8 blocks before the next.
+ */
+__attribute__((target("aes,sse2")))
+static void ctr_blocks_aesni(const aes_ctx *ctx, uint64_t *hi, uint64_t *lo,
+                             const uint8_t *in, uint8_t *out, size_t nblocks)
+{
+    const __m128i *rk = (const __m128i *)ctx->roundKey;
+    __m128i b0, b1, b2, b3, b4, b5, b6, b7, k;
+    uint64_t l_;
+    int nr = ctx->nr;
+
+    for(;nblocks>=CTR_PAR;nblocks-=CTR_PAR){
+        b0 = CTR_BLOCK(0); b1 = CTR_BLOCK(1); b2 = CTR_BLOCK(2); b3 = CTR_BLOCK(3);
+        b4 = CTR_BLOCK(4); b5 = CTR_BLOCK(5); b6 = CTR_BLOCK(6); b7 = CTR_BLOCK(7);
+        ctr_inc(hi, lo, CTR_PAR);
+        k = _mm_loadu_si128(rk);
+        CTR_EACH(_mm_xor_si128);
+        for(int r=1;r<nr;r++){
+            k = _mm_loadu_si128(rk + r);
+            CTR_EACH(_mm_aesenc_si128);
+        }
+        k = _mm_loadu_si128(rk + nr);
+        CTR_EACH(_mm_aesenclast_si128);
+        CTR_XOR(0, b0); CTR_XOR(1, b1); CTR_XOR(2, b2); CTR_XOR(3, b3);
+        CTR_XOR(4, b4); CTR_XOR(5, b5); CTR_XOR(6, b6); CTR_XOR(7, b7);
+        in += CTR_PAR*BLOCKLEN;
+        out += CTR_PAR*BLOCKLEN;
+    }
+    if(nblocks)
+        ctr_blocks_sw(ctx, hi, lo, in, out, nblocks);
+}
+#endif
+
+/* len bytes starting with counter block (hi, lo) */
+static void ctr_run(const aes_ctx *ctx, uint64_t hi, uint64_t lo,
+                    const uint8_t *in, uint8_t *out, size_t len)
+{
+    size_t nblocks = len / BLOCKLEN, tail = len % BLOCKLEN;
+    uint8_t ks[BLOCKLEN];
+
+#ifdef AES_X86
+    if(ctx->impl == AES_AESNI)
+        ctr_blocks_aesni(ctx, &hi, &lo, in, out, nblocks);
+    else
+#endif
+        ctr_blocks_sw(ctx, &hi, &lo, in, out, nblocks);
+    if(tail){
+        in += nblocks*BLOCKLEN;
+        out += nblocks*BLOCKLEN;
+        store_be64(ks, hi);
+        store_be64(ks + 8, lo);
+        aes_encrypt(ctx, ks);
+        for(size_t i=0;i<tail;i++)
+            out[i] = in[i] ^ ks[i];
+    }
+}
+
+/*
+ * aes_ctr() - CTR encryption/decryption of len bytes
+ * iv is the counter block of the first block and is not modified; the
+ * next call of a stream continues at aes_ctr_add(iv, len/16). in and
+ * out may be the same buffer.
+ */
+void aes_ctr(const aes_ctx *ctx, const uint8_t *iv, const uint8_t *in, uint8_t *out, size_t len)
+{
+    ctr_run(ctx, load_be64(iv), load_be64(iv + 8), in, out, len);
+}
+
+static void *ctr_worker(void *p)
+{
+    struct ctr_job *j = p;
+
+    ctr_run(j->ctx, j->hi, j->lo, j->in, j->out, j->len);
+    return NULL;
+}
+
+/*
+ * aes_ctr_mt() - aes_ctr() over nthreads threads
+ * The keystream is split into contiguous block ranges; each thread starts
+ * at its own counter offset, so no thread depends on another. Buffers
+ * shorter than CTR_MT_MIN are done on the calling thread.
+ */
+void aes_ctr_mt(const aes_ctx *ctx, const uint8_t *iv, const uint8_t *in, uint8_t *out, size_t len, int nthreads)
+{
+    struct ctr_job job[AES_MAX_THREADS];
+    pthread_t tid[AES_MAX_THREADS];
+    int started[AES_MAX_THREADS];
+    size_t per;
+    int t;
+
+    if(nthreads > AES_MAX_THREADS)
+        nthreads = AES_MAX_THREADS;
+    if((size_t)nthreads > len / (CTR_MT_MIN / 2))
+        nthreads = len / (CTR_MT_MIN / 2);
+    if(nthreads < 2 || len < CTR_MT_MIN){
+        aes_ctr(ctx, iv, in, out, len);
+        return;
+    }
+    per = ((len + BLOCKLEN - 1) / BLOCKLEN + nthreads - 1) / nthreads * BLOCKLEN;
+    for(t=0;t<nthreads;t++){
+        size_t off = t*per < len ? t*per : len;
+        job[t].ctx = ctx;
+        job[t].hi = load_be64(iv);
+        job[t].lo = load_be64(iv + 8);
+        ctr_inc(&job[t].hi, &job[t].lo, off / BLOCKLEN);
+        job[t].in = in + off;
+        job[t].out = out + off;
+        job[t].len = len - off < per ? len - off : per;
+        started[t] = 0;
+    }
+    for(t=1;t<nthreads;t++)
+        started[t] = pthread_create(&tid[t], NULL, ctr_worker, &job[t]) == 0;
+    ctr_worker(&job[0]);
+    for(t=1;t<nthreads;t++){
+        if(started[t])
+            pthread_join(tid[t], NULL);
+        else
+            ctr_worker(&job[t]);
+    }
+}
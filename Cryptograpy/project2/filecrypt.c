@@ -0,0 +1,423 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "filecrypt.h"
+#include "../project5/sha2.h"
+
+static const uint8_t fc_magic[4] = {'A', 'E', 'S', 'F'};
+
+#define FC_NONCE_OFF 9          /* 7-byte chunk IV prefix */
+#define FC_SALT_OFF 16          /* FC_SALTLEN-byte key derivation salt */
+
+enum { SLOT_FREE, SLOT_FULL, SLOT_BUSY, SLOT_DONE };
+
+struct fc_slot {
+    int state;
+    uint64_t seq;
+    const uint8_t *in;          /* into the mapping, or inbuf */
+    uint8_t *inbuf, *outbuf;
+    size_t inlen, outlen;
+    int final, bad;
+};
+
+/*
+ * Reader -> workers -> writer over a ring of nslots chunk buffers
+ * Chunk seq lives in slot seq % nslots from the time the reader fills it
+ * until the writer has written it out, so at most nslots chunks are in
+ * memory whatever the file size; fc_run() keeps nslots * chunk within
+ * FC_MAX_BUFFER unless that is less than two chunks. One mutex and one condition variable
+ * guard the slot states; at chunk granularity that is not contended.
+ */
+struct fc_pipe {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct fc_slot slot[FC_MAX_SLOTS];
+    int nslots;
+    uint64_t next_work;         /* next chunk a worker takes */
+    uint64_t nchunks;           /* known once the reader has seen the final chunk */
+    int error;
+    int enc;
+    size_t chunk, inchunk;      /* plain text chunk, input chunk */
+    const gcm_ctx *gcm;
+    uint8_t hdr[FC_HDRLEN];
+    int infd;
+    const uint8_t *map;         /* whole input file, or NULL */
+    size_t mapoff, mapsize;
+};
+
+static ssize_t read_full(int fd, uint8_t *buf, size_t len)
+{
+    size_t done = 0;
+    ssize_t n;
+
+    while(done < len){
+        n = read(fd, buf + done, len - done);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n < 0)
+            return -1;
+        if(n == 0)
+            break;
+        done += n;
+    }
+    return done;
+}
+
+static int write_full(int fd, const uint8_t *buf, size_t len)
+{
+    ssize_t n;
+
+    while(len){
+        n = write(fd, buf, len);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return -1;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* stop the pipeline; the first error wins */
+static void fc_fail(struct fc_pipe *p, int err)
+{
+    pthread_mutex_lock(&p->lock);
+    if(!p->error)
+        p->error = err;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+}
+
+static void *fc_reader(void *arg)
+{
+    struct fc_pipe *p = arg;
+    struct fc_slot *s;
+    ssize_t n;
+    int stop;
+
+    for(uint64_t seq=0;;seq++){
+        s = &p->slot[seq % p->nslots];
+        pthread_mutex_lock(&p->lock);
+        while(s->state != SLOT_FREE && !p->error)
+            pthread_cond_wait(&p->cond, &p->lock);
+        stop = p->error;
+        pthread_mutex_unlock(&p->lock);
+        if(stop)
+            break;
+        if(seq > UINT32_MAX){
+            fc_fail(p, FC_EFORMAT);
+            break;
+        }
+        if(p->map){
+            n = p->mapsize - p->mapoff < p->inchunk ? p->mapsize - p->mapoff : p->inchunk;
+            s->in = p->map + p->mapoff;
+            p->mapoff += n;
+        }
+        else{
+            n = read_full(p->infd, s->inbuf, p->inchunk);
+            if(n < 0){
+                fc_fail(p, FC_EIO);
+                break;
+            }
+            s->in = s->inbuf;
+        }
+        s->inlen = n;
+        s->final = (size_t)n < p->inchunk;
+        pthread_mutex_lock(&p->lock);
+        s->seq = seq;
+        s->state = SLOT_FULL;
+        if(s->final)
+            p->nchunks = seq + 1;
+        pthread_cond_broadcast(&p->cond);
+        pthread_mutex_unlock(&p->lock);
+        if(s->final)
+            break;
+    }
+    return NULL;
+}
+
+static void fc_chunk(const struct fc_pipe *p, struct fc_slot *s)
+{
+    uint8_t iv[12];
+
+    memcpy(iv, p->hdr + FC_NONCE_OFF, 7);
+    iv[7] = s->seq >> 24;
+    iv[8] = s->seq >> 16;
+    iv[9] = s->seq >> 8;
+    iv[10] = s->seq;
+    iv[11] = s->final;
+    s->bad = 0;
+    if(p->enc){
+        gcm_seal(p->gcm, iv, sizeof(iv), p->hdr, FC_HDRLEN, s->in, s->outbuf, s->inlen, s->outbuf + s->inlen);
+        s->outlen = s->inlen + GCM_TAGLEN;
+    }
+    else if(s->inlen < GCM_TAGLEN)
+        s->bad = FC_EFORMAT;
+    else{
+        s->outlen = s->inlen - GCM_TAGLEN;
+        if(gcm_open(p->gcm, iv, sizeof(iv), p->hdr, FC_HDRLEN, s->in, s->outbuf, s->outlen, s->in + s->outlen) != 0)
+            s->bad = FC_EAUTH;
+    }
+}
+
+static void *fc_worker(void *arg)
+{
+    struct fc_pipe *p = arg;
+    struct fc_slot *s;
+
+    pthread_mutex_lock(&p->lock);
+    for(;;){
+        s = &p->slot[p->next_work % p->nslots];
+        while(!p->error && p->next_work < p->nchunks &&
+              !(s->state == SLOT_FULL && s->seq == p->next_work)){
+            pthread_cond_wait(&p->cond, &p->lock);
+            s = &p->slot[p->next_work % p->nslots];
+        }
+        if(p->error || p->next_work >= p->nchunks)
+            break;
+        s->state = SLOT_BUSY;
+        p->next_work++;
+        pthread_mutex_unlock(&p->lock);
+        fc_chunk(p, s);
+        pthread_mutex_lock(&p->lock);
+        s->state = SLOT_DONE;
+        pthread_cond_broadcast(&p->cond);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+/* writes the chunks out in order on the calling thread */
+static void fc_writer(struct fc_pipe *p, int outfd)
+{
+    struct fc_slot *s;
+    long page = sysconf(_SC_PAGESIZE);
+    size_t dropped = 0, upto;
+    int stop;
+
+    for(uint64_t seq=0;;seq++){
+        s = &p->slot[seq % p->nslots];
+        pthread_mutex_lock(&p->lock);
+        while(!p->error && seq < p->nchunks && !(s->state == SLOT_DONE && s->seq == seq))
+            pthread_cond_wait(&p->cond, &p->lock);
+        stop = p->error || seq >= p->nchunks;
+        pthread_mutex_unlock(&p->lock);
+        if(stop)
+            break;
+        if(s->bad){
+            fc_fail(p, s->bad);
+            break;
+        }
+        if(write_full(outfd, s->outbuf, s->outlen) != 0){
+            fc_fail(p, FC_EIO);
+            break;
+        }
+        /* mapped input that has been consumed need not stay resident */
+        if(p->map){
+            upto = (s->in + s->inlen - p->map) / page * page;
+            if(upto > dropped){
+                madvise((uint8_t *)p->map + dropped, upto - dropped, MADV_DONTNEED);
+                dropped = upto;
+            }
+        }
+        pthread_mutex_lock(&p->lock);
+        s->state = SLOT_FREE;
+        pthread_cond_broadcast(&p->cond);
+        pthread_mutex_unlock(&p->lock);
+    }
+}
+
+/*
+ * fc_run() - the pipeline over infd from its current offset
+ * Regular files are mapped, so the workers read the page cache directly;
+ * pipes and empty files go through aligned read() buffers instead.
+ * The header has already been read (decryption) or is written here
+ * (encryption).
+ */
+static int fc_run(struct fc_pipe *p, int outfd, int nthreads)
+{
+    pthread_t reader, tid[AES_MAX_THREADS];
+    int started[AES_MAX_THREADS], rstarted, nstarted = 0, t, err = 0;
+    struct stat st;
+    void *m;
+
+    if(nthreads > AES_MAX_THREADS)
+        nthreads = AES_MAX_THREADS;
+    if(nthreads < 1)
+        nthreads = 1;
+    /* 2*nthreads + 2 slots, but no more than FC_MAX_BUFFER of chunks */
+    p->nslots = 2*nthreads + 2;
+    if((size_t)p->nslots > FC_MAX_BUFFER / p->chunk)
+        p->nslots = FC_MAX_BUFFER / p->chunk > 2 ? FC_MAX_BUFFER / p->chunk : 2;
+    if(nthreads > p->nslots)
+        nthreads = p->nslots;
+    p->next_work = 0;
+    p->nchunks = UINT64_MAX;
+    p->error = 0;
+    p->map = NULL;
+    p->inchunk = p->enc ? p->chunk : p->chunk + GCM_TAGLEN;
+    if(fstat(p->infd, &st) == 0 && S_ISREG(st.st_mode)){
+        off_t cur = lseek(p->infd, 0, SEEK_CUR);
+        if(cur >= 0 && st.st_size > cur){
+            m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, p->infd, 0);
+            if(m != MAP_FAILED){
+                madvise(m, st.st_size, MADV_SEQUENTIAL);
+                p->map = m;
+                p->mapoff = cur;
+                p->mapsize = st.st_size;
+            }
+        }
+    }
+    for(t=0;t<p->nslots;t++){
+        struct fc_slot *s = &p->slot[t];
+        s->state = SLOT_FREE;
+        s->inbuf = s->outbuf = NULL;
+        if(posix_memalign((void **)&s->outbuf, 4096, p->chunk + GCM_TAGLEN) != 0 ||
+           (!p->map && posix_memalign((void **)&s->inbuf, 4096, p->inchunk) != 0))
+            err = FC_EIO;
+    }
+    if(!err && p->enc && write_full(outfd, p->hdr, FC_HDRLEN) != 0)
+        err = FC_EIO;
+    if(!err){
+        pthread_mutex_init(&p->lock, NULL);
+        pthread_cond_init(&p->cond, NULL);
+        rstarted = pthread_create(&reader, NULL, fc_reader, p) == 0;
+        for(t=0;t<nthreads;t++){
+            started[t] = rstarted && pthread_create(&tid[t], NULL, fc_worker, p) == 0;
+            nstarted += started[t];
+        }
+        if(!nstarted)
+            fc_fail(p, FC_EIO);
+        fc_writer(p, outfd);
+        /* the writer stops at the first error; make sure everyone else does */
+        if(p->error)
+            fc_fail(p, p->error);
+        if(rstarted)
+            pthread_join(reader, NULL);
+        for(t=0;t<nthreads;t++)
+            if(started[t])
+                pthread_join(tid[t], NULL);
+        err = p->error;
+        pthread_cond_destroy(&p->cond);
+        pthread_mutex_destroy(&p->lock);
+    }
+    for(t=0;t<p->nslots;t++){
+        free(p->slot[t].inbuf);
+        free(p->slot[t].outbuf);
+    }
+    if(p->map)
+        munmap((void *)p->map, p->mapsize);
+    return err;
+}
+
+/*
+ * fc_file_key() - the per-file key, HMAC-SHA-256(key, "AESF" || salt)
+ * cut to keybits, which is 128, 192 or 256
+ */
+static void fc_file_key(const uint8_t *key, int keybits, const uint8_t *salt, uint8_t *fkey)
+{
+    uint8_t k0[SHA256_BLOCK_SIZE] = {0}, inner[SHA256_DIGEST_SIZE], out[SHA256_DIGEST_SIZE];
+    sha256_ctx c;
+    int i;
+
+    memcpy(k0, key, keybits / 8);
+    for(i=0;i<SHA256_BLOCK_SIZE;i++)
+        k0[i] ^= 0x36;
+    sha256_init(&c);
+    sha256_update(&c, k0, SHA256_BLOCK_SIZE);
+    sha256_update(&c, fc_magic, 4);
+    sha256_update(&c, salt, FC_SALTLEN);
+    sha256_final(&c, inner);
+    for(i=0;i<SHA256_BLOCK_SIZE;i++)
+        k0[i] ^= 0x36 ^ 0x5c;
+    sha256_init(&c);
+    sha256_update(&c, k0, SHA256_BLOCK_SIZE);
+    sha256_update(&c, inner, SHA256_DIGEST_SIZE);
+    sha256_final(&c, out);
+    memcpy(fkey, out, keybits / 8);
+    memset(k0, 0, sizeof(k0));
+    memset(inner, 0, sizeof(inner));
+    memset(out, 0, sizeof(out));
+    memset(&c, 0, sizeof(c));
+}
+
+static int fc_start(int enc, int infd, int outfd, const uint8_t *key, int keybits,
+                    const uint8_t *hdr, int nthreads)
+{
+    struct fc_pipe *p;
+    gcm_ctx *gcm;
+    uint8_t fkey[32];
+    int err;
+
+    if(keybits != 128 && keybits != 192 && keybits != 256)
+        return FC_EFORMAT;
+
+    p = malloc(sizeof(*p));
+    gcm = malloc(sizeof(*gcm));
+    if(!p || !gcm){
+        free(p);
+        free(gcm);
+        return FC_EIO;
+    }
+    fc_file_key(key, keybits, hdr + FC_SALT_OFF, fkey);
+    err = gcm_init(gcm, fkey, keybits);
+    memset(fkey, 0, sizeof(fkey));
+    if(err != 0)
+        err = FC_EFORMAT;
+    else{
+        p->enc = enc;
+        p->infd = infd;
+        p->gcm = gcm;
+        p->chunk = (size_t)1 << hdr[5];
+        memcpy(p->hdr, hdr, FC_HDRLEN);
+        err = fc_run(p, outfd, nthreads);
+    }
+    memset(gcm, 0, sizeof(*gcm));
+    free(gcm);
+    free(p);
+    return err;
+}
+
+/*
+ * aes_file_encrypt() - encrypt infd to outfd in 2^chunk_shift byte chunks
+ * Reading starts at the current offset of infd and goes to end of file.
+ * Up to nthreads chunks are sealed at a time. Returns 0 or one of the
+ * FC_E* codes.
+ */
+int aes_file_encrypt(int infd, int outfd, const uint8_t *key, int keybits, int chunk_shift, int nthreads)
+{
+    uint8_t hdr[FC_HDRLEN] = {0};
+
+    if(chunk_shift < FC_MIN_SHIFT || chunk_shift > FC_MAX_SHIFT)
+        return FC_EFORMAT;
+    memcpy(hdr, fc_magic, 4);
+    hdr[4] = FC_VERSION;
+    hdr[5] = chunk_shift;
+    arc4random_buf(hdr + FC_NONCE_OFF, 7);
+    arc4random_buf(hdr + FC_SALT_OFF, FC_SALTLEN);
+    return fc_start(1, infd, outfd, key, keybits, hdr, nthreads);
+}
+
+/*
+ * aes_file_decrypt() - the inverse of aes_file_encrypt()
+ * Chunks are written out as they verify, so on FC_EAUTH or FC_EFORMAT
+ * the output holds a verified prefix and the caller should discard it.
+ */
+int aes_file_decrypt(int infd, int outfd, const uint8_t *key, int keybits, int nthreads)
+{
+    uint8_t hdr[FC_HDRLEN];
+    ssize_t n;
+
+    n = read_full(infd, hdr, FC_HDRLEN);
+    if(n < 0)
+        return FC_EIO;
+    if(n != FC_HDRLEN || memcmp(hdr, fc_magic, 4) != 0 || hdr[4] != FC_VERSION ||
+       hdr[5] < FC_MIN_SHIFT || hdr[5] > FC_MAX_SHIFT || hdr[6] || hdr[7] || hdr[8])
+        return FC_EFORMAT;
+    return fc_start(0, infd, outfd, key, keybits, hdr, nthreads);
+}
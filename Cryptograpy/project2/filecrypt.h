@@ -0,0 +1,36 @@
+#ifndef FILECRYPT_H
+#define FILECRYPT_H
+
+#include "modes.h"
+
+/*
+ * Chunked AES-GCM file format
+ * A 32-byte header ("AESF", version, log2 of the chunk size, 3 zero
+ * bytes, 7-byte random nonce, 16-byte random salt) is followed by chunks
+ * of the plain text, each sealed with its own tag. Every file is sealed
+ * under its own key, HMAC-SHA-256(key, "AESF" || salt) cut to the key
+ * size, so GCM IVs only have to be unique within a file and a long-lived
+ * key does not run into nonce collisions across many files. The IV of
+ * chunk i is nonce || i (32-bit big-endian) || final flag and the header
+ * is the additional data, so chunks cannot be reordered, dropped or
+ * truncated unnoticed. A chunk is final iff it is shorter than the chunk
+ * size, which makes an input of a whole number of chunks end in an empty
+ * chunk.
+ */
+#define FC_HDRLEN 32
+#define FC_VERSION 2
+#define FC_SALTLEN 16
+#define FC_CHUNK_SHIFT 20       /* default chunk size, 1 MiB */
+#define FC_MIN_SHIFT 12
+#define FC_MAX_SHIFT 30
+#define FC_MAX_SLOTS (2*AES_MAX_THREADS + 2)
+#define FC_MAX_BUFFER (1 << 28)  /* bytes of chunks in flight, at least two chunks */
+
+#define FC_EIO -1               /* read/write error */
+#define FC_EFORMAT -2           /* bad header, truncated input or bad arguments */
+#define FC_EAUTH -3             /* a tag did not verify */
+
+int aes_file_encrypt(int infd, int outfd, const uint8_t *key, int keybits, int chunk_shift, int nthreads);
+int aes_file_decrypt(int infd, int outfd, const uint8_t *key, int keybits, int nthreads);
+
+#endif
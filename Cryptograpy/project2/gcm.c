@@ -0,0 +1,458 @@
+#include <string.h>
+#include "modes.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define AES_X86
+#endif
+
+#define GCM_PAR 8       /* blocks per stitched iteration = aggregated GHASH width */
+
+static int use_pclmul = 0;
+
+static inline uint64_t load_be64(const uint8_t *p)
+{
+    uint64_t x;
+    memcpy(&x, p, 8);
+    return __builtin_bswap64(x);
+}
+
+static inline void store_be64(uint8_t *p, uint64_t x)
+{
+    x = __builtin_bswap64(x);
+    memcpy(p, &x, 8);
+}
+
+/*
+ * Software GHASH, 4-bit tables (Shoup)
+ *
+ * HL/HH[i] is i*H for the 16 values of a nibble, in the bit-reflected
+ * order of GCM with the high half in HH. One multiplication walks the
+ * 32 nibbles of x, shifting the product right by 4 and folding the
+ * 4 bits shifted out back in with last4[].
+ */
+static const uint16_t last4[16] = {
+    0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+    0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+};
+
+static void ghash_table_init(gcm_ctx *g)
+{
+    uint64_t vh = load_be64(g->H), vl = load_be64(g->H + 8);
+
+    g->HH[0] = g->HL[0] = 0;
+    g->HH[8] = vh; g->HL[8] = vl;
+    for(int i=4;i>0;i>>=1){
+        uint64_t t = (vl & 1) * 0xe1000000U;
+        vl = vh << 63 | vl >> 1;
+        vh = vh >> 1 ^ t << 32;
+        g->HH[i] = vh; g->HL[i] = vl;
+    }
+    for(int i=2;i<=8;i*=2)
+        for(int j=1;j<i;j++){
+            g->HH[i+j] = g->HH[i] ^ g->HH[j];
+            g->HL[i+j] = g->HL[i] ^ g->HL[j];
+        }
+}
+
+/* y = y * H */
+static void ghash_table_mul(const gcm_ctx *g, uint8_t *y)
+{
+    uint64_t zh, zl;
+    int lo, hi, rem;
+
+    lo = y[15] & 0xf;
+    zh = g->HH[lo]; zl = g->HL[lo];
+    for(int i=15;i>=0;i--){
+        lo = y[i] & 0xf;
+        hi = y[i] >> 4;
+        if(i != 15){
+            rem = zl & 0xf;
+            zl = zh << 60 | zl >> 4;
+            zh = zh >> 4 ^ (uint64_t)last4[rem] << 48;
+            zh ^= g->HH[lo]; zl ^= g->HL[lo];
+        }
+        rem = zl & 0xf;
+        zl = zh << 60 | zl >> 4;
+        zh = zh >> 4 ^ (uint64_t)last4[rem] << 48;
+        zh ^= g->HH[hi]; zl ^= g->HL[hi];
+    }
+    store_be64(y, zh);
+    store_be64(y + 8, zl);
+}
+
+static void ghash_table(const gcm_ctx *g, uint8_t *y, const uint8_t *x, size_t nblocks)
+{
+    for(size_t n=0;n<nblocks;n++,x+=BLOCKLEN){
+        for(int i=0;i<BLOCKLEN;i++)
+            y[i] ^= x[i];
+        ghash_table_mul(g, y);
+    }
+}
+
+#ifdef AES_X86
+/*
+ * PCLMULQDQ GHASH
+ *
+ * Blocks are byte-reversed so that the 128-bit carry-less product
+ * works on them directly (Gueron-Kounavis). A product is kept
+ * unreduced as lo/hi; since the shift and reduction below are linear,
+ * the products x_1*H^8 ^ ... ^ x_8*H^1 of 8 blocks are summed first
+ * and reduced once.
+ */
+#define GCM_ATTR __attribute__((target("aes,pclmul,ssse3")))
+#define BSWAP128 _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+
+GCM_ATTR static inline void clmul_acc(__m128i x, __m128i h, __m128i *lo, __m128i *mid, __m128i *hi)
+{
+    *lo = _mm_xor_si128(*lo, _mm_clmulepi64_si128(x, h, 0x00));
+    *hi = _mm_xor_si128(*hi, _mm_clmulepi64_si128(x, h, 0x11));
+    *mid = _mm_xor_si128(*mid, _mm_xor_si128(_mm_clmulepi64_si128(x, h, 0x01),
+                                             _mm_clmulepi64_si128(x, h, 0x10)));
+}
+
+/* reduce the 256-bit product (lo, mid, hi) modulo x^128 + x^7 + x^2 + x + 1 */
+GCM_ATTR static inline __m128i ghash_reduce(__m128i lo, __m128i mid, __m128i hi)
+{
+    __m128i t7, t8, t9, t2;
+
+    lo = _mm_xor_si128(lo, _mm_slli_si128(mid, 8));
+    hi = _mm_xor_si128(hi, _mm_srli_si128(mid, 8));
+    /* the operands are bit-reflected: shift the product left by one */
+    t7 = _mm_srli_epi32(lo, 31);
+    t8 = _mm_srli_epi32(hi, 31);
+    lo = _mm_slli_epi32(lo, 1);
+    hi = _mm_slli_epi32(hi, 1);
+    t9 = _mm_srli_si128(t7, 12);
+    t8 = _mm_slli_si128(t8, 4);
+    t7 = _mm_slli_si128(t7, 4);
+    lo = _mm_or_si128(lo, t7);
+    hi = _mm_or_si128(_mm_or_si128(hi, t8), t9);
+    /* reduction */
+    t7 = _mm_xor_si128(_mm_xor_si128(_mm_slli_epi32(lo, 31), _mm_slli_epi32(lo, 30)), _mm_slli_epi32(lo, 25));
+    t8 = _mm_srli_si128(t7, 4);
+    lo = _mm_xor_si128(lo, _mm_slli_si128(t7, 12));
+    t2 = _mm_xor_si128(_mm_xor_si128(_mm_srli_epi32(lo, 1), _mm_srli_epi32(lo, 2)), _mm_srli_epi32(lo, 7));
+    lo = _mm_xor_si128(lo, _mm_xor_si128(t2, t8));
+    return _mm_xor_si128(hi, lo);
+}
+
+GCM_ATTR static inline __m128i gfmul(__m128i a, __m128i b)
+{
+    __m128i lo = _mm_setzero_si128(), mid = lo, hi = lo;
+
+    clmul_acc(a, b, &lo, &mid, &hi);
+    return ghash_reduce(lo, mid, hi);
+}
+
+GCM_ATTR static void ghash_pclmul_init(gcm_ctx *g)
+{
+    __m128i h = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)g->H), BSWAP128);
+    __m128i p = h;
+
+    for(int i=0;i<GCM_PAR;i++){
+        _mm_store_si128((__m128i *)g->Hpow[i], p);
+        p = gfmul(p, h);
+    }
+}
+
+/* y ^= x_1..x_8 against H^8..H^1, one reduction */
+GCM_ATTR static inline __m128i ghash_pclmul8(const gcm_ctx *g, __m128i y, const uint8_t *x)
+{
+    const __m128i bswap = BSWAP128;
+    __m128i lo = _mm_setzero_si128(), mid = lo, hi = lo, b;
+
+    for(int j=0;j<GCM_PAR;j++){
+        b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)x + j), bswap);
+        if(j == 0)
+            b = _mm_xor_si128(b, y);
+        clmul_acc(b, _mm_load_si128((const __m128i *)g->Hpow[GCM_PAR-1-j]), &lo, &mid, &hi);
+    }
+    return ghash_reduce(lo, mid, hi);
+}
+
+GCM_ATTR static void ghash_pclmul(const gcm_ctx *g, uint8_t *y, const uint8_t *x, size_t nblocks)
+{
+    const __m128i bswap = BSWAP128;
+    const __m128i h = _mm_load_si128((const __m128i *)g->Hpow[0]);
+    __m128i acc = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)y), bswap);
+
+    for(;nblocks>=GCM_PAR;nblocks-=GCM_PAR,x+=GCM_PAR*BLOCKLEN)
+        acc = ghash_pclmul8(g, acc, x);
+    for(;nblocks;nblocks--,x+=BLOCKLEN)
+        acc = gfmul(_mm_xor_si128(acc, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)x), bswap)), h);
+    _mm_storeu_si128((__m128i *)y, _mm_shuffle_epi8(acc, bswap));
+}
+
+#define GCM_EACH(op) \
+    b0 = op(b0, k); b1 = op(b1, k); b2 = op(b2, k); b3 = op(b3, k); \
+    b4 = op(b4, k); b5 = op(b5, k); b6 = op(b6, k); b7 = op(b7, k)
+
+#define GCM_CTR(j) _mm_shuffle_epi8(_mm_add_epi32(c, _mm_setr_epi32(j, 0, 0, 0)), bswap)
+
+#define GCM_XOR(j, b) \
+    _mm_storeu_si128((__m128i *)out + (j), \
+                     _mm_xor_si128(b, _mm_loadu_si128((const __m128i *)in + (j))))
+
+/*
+ * gcm_blocks_stitched() - CTR and GHASH of 8 blocks per iteration
+ *
+ * The clmuls of one ciphertext block go between two AES rounds, so the
+ * AESENC and PCLMULQDQ units work at the same time. Decryption hashes
+ * the ciphertext it is decrypting; encryption hashes the 8 blocks it
+ * produced in the previous iteration and the last 8 after the loop.
+ * ctr is the counter block, y the hash, both byte-reversed. Returns the
+ * number of blocks done, a multiple of 8.
+ */
+GCM_ATTR static size_t gcm_blocks_stitched(const gcm_ctx *g, __m128i *ctr, __m128i *y,
+                                           const uint8_t *in, uint8_t *out, size_t nblocks, int enc)
+{
+    const __m128i bswap = BSWAP128;
+    const __m128i *rk = (const __m128i *)g->aes.roundKey;
+    const uint8_t *hp = NULL;
+    __m128i b0, b1, b2, b3, b4, b5, b6, b7, k, x, c = *ctr, acc = *y;
+    __m128i lo, mid, hi;
+    int nr = g->aes.nr;
+    size_t done;
+
+    for(done=0;done+GCM_PAR<=nblocks;done+=GCM_PAR){
+        b0 = GCM_CTR(0); b1 = GCM_CTR(1); b2 = GCM_CTR(2); b3 = GCM_CTR(3);
+        b4 = GCM_CTR(4); b5 = GCM_CTR(5); b6 = GCM_CTR(6); b7 = GCM_CTR(7);
+        c = _mm_add_epi32(c, _mm_setr_epi32(GCM_PAR, 0, 0, 0));
+        k = _mm_loadu_si128(rk);
+        GCM_EACH(_mm_xor_si128);
+        if(!enc)
+            hp = in;
+        lo = mid = hi = _mm_setzero_si128();
+        for(int r=1;r<nr;r++){
+            k = _mm_loadu_si128(rk + r);
+            GCM_EACH(_mm_aesenc_si128);
+            if(hp && r <= GCM_PAR){
+                x = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)hp + r-1), bswap);
+                if(r == 1)
+                    x = _mm_xor_si128(x, acc);
+                clmul_acc(x, _mm_load_si128((const __m128i *)g->Hpow[GCM_PAR-r]), &lo, &mid, &hi);
+            }
+        }
+        k = _mm_loadu_si128(rk + nr);
+        GCM_EACH(_mm_aesenclast_si128);
+        if(hp)
+            acc = ghash_reduce(lo, mid, hi);
+        GCM_XOR(0, b0); GCM_XOR(1, b1); GCM_XOR(2, b2); GCM_XOR(3, b3);
+        GCM_XOR(4, b4); GCM_XOR(5, b5); GCM_XOR(6, b6); GCM_XOR(7, b7);
+        if(enc)
+            hp = out;
+        in += GCM_PAR*BLOCKLEN;
+        out += GCM_PAR*BLOCKLEN;
+    }
+    if(enc && hp)
+        acc = ghash_pclmul8(g, acc, hp);
+    *ctr = c;
+    *y = acc;
+    return done;
+}
+
+/* gcm_blocks_stitched() on counter block cb and hash y in byte order */
+GCM_ATTR static size_t gcm_stitched(const gcm_ctx *g, uint8_t *cb, uint8_t *y,
+                                    const uint8_t *in, uint8_t *out, size_t nblocks, int enc)
+{
+    const __m128i bswap = BSWAP128;
+    __m128i vc = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)cb), bswap);
+    __m128i vy = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)y), bswap);
+    size_t n;
+
+    n = gcm_blocks_stitched(g, &vc, &vy, in, out, nblocks, enc);
+    _mm_storeu_si128((__m128i *)cb, _mm_shuffle_epi8(vc, bswap));
+    _mm_storeu_si128((__m128i *)y, _mm_shuffle_epi8(vy, bswap));
+    return n;
+}
+#endif
+
+static void ghash(const gcm_ctx *g, uint8_t *y, const uint8_t *x, size_t nblocks)
+{
+#ifdef AES_X86
+    if(use_pclmul){
+        ghash_pclmul(g, y, x, nblocks);
+        return;
+    }
+#endif
+    ghash_table(g, y, x, nblocks);
+}
+
+/* GHASH of len bytes, the last block padded with zeros */
+static void ghash_pad(const gcm_ctx *g, uint8_t *y, const uint8_t *x, size_t len)
+{
+    uint8_t last[BLOCKLEN] = {0};
+
+    ghash(g, y, x, len / BLOCKLEN);
+    if(len % BLOCKLEN){
+        memcpy(last, x + len / BLOCKLEN * BLOCKLEN, len % BLOCKLEN);
+        ghash(g, y, last, 1);
+    }
+}
+
+/*
+ * gcm_select_pclmul() - GHASH with PCLMULQDQ (on != 0) or the 4-bit tables
+ * The default is PCLMULQDQ when CPUID reports it. Returns -1 if on is
+ * set and the CPU has no PCLMULQDQ.
+ */
+int gcm_select_pclmul(int on)
+{
+#ifdef AES_X86
+    __builtin_cpu_init();
+    if(on && !__builtin_cpu_supports("pclmul"))
+        return -1;
+    use_pclmul = on != 0;
+    return 0;
+#else
+    return on ? -1 : 0;
+#endif
+}
+
+__attribute__((constructor))
+static void gcm_init_dispatch(void)
+{
+    gcm_select_pclmul(1);
+}
+
+/*
+ * gcm_init() - AES key schedule and hash key H = E_K(0^128)
+ * Returns 0, or -1 if keybits is not 128, 192 or 256.
+ */
+int gcm_init(gcm_ctx *g, const uint8_t *key, int keybits)
+{
+    if(aes_ctx_init(&g->aes, key, keybits) != 0)
+        return -1;
+    memset(g->H, 0, BLOCKLEN);
+    aes_encrypt(&g->aes, g->H);
+    ghash_table_init(g);
+#ifdef AES_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3"))
+        ghash_pclmul_init(g);
+#endif
+    return 0;
+}
+
+/* pre-counter block J0 from the IV (SP 800-38D 7.1 step 2) */
+static void gcm_j0(const gcm_ctx *g, const uint8_t *iv, size_t ivlen, uint8_t *j0)
+{
+    uint8_t lenblk[BLOCKLEN] = {0};
+
+    if(ivlen == 12){
+        memcpy(j0, iv, 12);
+        j0[12] = j0[13] = j0[14] = 0;
+        j0[15] = 1;
+        return;
+    }
+    memset(j0, 0, BLOCKLEN);
+    ghash_pad(g, j0, iv, ivlen);
+    store_be64(lenblk + 8, (uint64_t)ivlen * 8);
+    ghash(g, j0, lenblk, 1);
+}
+
+static inline void inc32(uint8_t *cb)
+{
+    uint32_t c = (uint32_t)cb[12] << 24 | cb[13] << 16 | cb[14] << 8 | cb[15];
+
+    c++;
+    cb[12] = c >> 24; cb[13] = c >> 16; cb[14] = c >> 8; cb[15] = c;
+}
+
+/*
+ * gcm_crypt() - GCTR of len bytes from counter block cb, GHASH of the
+ * ciphertext into y; enc tells which side of the xor is the ciphertext.
+ */
+static void gcm_crypt(const gcm_ctx *g, uint8_t *cb, uint8_t *y,
+                      const uint8_t *in, uint8_t *out, size_t len, int enc)
+{
+    uint8_t ks[BLOCKLEN], c[BLOCKLEN];
+    size_t nblocks = len / BLOCKLEN, n, i;
+
+#ifdef AES_X86
+    if(use_pclmul && g->aes.impl == AES_AESNI && nblocks >= GCM_PAR){
+        n = gcm_stitched(g, cb, y, in, out, nblocks, enc);
+        in += n*BLOCKLEN;
+        out += n*BLOCKLEN;
+        len -= n*BLOCKLEN;
+    }
+#endif
+    while(len){
+        n = len < BLOCKLEN ? len : BLOCKLEN;
+        memcpy(ks, cb, BLOCKLEN);
+        aes_encrypt(&g->aes, ks);
+        inc32(cb);
+        memset(c, 0, BLOCKLEN);
+        for(i=0;i<n;i++){
+            uint8_t x = in[i];
+            out[i] = x ^ ks[i];
+            c[i] = enc ? out[i] : x;
+        }
+        ghash(g, y, c, 1);
+        in += n;
+        out += n;
+        len -= n;
+    }
+}
+
+static void gcm_tag(const gcm_ctx *g, const uint8_t *j0, uint8_t *y,
+                    size_t aadlen, size_t len, uint8_t *tag)
+{
+    uint8_t lenblk[BLOCKLEN];
+
+    store_be64(lenblk, (uint64_t)aadlen * 8);
+    store_be64(lenblk + 8, (uint64_t)len * 8);
+    ghash(g, y, lenblk, 1);
+    memcpy(tag, j0, BLOCKLEN);
+    aes_encrypt(&g->aes, tag);
+    for(int i=0;i<GCM_TAGLEN;i++)
+        tag[i] ^= y[i];
+}
+
+/*
+ * gcm_seal() - authenticated encryption of len bytes
+ * Writes len bytes of ciphertext to out (which may be in) and a
+ * GCM_TAGLEN-byte tag. The IV should be 12 bytes and never reused with
+ * the same key; other lengths go through GHASH.
+ */
+void gcm_seal(const gcm_ctx *g, const uint8_t *iv, size_t ivlen,
+              const uint8_t *aad, size_t aadlen,
+              const uint8_t *in, uint8_t *out, size_t len, uint8_t *tag)
+{
+    uint8_t j0[BLOCKLEN], cb[BLOCKLEN], y[BLOCKLEN] = {0};
+
+    gcm_j0(g, iv, ivlen, j0);
+    ghash_pad(g, y, aad, aadlen);
+    memcpy(cb, j0, BLOCKLEN);
+    inc32(cb);
+    gcm_crypt(g, cb, y, in, out, len, 1);
+    gcm_tag(g, j0, y, aadlen, len, tag);
+}
+
+/*
+ * gcm_open() - authenticated decryption of len bytes
+ * Returns 0 if the tag matches. Otherwise returns -1 and clears out, so
+ * unauthenticated plain text is never handed back.
+ */
+int gcm_open(const gcm_ctx *g, const uint8_t *iv, size_t ivlen,
+             const uint8_t *aad, size_t aadlen,
+             const uint8_t *in, uint8_t *out, size_t len, const uint8_t *tag)
+{
+    uint8_t j0[BLOCKLEN], cb[BLOCKLEN], y[BLOCKLEN] = {0}, t[GCM_TAGLEN];
+    uint8_t diff = 0;
+
+    gcm_j0(g, iv, ivlen, j0);
+    ghash_pad(g, y, aad, aadlen);
+    memcpy(cb, j0, BLOCKLEN);
+    inc32(cb);
+    gcm_crypt(g, cb, y, in, out, len, 0);
+    gcm_tag(g, j0, y, aadlen, len, t);
+    /* constant-time compare */
+    for(int i=0;i<GCM_TAGLEN;i++)
+        diff |= t[i] ^ tag[i];
+    if(diff){
+        memset(out, 0, len);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,98 @@
+#ifndef MODES_H
+#define MODES_H
+
+#include <stddef.h>
+#include "aes.h"
+
+/*
+ * Block cipher modes on top of aes_ctx
+ * All of them take an initialised aes_ctx, so the key size and the
+ * implementation are fixed by aes_ctx_init() and aes_select().
+ */
+#define AES_MAX_THREADS 64
+
+/*
+ * CTR mode (SP 800-38A): counter block i is iv + i as a 128-bit
+ * big-endian integer. Encryption and decryption are the same operation.
+ */
+#define CTR_MT_MIN (1 << 20)    /* bytes below which aes_ctr_mt() stays on one thread */
+
+void aes_ctr_add(uint8_t *ctr, uint64_t n);
+void aes_ctr(const aes_ctx *ctx, const uint8_t *iv, const uint8_t *in, uint8_t *out, size_t len);
+void aes_ctr_mt(const aes_ctx *ctx, const uint8_t *iv, const uint8_t *in, uint8_t *out, size_t len, int nthreads);
+
+/*
+ * CBC mode without padding; iv is updated to the last cipher text block.
+ * Decryption of different blocks is independent and is done in parallel.
+ */
+#define CBC_MT_MIN (1 << 20)    /* bytes below which aes_cbc_decrypt_mt() stays on one thread */
+
+int aes_cbc_encrypt(const aes_ctx *ctx, uint8_t *iv, const uint8_t *in, uint8_t *out, size_t len);
+int aes_cbc_decrypt(const aes_ctx *ctx, uint8_t *iv, const uint8_t *in, uint8_t *out, size_t len);
+int aes_cbc_decrypt_mt(const aes_ctx *ctx, uint8_t *iv, const uint8_t *in, uint8_t *out, size_t len, int nthreads);
+
+/*
+ * XTS-AES (IEEE 1619) with two keys: data is keyed with the first half
+ * of the key, tweak with the second. Sectors (data units) are numbered
+ * by a 64-bit sequence number and may end in a partial block.
+ */
+#define XTS_MT_MIN (1 << 20)    /* bytes below which the sector batch stays on one thread */
+
+typedef struct {
+    aes_ctx data;
+    aes_ctx tweak;
+} xts_ctx;
+
+int aes_xts_init(xts_ctx *x, const uint8_t *key, int keybits);
+int aes_xts_encrypt(const xts_ctx *x, uint64_t sector, const uint8_t *in, uint8_t *out, size_t len);
+int aes_xts_decrypt(const xts_ctx *x, uint64_t sector, const uint8_t *in, uint8_t *out, size_t len);
+int aes_xts_encrypt_sectors(const xts_ctx *x, uint64_t sector, const uint8_t *in, uint8_t *out,
+                            size_t sector_size, size_t nsectors, int nthreads);
+int aes_xts_decrypt_sectors(const xts_ctx *x, uint64_t sector, const uint8_t *in, uint8_t *out,
+                            size_t sector_size, size_t nsectors, int nthreads);
+
+/*
+ * GCM (SP 800-38D) with 16-byte tags
+ * HL/HH are the 4-bit tables of the software GHASH, Hpow holds
+ * H^1..H^8 byte-reversed for the PCLMULQDQ code.
+ */
+#define GCM_TAGLEN 16
+
+typedef struct {
+    aes_ctx aes;
+    uint8_t H[16];
+    uint64_t HL[16], HH[16];
+    uint8_t Hpow[8][16] __attribute__((aligned(16)));
+} gcm_ctx;
+
+int gcm_select_pclmul(int on);
+int gcm_init(gcm_ctx *g, const uint8_t *key, int keybits);
+void gcm_seal(const gcm_ctx *g, const uint8_t *iv, size_t ivlen,
+              const uint8_t *aad, size_t aadlen,
+              const uint8_t *in, uint8_t *out, size_t len, uint8_t *tag);
+int gcm_open(const gcm_ctx *g, const uint8_t *iv, size_t ivlen,
+             const uint8_t *aad, size_t aadlen,
+             const uint8_t *in, uint8_t *out, size_t len, const uint8_t *tag);
+
+/*
+ * Encrypt-then-MAC: AES-CTR with an HMAC-SHA-256 tag over the cipher
+ * text, computed in the same pass. ipad/opad are the SHA-256 states
+ * after the HMAC key blocks.
+ */
+#define ETM_TAGLEN 32
+
+typedef struct {
+    aes_ctx aes;
+    uint32_t ipad[8], opad[8];
+} etm_ctx;
+
+int etm_select_shani(int on);
+int etm_init(etm_ctx *e, const uint8_t *key, int keybits, const uint8_t *mackey, size_t mackeylen);
+void etm_seal(const etm_ctx *e, const uint8_t *iv, const uint8_t *aad, size_t aadlen,
+              const uint8_t *in, uint8_t *out, size_t len, uint8_t *tag);
+int etm_open(const etm_ctx *e, const uint8_t *iv, const uint8_t *aad, size_t aadlen,
+             const uint8_t *in, uint8_t *out, size_t len, const uint8_t *tag);
+void etm_mac(const etm_ctx *e, const uint8_t *iv, const uint8_t *aad, size_t aadlen,
+             const uint8_t *c, size_t len, uint8_t *tag);
+
+#endif
@@ -2,6 +2,10 @@
 #include <string.h>
 #include <stdlib.h>
 #include "aes.h"
+#include <unistd.h>
+#include "modes.h"
+#include "filecrypt.h"
+#include "../project5/sha2.h"
 /*
    <128 bits AES verification data>
    plain text: 01 23 45 67 89 ab cd ef fe dc ba 98 76 54 32 10
@@ -10,12 +14,123 @@
  */
 uint8_t in[BLOCKLEN] = {0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef, 0xfe, 0xdc, 0xba, 0x98, 0x76, 0x54, 0x32, 0x10};
 uint8_t key[KEYLEN] = {0x0f, 0x15, 0x71, 0xc9, 0x47, 0xd9, 0xe8, 0x59, 0x0c, 0xb7, 0xad, 0xd6, 0xaf, 0x7f, 0x67, 0x98};
+uint8_t out[BLOCKLEN] = {0xff, 0x0b, 0x84, 0x4a, 0x08, 0x53, 0xbf, 0x7c, 0x69, 0x34, 0xab, 0x43, 0x64, 0x14, 0x8f, 0xb9};
+/*
+   <FIPS-197 Appendix C verification data>
+   plain text: 00 11 22 ... ff
+   key: 00 01 02 ... (16, 24 or 32 bytes)
+ */
+/*
+   <SP 800-38A F.5.1 CTR-AES128 verification data>
+ */
+uint8_t ctr_key[16] = {0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c};
+uint8_t ctr_iv[16] = {0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff};
+uint8_t ctr_in[64] = {
+    0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+    0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+    0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11, 0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+    0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17, 0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10};
+uint8_t ctr_out[64] = {
+    0x87, 0x4d, 0x61, 0x91, 0xb6, 0x20, 0xe3, 0x26, 0x1b, 0xef, 0x68, 0x64, 0x99, 0x0d, 0xb6, 0xce,
+    0x98, 0x06, 0xf6, 0x6b, 0x79, 0x70, 0xfd, 0xff, 0x86, 0x17, 0x18, 0x7b, 0xb9, 0xff, 0xfd, 0xff,
+    0x5a, 0xe4, 0xdf, 0x3e, 0xdb, 0xd5, 0xd3, 0x5e, 0x5b, 0x4f, 0x09, 0x02, 0x0d, 0xb0, 0x3e, 0xab,
+    0x1e, 0x03, 0x1d, 0xda, 0x2f, 0xbe, 0x03, 0xd1, 0x79, 0x21, 0x70, 0xa0, 0xf3, 0x00, 0x9c, 0xee};
+/*
+   <SP 800-38A F.2.1 CBC-AES128 verification data>, same key & plain text as CTR
+ */
+uint8_t cbc_iv[16] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
+uint8_t cbc_out[64] = {
+    0x76, 0x49, 0xab, 0xac, 0x81, 0x19, 0xb2, 0x46, 0xce, 0xe9, 0x8e, 0x9b, 0x12, 0xe9, 0x19, 0x7d,
+    0x50, 0x86, 0xcb, 0x9b, 0x50, 0x72, 0x19, 0xee, 0x95, 0xdb, 0x11, 0x3a, 0x91, 0x76, 0x78, 0xb2,
+    0x73, 0xbe, 0xd6, 0xb8, 0xe3, 0xc1, 0x74, 0x3b, 0x71, 0x16, 0xe6, 0x9e, 0x22, 0x22, 0x95, 0x16,
+    0x3f, 0xf1, 0xca, 0xa1, 0x68, 0x1f, 0xac, 0x09, 0x12, 0x0e, 0xca, 0x30, 0x75, 0x86, 0xe1, 0xa7};
+/*
+   <XTS-AES-128 verification data>
+   IEEE 1619 vectors 1 and 2, and a 17-byte data unit with ciphertext
+   stealing under the vector 15 keys (cross-checked with OpenSSL)
+ */
+uint8_t xts_out1[32] = {
+    0x91, 0x7c, 0xf6, 0x9e, 0xbd, 0x68, 0xb2, 0xec, 0x9b, 0x9f, 0xe9, 0xa3, 0xea, 0xdd, 0xa6, 0x92,
+    0xcd, 0x43, 0xd2, 0xf5, 0x95, 0x98, 0xed, 0x85, 0x8c, 0x02, 0xc2, 0x65, 0x2f, 0xbf, 0x92, 0x2e};
+uint8_t xts_out2[32] = {
+    0xc4, 0x54, 0x18, 0x5e, 0x6a, 0x16, 0x93, 0x6e, 0x39, 0x33, 0x40, 0x38, 0xac, 0xef, 0x83, 0x8b,
+    0xfb, 0x18, 0x6f, 0xff, 0x74, 0x80, 0xad, 0xc4, 0x28, 0x93, 0x82, 0xec, 0xd6, 0xd3, 0x94, 0xf0};
+uint8_t xts_out17[17] = {
+    0x64, 0x16, 0x10, 0x67, 0x9d, 0xcb, 0xf9, 0x2e, 0x50, 0x5c, 0x41, 0x33, 0x3f, 0xb0, 0x6c, 0x2a, 0x95};
+/*
+   <GCM test cases 2, 4 and 5 (McGrew-Viega)>
+ */
+uint8_t gcm_key[16] = {0xfe, 0xff, 0xe9, 0x92, 0x86, 0x65, 0x73, 0x1c, 0x6d, 0x6a, 0x8f, 0x94, 0x67, 0x30, 0x83, 0x08};
+uint8_t gcm_iv[12] = {0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce, 0xdb, 0xad, 0xde, 0xca, 0xf8, 0x88};
+uint8_t gcm_aad[20] = {0xfe, 0xed, 0xfa, 0xce, 0xde, 0xad, 0xbe, 0xef, 0xfe, 0xed, 0xfa, 0xce, 0xde, 0xad, 0xbe, 0xef, 0xab, 0xad, 0xda, 0xd2};
+uint8_t gcm_in[60] = {
+    0xd9, 0x31, 0x32, 0x25, 0xf8, 0x84, 0x06, 0xe5, 0xa5, 0x59, 0x09, 0xc5, 0xaf, 0xf5, 0x26, 0x9a,
+    0x86, 0xa7, 0xa9, 0x53, 0x15, 0x34, 0xf7, 0xda, 0x2e, 0x4c, 0x30, 0x3d, 0x8a, 0x31, 0x8a, 0x72,
+    0x1c, 0x3c, 0x0c, 0x95, 0x95, 0x68, 0x09, 0x53, 0x2f, 0xcf, 0x0e, 0x24, 0x49, 0xa6, 0xb5, 0x25,
+    0xb1, 0x6a, 0xed, 0xf5, 0xaa, 0x0d, 0xe6, 0x57, 0xba, 0x63, 0x7b, 0x39};
+uint8_t gcm_out[60] = {
+    0x42, 0x83, 0x1e, 0xc2, 0x21, 0x77, 0x74, 0x24, 0x4b, 0x72, 0x21, 0xb7, 0x84, 0xd0, 0xd4, 0x9c,
+    0xe3, 0xaa, 0x21, 0x2f, 0x2c, 0x02, 0xa4, 0xe0, 0x35, 0xc1, 0x7e, 0x23, 0x29, 0xac, 0xa1, 0x2e,
+    0x21, 0xd5, 0x14, 0xb2, 0x54, 0x66, 0x93, 0x1c, 0x7d, 0x8f, 0x6a, 0x5a, 0xac, 0x84, 0xaa, 0x05,
+    0x1b, 0xa3, 0x0b, 0x39, 0x6a, 0x0a, 0xac, 0x97, 0x3d, 0x58, 0xe0, 0x91};
+uint8_t gcm_tag4[16] = {0x5b, 0xc9, 0x4f, 0xbc, 0x32, 0x21, 0xa5, 0xdb, 0x94, 0xfa, 0xe9, 0x5a, 0xe7, 0x12, 0x1a, 0x47};
+uint8_t gcm_tag5[16] = {0x36, 0x12, 0xd2, 0xe7, 0x9e, 0x3b, 0x07, 0x85, 0x56, 0x1b, 0xe1, 0x4a, 0xac, 0xa2, 0xfc, 0xcb};
+uint8_t gcm_out2[16] = {0x03, 0x88, 0xda, 0xce, 0x60, 0xb6, 0xa3, 0x92, 0xf3, 0x28, 0xc2, 0xb9, 0x71, 0xb2, 0xfe, 0x78};
+uint8_t gcm_tag2[16] = {0xab, 0x6e, 0x47, 0xd4, 0x2c, 0xec, 0x13, 0xbd, 0xf5, 0x3a, 0x67, 0xb2, 0x12, 0x57, 0xbd, 0xdf};
+/*
+   <RFC 4231 test case 2, HMAC-SHA-256>
+   key: "Jefe", data: "what do ya want for nothing?"
+ */
+uint8_t hmac_out2[32] = {
+    0x5b, 0xdc, 0xc1, 0x46, 0xbf, 0x60, 0x75, 0x4e, 0x6a, 0x04, 0x24, 0x26, 0x08, 0x95, 0x75, 0xc7,
+    0x5a, 0x00, 0x3f, 0x08, 0x9d, 0x27, 0x39, 0x83, 0x9d, 0xec, 0x58, 0xb9, 0x64, 0xec, 0x38, 0x43};
+uint8_t fips_in[BLOCKLEN] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff};
+uint8_t fips_out[3][BLOCKLEN] = {
+    {0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30, 0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a},
+    {0xdd, 0xa9, 0x7c, 0xa4, 0x86, 0x4c, 0xdf, 0xe0, 0x6e, 0xaf, 0x70, 0xa0, 0xec, 0x0d, 0x71, 0x91},
+    {0x8e, 0xa2, 0xb7, 0xca, 0x51, 0x67, 0x45, 0xbf, 0xea, 0xfc, 0x49, 0x90, 0x4b, 0x49, 0x60, 0x89}};
+
+/*
+ * Two-pass HMAC-SHA-256 with sha2.c, as reference for etm_seal()
+ */
+static void hmac_ref(const uint8_t *key, size_t keylen, const uint8_t *msg, size_t len, uint8_t *mac)
+{
+    uint8_t k0[SHA256_BLOCK_SIZE] = {0}, pad[SHA256_BLOCK_SIZE], inner[SHA256_DIGEST_SIZE];
+    sha256_ctx c;
+    int i;
+
+    if (keylen > SHA256_BLOCK_SIZE)
+        sha256(key, keylen, k0);
+    else
+        memcpy(k0, key, keylen);
+    for (i = 0; i < SHA256_BLOCK_SIZE; ++i)
+        pad[i] = k0[i] ^ 0x36;
+    sha256_init(&c);
+    sha256_update(&c, pad, SHA256_BLOCK_SIZE);
+    sha256_update(&c, msg, len);
+    sha256_final(&c, inner);
+    for (i = 0; i < SHA256_BLOCK_SIZE; ++i)
+        pad[i] = k0[i] ^ 0x5c;
+    sha256_init(&c);
+    sha256_update(&c, pad, SHA256_BLOCK_SIZE);
+    sha256_update(&c, inner, SHA256_DIGEST_SIZE);
+    sha256_final(&c, mac);
+}
 
 int main(void)
 {
-    uint32_t roundKey[RNDKEYSIZE];
-    uint8_t *p, buf[BLOCKLEN];
-    int i, count;
+    uint32_t roundKey[RNDKEYSIZE], rroundKey[RNDKEYSIZE], invRoundKey[RNDKEYSIZE];
+    uint8_t *p, buf[BLOCKLEN], ref[BLOCKLEN], rkey[KEYLEN], rin[BLOCKLEN];
+    uint8_t fkey[32], rkey2[32];
+    uint8_t bsbuf[8*BLOCKLEN], bsref[8*BLOCKLEN];
+    aes_ctx ctx, rctx;
+    aes_bs_ctx bs;
+    gcm_ctx gcm;
+    xts_ctx xts;
+    uint8_t tag[GCM_TAGLEN], rtag[ETM_TAGLEN], rtag2[ETM_TAGLEN], aad[100];
+    int pcl;
+    uint8_t ctr[BLOCKLEN], *mbuf, *mref;
+    int i, count, impl, mode, bits;
 
     printf("<key>\n");
     for (i = 0; i < KEYLEN; ++i)
@@ -49,6 +164,648 @@ int main(void)
     for (i = 0; i < BLOCKLEN; ++i)
         printf("%02x ", buf[i]);
     printf("\n");
+    /*
+     * Every implementation must give the verification cipher text and
+     * agree with the reference code on random keys & blocks
+     */
+    printf("Implementation testing"); fflush(stdout);
+    for (impl = AES_REF; impl < AES_NIMPL; ++impl) {
+        if (aes_select(impl) != 0)
+            continue;
+        KeyExpansion(key, roundKey);
+        memcpy(buf, in, BLOCKLEN);
+        Cipher(buf, roundKey, ENCRYPT);
+        if (memcmp(buf, out, BLOCKLEN) != 0) {
+            printf("Logic error\n");
+            exit(1);
+        }
+        Cipher(buf, roundKey, DECRYPT);
+        if (memcmp(buf, in, BLOCKLEN) != 0) {
+            printf("Logic error\n");
+            exit(1);
+        }
+        for (count = 0; count < 0xfff; ++count) {
+            arc4random_buf(rkey, KEYLEN);
+            KeyExpansion(rkey, rroundKey);
+            aes_select(AES_REF);
+            KeyExpansion(rkey, roundKey);
+            aes_select(impl);
+            if (memcmp(roundKey, rroundKey, sizeof(roundKey)) != 0) {
+                printf("Logic error\n");
+                exit(1);
+            }
+            InvKeyExpansion(rroundKey, invRoundKey);
+            aes_select(AES_REF);
+            InvKeyExpansion(rroundKey, roundKey);
+            aes_select(impl);
+            if (memcmp(roundKey, invRoundKey, sizeof(roundKey)) != 0) {
+                printf("Logic error\n");
+                exit(1);
+            }
+            arc4random_buf(rin, BLOCKLEN);
+            memcpy(buf, rin, BLOCKLEN);
+            memcpy(ref, rin, BLOCKLEN);
+            InvCipher(buf, invRoundKey);
+            Cipher(ref, rroundKey, DECRYPT);
+            if (memcmp(buf, ref, BLOCKLEN) != 0) {
+                printf("Logic error\n");
+                exit(1);
+            }
+            for (mode = DECRYPT; mode <= ENCRYPT; ++mode) {
+                memcpy(buf, rin, BLOCKLEN);
+                memcpy(ref, rin, BLOCKLEN);
+                Cipher(buf, rroundKey, mode);
+                aes_select(AES_REF);
+                Cipher(ref, rroundKey, mode);
+                aes_select(impl);
+                if (memcmp(buf, ref, BLOCKLEN) != 0) {
+                    printf("Logic error\n");
+                    exit(1);
+                }
+            }
+        }
+        printf(".");
+        fflush(stdout);
+    }
+    printf("No error found\n");
+    /*
+     * aes_ctx with all three key sizes: FIPS-197 vectors, then random
+     * keys & blocks against the reference code
+     */
+    printf("Key size testing"); fflush(stdout);
+    for (i = 0; i < 32; ++i)
+        fkey[i] = i;
+    for (impl = AES_REF; impl < AES_NIMPL; ++impl) {
+        if (aes_select(impl) != 0)
+            continue;
+        for (bits = 128; bits <= 256; bits += 64) {
+            aes_ctx_init(&ctx, fkey, bits);
+            memcpy(buf, fips_in, BLOCKLEN);
+            aes_encrypt(&ctx, buf);
+            if (memcmp(buf, fips_out[(bits-128)/64], BLOCKLEN) != 0) {
+                printf("Logic error\n");
+                exit(1);
+            }
+            aes_decrypt(&ctx, buf);
+            if (memcmp(buf, fips_in, BLOCKLEN) != 0) {
+                printf("Logic error\n");
+                exit(1);
+            }
+            for (count = 0; count < 0x3ff; ++count) {
+                arc4random_buf(rkey2, sizeof(rkey2));
+                arc4random_buf(rin, BLOCKLEN);
+                aes_ctx_init(&ctx, rkey2, bits);
+                aes_select(AES_REF);
+                aes_ctx_init(&rctx, rkey2, bits);
+                aes_select(impl);
+                if (memcmp(ctx.roundKey, rctx.roundKey, BLOCKLEN*(ctx.nr+1)) != 0 ||
+                    memcmp(ctx.invRoundKey, rctx.invRoundKey, BLOCKLEN*(ctx.nr+1)) != 0) {
+                    printf("Logic error\n");
+                    exit(1);
+                }
+                memcpy(buf, rin, BLOCKLEN);
+                memcpy(ref, rin, BLOCKLEN);
+                aes_encrypt(&ctx, buf);
+                aes_encrypt(&rctx, ref);
+                if (memcmp(buf, ref, BLOCKLEN) != 0) {
+                    printf("Logic error\n");
+                    exit(1);
+                }
+                aes_decrypt(&ctx, buf);
+                if (memcmp(buf, rin, BLOCKLEN) != 0) {
+                    printf("Logic error\n");
+                    exit(1);
+                }
+            }
+        }
+        printf(".");
+        fflush(stdout);
+    }
+    aes_select(AES_AUTO);
+    KeyExpansion(key, roundKey);
+    printf("No error found\n");
+    /*
+     * Bitsliced 8-block encryption against aes_encrypt()
+     */
+    printf("Bitsliced testing"); fflush(stdout);
+    for (bits = 128; bits <= 256; bits += 64) {
+        for (count = 0; count < 0x3ff; ++count) {
+            arc4random_buf(rkey2, sizeof(rkey2));
+            aes_ctx_init(&ctx, rkey2, bits);
+            if (aes_bs_init(&bs, ctx.roundKey, ctx.nr) != 0)
+                break;
+            arc4random_buf(bsbuf, sizeof(bsbuf));
+            memcpy(bsref, bsbuf, sizeof(bsbuf));
+            aes_bs_encrypt8(&bs, bsbuf);
+            for (i = 0; i < 8; ++i)
+                aes_encrypt(&ctx, bsref + i * BLOCKLEN);
+            if (memcmp(bsbuf, bsref, sizeof(bsbuf)) != 0) {
+                printf("Logic error\n");
+                exit(1);
+            }
+        }
+        printf(".");
+        fflush(stdout);
+    }
+    printf("No error found\n");
+    /*
+     * Key-agile batches: n (key, block) pairs, n not a multiple of the
+     * 8 lanes, against aes_ctx_init() + aes_encrypt() per key
+     */
+    printf("Key-agile testing"); fflush(stdout);
+    mbuf = malloc(37 * (32 + 2 * BLOCKLEN));
+    for (impl = AES_REF; impl < AES_NIMPL; ++impl) {
+        int ns[] = {1, 7, 8, 9, 37};
+        if (aes_select(impl) != 0)
+            continue;
+        for (bits = 128; bits <= 256; bits += 64) {
+            for (i = 0; i < 5; ++i) {
+                uint8_t *keys = mbuf, *blk = mbuf + 37 * 32, *exp = blk + 37 * BLOCKLEN;
+                arc4random_buf(mbuf, 37 * (32 + BLOCKLEN));
+                memcpy(exp, blk, ns[i] * BLOCKLEN);
+                if (aes_encrypt_keys(keys, bits, blk, ns[i]) != 0) {
+                    printf("Logic error\n");
+                    exit(1);
+                }
+                for (count = 0; count < ns[i]; ++count) {
+                    aes_ctx_init(&ctx, keys + count * bits / 8, bits);
+                    aes_encrypt(&ctx, exp + count * BLOCKLEN);
+                }
+                if (memcmp(blk, exp, ns[i] * BLOCKLEN) != 0) {
+                    printf("Logic error\n");
+                    exit(1);
+                }
+            }
+        }
+        printf(".");
+        fflush(stdout);
+    }
+    aes_select(AES_AUTO);
+    free(mbuf);
+    printf("No error found\n");
+    /*
+     * CTR mode: SP 800-38A vector, then random lengths and counters near
+     * a 64-bit carry against block-by-block aes_encrypt(), then the
+     * threaded path against the single-threaded one
+     */
+    printf("CTR testing"); fflush(stdout);
+    mbuf = malloc(3 * CTR_MT_MIN + 5);
+    mref = malloc(3 * CTR_MT_MIN + 5);
+    for (impl = AES_REF; impl < AES_NIMPL; ++impl) {
+        if (aes_select(impl) != 0)
+            continue;
+        aes_ctx_init(&ctx, ctr_key, 128);
+        aes_ctr(&ctx, ctr_iv, ctr_in, mbuf, sizeof(ctr_in));
+        if (memcmp(mbuf, ctr_out, sizeof(ctr_out)) != 0) {
+            printf("Logic error\n");
+            exit(1);
+        }
+        for (count = 0; count < 0xff; ++count) {
+            size_t len = arc4random_uniform(40 * BLOCKLEN);
+            arc4random_buf(rkey2, sizeof(rkey2));
+            aes_ctx_init(&ctx, rkey2, 128 + 64 * (count % 3));
+            arc4random_buf(ctr, BLOCKLEN);
+            if (count & 1)
+                memset(ctr + 8, 0xff, 7);
+            arc4random_buf(mbuf, len);
+            memcpy(mref, mbuf, len);
+            aes_ctr(&ctx, ctr, mbuf, mbuf, len);
+            memcpy(buf, ctr, BLOCKLEN);
+            for (size_t off = 0; off < len; off += BLOCKLEN) {
+                memcpy(ref, buf, BLOCKLEN);
+                aes_encrypt(&ctx, ref);
+                for (i = 0; i < BLOCKLEN && off + i < len; ++i)
+                    mref[off + i] ^= ref[i];
+                aes_ctr_add(buf, 1);
+            }
+            if (memcmp(mbuf, mref, len) != 0) {
+                printf("Logic error\n");
+                exit(1);
+            }
+        }
+        printf(".");
+        fflush(stdout);
+    }
+    aes_select(AES_AUTO);
+    aes_ctx_init(&ctx, rkey2, 256);
+    arc4random_buf(mbuf, 3 * CTR_MT_MIN + 5);
+    memcpy(mref, mbuf, 3 * CTR_MT_MIN + 5);
+    aes_ctr(&ctx, ctr, mbuf, mbuf, 3 * CTR_MT_MIN + 5);
+    aes_ctr_mt(&ctx, ctr, mref, mref, 3 * CTR_MT_MIN + 5, 4);
+    if (memcmp(mbuf, mref, 3 * CTR_MT_MIN + 5) != 0) {
+        printf("Logic error\n");
+        exit(1);
+    }
+    free(mbuf);
+    free(mref);
+    printf("No error found\n");
+    /*
+     * GCM: test vectors with both GHASH implementations, then random
+     * lengths with the stitched AES-NI/PCLMULQDQ path against T-tables
+     * and 4-bit tables, open() round trip and a flipped tag bit
+     */
+    printf("GCM testing"); fflush(stdout);
+    mbuf = malloc(64 * BLOCKLEN);
+    mref = malloc(64 * BLOCKLEN);
+    for (pcl = 0; pcl <= 1; ++pcl) {
+        if (gcm_select_pclmul(pcl) != 0)
+            continue;
+        memset(rkey2, 0, sizeof(rkey2));
+        memset(buf, 0, BLOCKLEN);
+        gcm_init(&gcm, rkey2, 128);
+        gcm_seal(&gcm, rkey2, 12, NULL, 0, buf, buf, BLOCKLEN, tag);
+        if (memcmp(buf, gcm_out2, BLOCKLEN) != 0 || memcmp(tag, gcm_tag2, GCM_TAGLEN) != 0) {
+            printf("Logic error\n");
+            exit(1);
+        }
+        gcm_init(&gcm, gcm_key, 128);
+        gcm_seal(&gcm, gcm_iv, 12, gcm_aad, sizeof(gcm_aad), gcm_in, mbuf, sizeof(gcm_in), tag);
+        if (memcmp(mbuf, gcm_out, sizeof(gcm_out)) != 0 || memcmp(tag, gcm_tag4, GCM_TAGLEN) != 0) {
+            printf("Logic error\n");
+            exit(1);
+        }
+        gcm_seal(&gcm, gcm_iv, 8, gcm_aad, sizeof(gcm_aad), gcm_in, mbuf, sizeof(gcm_in), tag);
+        if (memcmp(tag, gcm_tag5, GCM_TAGLEN) != 0) {
+            printf("Logic error\n");
+            exit(1);
+        }
+        printf(".");
+        fflush(stdout);
+    }
+    for (count = 0; count < 0xff; ++count) {
+        size_t len = arc4random_uniform(64 * BLOCKLEN), alen = arc4random_uniform(sizeof(aad));
+        size_t ivlen = count & 1 ? 12 : 1 + arc4random_uniform(BLOCKLEN * 2);
+        uint8_t iv[BLOCKLEN * 2];
+        arc4random_buf(rkey2, sizeof(rkey2));
+        arc4random_buf(iv, sizeof(iv));
+        arc4random_buf(aad, sizeof(aad));
+        arc4random_buf(mref, len);
+        bits = 128 + 64 * (count % 3);
+        aes_select(AES_TTABLE);
+        gcm_select_pclmul(0);
+        gcm_init(&gcm, rkey2, bits);
+        gcm_seal(&gcm, iv, ivlen, aad, alen, mref, mbuf, len, rtag);
+        aes_select(AES_AUTO);
+        gcm_select_pclmul(1);
+        gcm_init(&gcm, rkey2, bits);
+        if (gcm_open(&gcm, iv, ivlen, aad, alen, mbuf, mbuf, len, rtag) != 0 ||
+            memcmp(mbuf, mref, len) != 0) {
+            printf("Logic error\n");
+            exit(1);
+        }
+        gcm_seal(&gcm, iv, ivlen, aad, alen, mref, mbuf, len, tag);
+        if (memcmp(tag, rtag, GCM_TAGLEN) != 0) {
+            printf("Logic error\n");
+            exit(1);
+        }
+        tag[count % GCM_TAGLEN] ^= 1 << (count % 8);
+        if (gcm_open(&gcm, iv, ivlen, aad, alen, mbuf, mbuf, len, tag) != -1) {
+            printf("Logic error\n");
+            exit(1);
+        }
+    }
+    aes_select(AES_AUTO);
+    gcm_select_pclmul(1);
+    free(mbuf);
+    free(mref);
+    printf("No error found\n");
+    /*
+     * CBC: SP 800-38A vector, random in-place round trips split in two
+     * calls for every implementation, threaded decryption in place
+     */
+    printf("CBC testing"); fflush(stdout);
+    mbuf = malloc(3 * CBC_MT_MIN);
+    mref = malloc(3 * CBC_MT_MIN);
+    for (impl = AES_REF; impl < AES_NIMPL; ++impl) {
+        if (aes_select(impl) != 0)
+            continue;
+        aes_ctx_init(&ctx, ctr_key, 128);
+        memcpy(ctr, cbc_iv, BLOCKLEN);
+        aes_cbc_encrypt(&ctx, ctr, ctr_in, mbuf, sizeof(ctr_in));
+        if (memcmp(mbuf, cbc_out, sizeof(cbc_out)) != 0) {
+            printf("Logic error\n");
+            exit(1);
+        }
+        memcpy(ctr, cbc_iv, BLOCKLEN);
+        aes_cbc_decrypt(&ctx, ctr, mbuf, mbuf, sizeof(cbc_out));
+        if (memcmp(mbuf, ctr_in, sizeof(ctr_in)) != 0) {
+            printf("Logic error\n");
+            exit(1);
+        }
+        for (count = 0; count < 0xff; ++count) {
+            size_t n = arc4random_uniform(40), half = arc4random_uniform(n + 1);
+            uint8_t iv0[BLOCKLEN];
+            arc4random_buf(rkey2, sizeof(rkey2));
+            aes_ctx_init(&ctx, rkey2, 128 + 64 * (count % 3));
+            arc4random_buf(iv0, BLOCKLEN);
+            arc4random_buf(mref, n * BLOCKLEN);
+            memcpy(ctr, iv0, BLOCKLEN);
+            aes_cbc_encrypt(&ctx, ctr, mref, mbuf, n * BLOCKLEN);
+            memcpy(ctr, iv0, BLOCKLEN);
+            aes_cbc_decrypt(&ctx, ctr, mbuf, mbuf, half * BLOCKLEN);
+            aes_cbc_decrypt(&ctx, ctr, mbuf + half * BLOCKLEN, mbuf + half * BLOCKLEN, (n - half) * BLOCKLEN);
+            if (memcmp(mbuf, mref, n * BLOCKLEN) != 0) {
+                printf("Logic error\n");
+                exit(1);
+            }
+        }
+        printf(".");
+        fflush(stdout);
+    }
+    aes_select(AES_AUTO);
+    aes_ctx_init(&ctx, rkey2, 192);
+    arc4random_buf(mref, 3 * CBC_MT_MIN);
+    arc4random_buf(rin, BLOCKLEN);
+    memcpy(ctr, rin, BLOCKLEN);
+    aes_cbc_encrypt(&ctx, ctr, mref, mbuf, 3 * CBC_MT_MIN);
+    memcpy(buf, ctr, BLOCKLEN);
+    memcpy(ctr, rin, BLOCKLEN);
+    aes_cbc_decrypt_mt(&ctx, ctr, mbuf, mbuf, 3 * CBC_MT_MIN, 4);
+    if (memcmp(mbuf, mref, 3 * CBC_MT_MIN) != 0 || memcmp(ctr, buf, BLOCKLEN) != 0) {
+        printf("Logic error\n");
+        exit(1);
+    }
+    free(mbuf);
+    free(mref);
+    printf("No error found\n");
+    /*
+     * Encrypt-then-MAC: stitched and sliced paths against aes_ctr() and a
+     * two-pass sha2.c HMAC over iv || aad || pad || C || lengths, in place
+     * and with a flipped byte
+     */
+    printf("ETM testing"); fflush(stdout);
+    hmac_ref((const uint8_t *)"Jefe", 4, (const uint8_t *)"what do ya want for nothing?", 28, rtag2);
+    if (memcmp(rtag2, hmac_out2, 32) != 0) {
+        printf("Logic error\n");
+        exit(1);
+    }
+    mbuf = malloc(3 * 8192);
+    mref = malloc(3 * 8192);
+    for (impl = AES_REF; impl < AES_NIMPL; ++impl) {
+        if (aes_select(impl) != 0)
+            continue;
+        for (pcl = 1; pcl >= 0; --pcl) {
+            if (etm_select_shani(pcl) != 0)
+                continue;
+            for (count = 0; count < 0x40; ++count) {
+                size_t len = count < 8 ? (size_t)count * 61 : arc4random_uniform(impl == AES_REF ? 600 : 5000);
+                size_t aadlen = arc4random_uniform(100), macklen = 1 + arc4random_uniform(100), m;
+                uint8_t mackey[100], iv16[BLOCKLEN];
+                etm_ctx *etm = malloc(sizeof(*etm));
+
+                bits = 128 + 64 * (count % 3);
+                arc4random_buf(rkey2, sizeof(rkey2));
+                arc4random_buf(mackey, macklen);
+                arc4random_buf(iv16, BLOCKLEN);
+                arc4random_buf(aad, aadlen);
+                arc4random_buf(mref, len);
+                etm_init(etm, rkey2, bits, mackey, macklen);
+                memcpy(mbuf, mref, len);
+                etm_seal(etm, iv16, aad, aadlen, mbuf, mbuf, len, rtag2);
+                /* reference: CTR, then the MAC input assembled in mref + 8192 */
+                aes_ctx_init(&rctx, rkey2, bits);
+                p = mref + 8192;
+                memcpy(p, iv16, BLOCKLEN);
+                memcpy(p + BLOCKLEN, aad, aadlen);
+                m = (BLOCKLEN + aadlen + 63) / 64 * 64;
+                memset(p + BLOCKLEN + aadlen, 0, m - BLOCKLEN - aadlen);
+                aes_ctr(&rctx, iv16, mref, p + m, len);
+                memset(p + m + len, 0, 16);
+                for (i = 0; i < 8; ++i) {
+                    p[m + len + 7 - i] = (uint8_t)((uint64_t)aadlen >> (8 * i));
+                    p[m + len + 15 - i] = (uint8_t)((uint64_t)len >> (8 * i));
+                }
+                hmac_ref(mackey, macklen, p, m + len + 16, rtag);
+                if (memcmp(mbuf, p + m, len) != 0 || memcmp(rtag2, rtag, ETM_TAGLEN) != 0 ||
+                    etm_open(etm, iv16, aad, aadlen, mbuf, mbuf, len, rtag2) != 0 ||
+                    memcmp(mbuf, mref, len) != 0) {
+                    printf("Logic error\n");
+                    exit(1);
+                }
+                etm_seal(etm, iv16, aad, aadlen, mref, mbuf, len, rtag2);
+                etm_mac(etm, iv16, aad, aadlen, mbuf, len, rtag);
+                if (memcmp(rtag, rtag2, ETM_TAGLEN) != 0) {
+                    printf("Logic error\n");
+                    exit(1);
+                }
+                if (len)
+                    mbuf[arc4random_uniform(len)] ^= 0x01;
+                else
+                    rtag2[0] ^= 0x01;
+                if (etm_open(etm, iv16, aad, aadlen, mbuf, mbuf, len, rtag2) != -1) {
+                    printf("Logic error\n");
+                    exit(1);
+                }
+                free(etm);
+            }
+            printf(".");
+            fflush(stdout);
+        }
+    }
+    aes_select(AES_AUTO);
+    etm_select_shani(1);
+    free(mbuf);
+    free(mref);
+    printf("No error found\n");
+    /*
+     * XTS: IEEE 1619 vectors, random sector sizes (with stealing) against
+     * the reference code, in-place decryption, threaded sector batches
+     */
+    printf("XTS testing"); fflush(stdout);
+    mbuf = malloc(4096 * 1024);
+    mref = malloc(4096 * 1024);
+    for (impl = AES_REF; impl < AES_NIMPL; ++impl) {
+        if (aes_select(impl) != 0)
+            continue;
+        memset(rkey2, 0, sizeof(rkey2));
+        memset(mref, 0, 32);
+        aes_xts_init(&xts, rkey2, 128);
+        aes_xts_encrypt(&xts, 0, mref, mbuf, 32);
+        if (memcmp(mbuf, xts_out1, 32) != 0) {
+            printf("Logic error\n");
+            exit(1);
+        }
+        memset(rkey2, 0x11, 16);
+        memset(rkey2 + 16, 0x22, 16);
+        memset(mref, 0x44, 32);
+        aes_xts_init(&xts, rkey2, 128);
+        aes_xts_encrypt(&xts, 0x3333333333ULL, mref, mbuf, 32);
+        if (memcmp(mbuf, xts_out2, 32) != 0) {
+            printf("Logic error\n");
+            exit(1);
+        }
+        for (i = 0; i < 16; ++i) {
+            rkey2[i] = 0xff - i;
+            rkey2[16 + i] = 0xbf - i;
+        }
+        for (i = 0; i < 17; ++i)
+            mref[i] = i;
+        aes_xts_init(&xts, rkey2, 128);
+        aes_xts_encrypt(&xts, 0x9a78563412ULL, mref, mbuf, 17);
+        if (memcmp(mbuf, xts_out17, 17) != 0) {
+            printf("Logic error\n");
+            exit(1);
+        }
+        for (count = 0; count < 0xff; ++count) {
+            size_t len = BLOCKLEN + arc4random_uniform(40 * BLOCKLEN);
+            uint64_t sector = ((uint64_t)arc4random() << 32) | arc4random();
+            bits = count & 1 ? 256 : 128;
+            arc4random_buf(rkey2, sizeof(rkey2));
+            arc4random_buf(mref, len);
+            aes_xts_init(&xts, rkey2, bits);
+            aes_xts_encrypt(&xts, sector, mref, mbuf, len);
+            aes_select(AES_REF);
+            aes_xts_init(&xts, rkey2, bits);
+            aes_xts_encrypt(&xts, sector, mref, mref + len, len);
+            aes_select(impl);
+            aes_xts_init(&xts, rkey2, bits);
+            if (memcmp(mbuf, mref + len, len) != 0) {
+                printf("Logic error\n");
+                exit(1);
+            }
+            aes_xts_decrypt(&xts, sector, mbuf, mbuf, len);
+            if (memcmp(mbuf, mref, len) != 0) {
+                printf("Logic error\n");
+                exit(1);
+            }
+        }
+        printf(".");
+        fflush(stdout);
+    }
+    aes_select(AES_AUTO);
+    arc4random_buf(rkey2, sizeof(rkey2));
+    aes_xts_init(&xts, rkey2, 256);
+    for (size_t ss = 512; ss <= 4096; ss += 4096 - 512 - 8) {
+        size_t ns = 4096 * 1024 / ss;
+        arc4random_buf(mref, ns * ss);
+        aes_xts_encrypt_sectors(&xts, 1000, mref, mbuf, ss, ns, 4);
+        for (i = 0; i < 8; ++i) {
+            size_t k = arc4random_uniform(ns);
+            aes_xts_decrypt(&xts, 1000 + k, mbuf + k * ss, mbuf + k * ss, ss);
+            if (memcmp(mbuf + k * ss, mref + k * ss, ss) != 0) {
+                printf("Logic error\n");
+                exit(1);
+            }
+            aes_xts_encrypt(&xts, 1000 + k, mref + k * ss, mbuf + k * ss, ss);
+        }
+        aes_xts_decrypt_sectors(&xts, 1000, mbuf, mbuf, ss, ns, 4);
+        if (memcmp(mbuf, mref, ns * ss) != 0) {
+            printf("Logic error\n");
+            exit(1);
+        }
+    }
+    free(mbuf);
+    free(mref);
+    printf("No error found\n");
+    /*
+     * Files: sizes around the 4 KiB chunk boundary through the mapped
+     * path and a pipe through the read() path, then a flipped byte and a
+     * dropped final chunk, which must both be refused
+     */
+    printf("File testing"); fflush(stdout);
+    mbuf = malloc(4 * 4096 + 64);
+    mref = malloc(4 * 4096 + 64);
+    {
+        size_t sizes[] = {0, 1, 4095, 4096, 4097, 3 * 4096 + 17};
+        FILE *fp = tmpfile(), *fc = tmpfile(), *fd = tmpfile();
+        int pfd[2];
+
+        arc4random_buf(rkey2, sizeof(rkey2));
+        for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+            size_t n = sizes[i];
+            arc4random_buf(mref, n);
+            if (ftruncate(fileno(fp), 0) || ftruncate(fileno(fc), 0) || ftruncate(fileno(fd), 0) ||
+                pwrite(fileno(fp), mref, n, 0) != (ssize_t)n) {
+                printf("Logic error\n");
+                exit(1);
+            }
+            lseek(fileno(fp), 0, SEEK_SET);
+            lseek(fileno(fc), 0, SEEK_SET);
+            lseek(fileno(fd), 0, SEEK_SET);
+            if (aes_file_encrypt(fileno(fp), fileno(fc), rkey2, 256, 12, 3) != 0) {
+                printf("Logic error\n");
+                exit(1);
+            }
+            lseek(fileno(fc), 0, SEEK_SET);
+            if (aes_file_decrypt(fileno(fc), fileno(fd), rkey2, 256, 2) != 0 ||
+                pread(fileno(fd), mbuf, n + 1, 0) != (ssize_t)n || memcmp(mbuf, mref, n) != 0) {
+                printf("Logic error\n");
+                exit(1);
+            }
+            printf(".");
+            fflush(stdout);
+        }
+        /* fc holds the last, 4-chunk file; flip one cipher text byte */
+        pread(fileno(fc), mbuf, 1, FC_HDRLEN + 4096 + 100);
+        mbuf[0] ^= 1;
+        pwrite(fileno(fc), mbuf, 1, FC_HDRLEN + 4096 + 100);
+        lseek(fileno(fc), 0, SEEK_SET);
+        lseek(fileno(fd), 0, SEEK_SET);
+        if (aes_file_decrypt(fileno(fc), fileno(fd), rkey2, 256, 2) != FC_EAUTH) {
+            printf("Logic error\n");
+            exit(1);
+        }
+        mbuf[0] ^= 1;
+        pwrite(fileno(fc), mbuf, 1, FC_HDRLEN + 4096 + 100);
+        if (ftruncate(fileno(fc), FC_HDRLEN + 3 * (4096 + GCM_TAGLEN)) != 0) {
+            printf("Logic error\n");
+            exit(1);
+        }
+        lseek(fileno(fc), 0, SEEK_SET);
+        lseek(fileno(fd), 0, SEEK_SET);
+        if (aes_file_decrypt(fileno(fc), fileno(fd), rkey2, 256, 2) == 0) {
+            printf("Logic error\n");
+            exit(1);
+        }
+        /* pipe input: stays in the pipe buffer, so no writer thread is needed */
+        if (pipe(pfd) != 0 || write(pfd[1], mref, 5000) != 5000) {
+            printf("Logic error\n");
+            exit(1);
+        }
+        close(pfd[1]);
+        if (ftruncate(fileno(fc), 0) || ftruncate(fileno(fd), 0))
+            exit(1);
+        lseek(fileno(fc), 0, SEEK_SET);
+        lseek(fileno(fd), 0, SEEK_SET);
+        if (aes_file_encrypt(pfd[0], fileno(fc), rkey2, 128, 12, 2) != 0) {
+            printf("Logic error\n");
+            exit(1);
+        }
+        close(pfd[0]);
+        lseek(fileno(fc), 0, SEEK_SET);
+        if (aes_file_decrypt(fileno(fc), fileno(fd), rkey2, 128, 4) != 0 ||
+            pread(fileno(fd), mbuf, 5001, 0) != 5000 || memcmp(mbuf, mref, 5000) != 0) {
+            printf("Logic error\n");
+            exit(1);
+        }
+        /* chunk 0 opened by hand under HMAC-SHA-256(key, "AESF" || salt) */
+        {
+            gcm_ctx *g = malloc(sizeof(*g));
+            uint8_t h[FC_HDRLEN], msg[4 + FC_SALTLEN] = "AESF", fkey[SHA256_DIGEST_SIZE], iv12[12] = {0};
+
+            if (pread(fileno(fc), h, FC_HDRLEN, 0) != FC_HDRLEN ||
+                pread(fileno(fc), mbuf, 4096 + GCM_TAGLEN, FC_HDRLEN) != 4096 + GCM_TAGLEN) {
+                printf("Logic error\n");
+                exit(1);
+            }
+            memcpy(msg + 4, h + 16, FC_SALTLEN);
+            hmac_ref(rkey2, 16, msg, sizeof(msg), fkey);
+            gcm_init(g, fkey, 128);
+            memcpy(iv12, h + 9, 7);
+            if (gcm_open(g, iv12, 12, h, FC_HDRLEN, mbuf, mbuf, 4096, mbuf + 4096) != 0 ||
+                memcmp(mbuf, mref, 4096) != 0) {
+                printf("Logic error\n");
+                exit(1);
+            }
+            free(g);
+        }
+        fclose(fp);
+        fclose(fc);
+        fclose(fd);
+    }
+    free(mbuf);
+    free(mref);
+    printf("No error found\n");
     /*
      * Select random key & plain text, verify whether crypt * 100 -> decrypt * 200 -> crypt * 100 == plain text
      */
@@ -0,0 +1,246 @@
+#include <string.h>
+#include <pthread.h>
+#include "modes.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define AES_X86
+#endif
+
+#define XTS_PAR 8       /* blocks per iteration of the AES-NI path */
+
+struct xts_job {
+    const xts_ctx *ctx;
+    uint64_t sector;
+    const uint8_t *in;
+    uint8_t *out;
+    size_t sector_size, nsectors;
+    int enc;
+};
+
+/*
+ * Tweaks are 128-bit little-endian integers (IEEE 1619); multiplying by
+ * alpha in GF(2^128) is a left shift with x^128 = x^7 + x^2 + x + 1.
+ */
+static inline void xts_double(uint64_t *t)
+{
+    uint64_t carry = t[1] >> 63;
+
+    t[1] = t[1] << 1 | t[0] >> 63;
+    t[0] = t[0] << 1 ^ (0x87 & -carry);
+}
+
+/* out = E/D(in ^ t) ^ t for one block */
+static void xts_block(const aes_ctx *ctx, const uint64_t *t, const uint8_t *in, uint8_t *out, int enc)
+{
+    uint8_t b[BLOCKLEN], tb[BLOCKLEN];
+
+    memcpy(tb, t, BLOCKLEN);
+    for(int i=0;i<BLOCKLEN;i++)
+        b[i] = in[i] ^ tb[i];
+    if(enc)
+        aes_encrypt(ctx, b);
+    else
+        aes_decrypt(ctx, b);
+    for(int i=0;i<BLOCKLEN;i++)
+        out[i] = b[i] ^ tb[i];
+}
+
+#ifdef AES_X86
+#define XTS_EACH(op) \
+    b0 = op(b0, k); b1 = op(b1, k); b2 = op(b2, k); b3 = op(b3, k); \
+    b4 = op(b4, k); b5 = op(b5, k); b6 = op(b6, k); b7 = op(b7, k)
+
+#define XTS_LOAD(j) \
+    (w##j = _mm_set_epi64x(t[1], t[0]), xts_double(t), \
+     _mm_xor_si128(_mm_loadu_si128((const __m128i *)in + (j)), w##j))
+
+#define XTS_STORE(j) _mm_storeu_si128((__m128i *)out + (j), _mm_xor_si128(b##j, w##j))
+
+/*
+ * xts_blocks_aesni() - 8 blocks per iteration, interleaved as in ctr.c
+ * Returns the number of blocks done; t is advanced past them.
+ */
+__attribute__((target("aes,sse2")))
+static size_t xts_blocks_aesni(const aes_ctx *ctx, uint64_t *t, const uint8_t *in, uint8_t *out,
+                               size_t nblocks, int enc)
+{
+    const __m128i *rk = (const __m128i *)(enc ? ctx->roundKey : ctx->invRoundKey);
+    __m128i b0, b1, b2, b3, b4, b5, b6, b7, k;
+    __m128i w0, w1, w2, w3, w4, w5, w6, w7;
+    int nr = ctx->nr;
+    size_t done;
+
+    for(done=0;done+XTS_PAR<=nblocks;done+=XTS_PAR){
+        b0 = XTS_LOAD(0); b1 = XTS_LOAD(1); b2 = XTS_LOAD(2); b3 = XTS_LOAD(3);
+        b4 = XTS_LOAD(4); b5 = XTS_LOAD(5); b6 = XTS_LOAD(6); b7 = XTS_LOAD(7);
+        k = _mm_loadu_si128(rk);
+        XTS_EACH(_mm_xor_si128);
+        if(enc){
+            for(int r=1;r<nr;r++){
+                k = _mm_loadu_si128(rk + r);
+                XTS_EACH(_mm_aesenc_si128);
+            }
+            k = _mm_loadu_si128(rk + nr);
+            XTS_EACH(_mm_aesenclast_si128);
+        }
+        else{
+            for(int r=1;r<nr;r++){
+                k = _mm_loadu_si128(rk + r);
+                XTS_EACH(_mm_aesdec_si128);
+            }
+            k = _mm_loadu_si128(rk + nr);
+            XTS_EACH(_mm_aesdeclast_si128);
+        }
+        XTS_STORE(0); XTS_STORE(1); XTS_STORE(2); XTS_STORE(3);
+        XTS_STORE(4); XTS_STORE(5); XTS_STORE(6); XTS_STORE(7);
+        in += XTS_PAR*BLOCKLEN;
+        out += XTS_PAR*BLOCKLEN;
+    }
+    return done;
+}
+#endif
+
+/*
+ * xts_sector() - one data unit of len >= 16 bytes
+ * A partial last block is handled with ciphertext stealing: the last
+ * full block and the partial one swap their tails, and for decryption
+ * the two tweaks are used in the opposite order.
+ */
+static int xts_sector(const xts_ctx *x, uint64_t sector, const uint8_t *in, uint8_t *out, size_t len, int enc)
+{
+    size_t nblocks = len / BLOCKLEN, r = len % BLOCKLEN, done = 0;
+    uint64_t t[2], t1[2];
+    uint8_t cc[BLOCKLEN], pp[BLOCKLEN];
+
+    if(len < BLOCKLEN)
+        return -1;
+    /* T = E_K2(sector number as a 16-byte little-endian integer) */
+    t[0] = sector;
+    t[1] = 0;
+    aes_encrypt(&x->tweak, (uint8_t *)t);
+    if(r)
+        nblocks--;
+#ifdef AES_X86
+    if(x->data.impl == AES_AESNI)
+        done = xts_blocks_aesni(&x->data, t, in, out, nblocks, enc);
+#endif
+    for(;done<nblocks;done++){
+        xts_block(&x->data, t, in + done*BLOCKLEN, out + done*BLOCKLEN, enc);
+        xts_double(t);
+    }
+    if(r == 0)
+        return 0;
+    in += nblocks*BLOCKLEN;
+    out += nblocks*BLOCKLEN;
+    memcpy(t1, t, BLOCKLEN);
+    xts_double(t1);
+    /* cc = last full block with the tweak that comes first in the stream */
+    xts_block(&x->data, enc ? t : t1, in, cc, enc);
+    memcpy(pp, in + BLOCKLEN, r);
+    memcpy(pp + r, cc + r, BLOCKLEN - r);
+    memcpy(out + BLOCKLEN, cc, r);
+    xts_block(&x->data, enc ? t1 : t, pp, out, enc);
+    return 0;
+}
+
+/*
+ * aes_xts_init() - two-key XTS-AES; key is data key || tweak key
+ * keybits is the size of one of the two keys, 128 or 256.
+ */
+int aes_xts_init(xts_ctx *x, const uint8_t *key, int keybits)
+{
+    if(keybits != 128 && keybits != 256)
+        return -1;
+    if(aes_ctx_init(&x->data, key, keybits) != 0 ||
+       aes_ctx_init(&x->tweak, key + keybits/8, keybits) != 0)
+        return -1;
+    return 0;
+}
+
+/*
+ * aes_xts_encrypt(), aes_xts_decrypt() - one sector of len >= 16 bytes
+ * Returns 0, or -1 if len is shorter than a block.
+ */
+int aes_xts_encrypt(const xts_ctx *x, uint64_t sector, const uint8_t *in, uint8_t *out, size_t len)
+{
+    return xts_sector(x, sector, in, out, len, 1);
+}
+
+int aes_xts_decrypt(const xts_ctx *x, uint64_t sector, const uint8_t *in, uint8_t *out, size_t len)
+{
+    return xts_sector(x, sector, in, out, len, 0);
+}
+
+static void *xts_worker(void *p)
+{
+    struct xts_job *j = p;
+
+    for(size_t i=0;i<j->nsectors;i++)
+        xts_sector(j->ctx, j->sector + i, j->in + i*j->sector_size,
+                   j->out + i*j->sector_size, j->sector_size, j->enc);
+    return NULL;
+}
+
+static int xts_sectors(const xts_ctx *x, uint64_t sector, const uint8_t *in, uint8_t *out,
+                       size_t sector_size, size_t nsectors, int nthreads, int enc)
+{
+    struct xts_job job[AES_MAX_THREADS];
+    pthread_t tid[AES_MAX_THREADS];
+    int started[AES_MAX_THREADS];
+    size_t per, total = sector_size * nsectors;
+    int t;
+
+    if(sector_size < BLOCKLEN)
+        return -1;
+    if(nthreads > AES_MAX_THREADS)
+        nthreads = AES_MAX_THREADS;
+    if((size_t)nthreads > total / (XTS_MT_MIN / 2))
+        nthreads = total / (XTS_MT_MIN / 2);
+    if((size_t)nthreads > nsectors)
+        nthreads = nsectors;
+    if(nthreads < 1)
+        nthreads = 1;
+    per = (nsectors + nthreads - 1) / nthreads;
+    for(t=0;t<nthreads;t++){
+        size_t first = t*per < nsectors ? t*per : nsectors;
+        job[t].ctx = x;
+        job[t].sector = sector + first;
+        job[t].in = in + first*sector_size;
+        job[t].out = out + first*sector_size;
+        job[t].sector_size = sector_size;
+        job[t].nsectors = nsectors - first < per ? nsectors - first : per;
+        job[t].enc = enc;
+        started[t] = 0;
+    }
+    for(t=1;t<nthreads;t++)
+        started[t] = pthread_create(&tid[t], NULL, xts_worker, &job[t]) == 0;
+    xts_worker(&job[0]);
+    for(t=1;t<nthreads;t++){
+        if(started[t])
+            pthread_join(tid[t], NULL);
+        else
+            xts_worker(&job[t]);
+    }
+    return 0;
+}
+
+/*
+ * aes_xts_encrypt_sectors(), aes_xts_decrypt_sectors() - nsectors
+ * consecutive sectors of sector_size bytes, numbered from sector
+ * Sectors are independent, so they are dealt out to nthreads threads
+ * in contiguous runs once the batch reaches XTS_MT_MIN bytes.
+ * sector_size need not be a multiple of 16. Returns 0, or -1 if
+ * sector_size is shorter than a block.
+ */
+int aes_xts_encrypt_sectors(const xts_ctx *x, uint64_t sector, const uint8_t *in, uint8_t *out,
+                            size_t sector_size, size_t nsectors, int nthreads)
+{
+    return xts_sectors(x, sector, in, out, sector_size, nsectors, nthreads, 1);
+}
+
+int aes_xts_decrypt_sectors(const xts_ctx *x, uint64_t sector, const uint8_t *in, uint8_t *out,
+                            size_t sector_size, size_t nsectors, int nthreads)
+{
+    return xts_sectors(x, sector, in, out, sector_size, nsectors, nthreads, 0);
+}
@@ -0,0 +1,299 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "miller_rabin.h"
+#include "sieve.h"
+
+#define NMUL 0x400000
+#define NPOW 0x10000
+#define NMR 0x4000
+#define NSIEVE 0x2000000
+
+/*
+ * The original double-and-add mod_mul() and the mod_pow()/miller_rabin()
+ * built on it, kept here only as the baseline
+ */
+static uint64_t ref_mod_add(uint64_t a, uint64_t b, uint64_t m)
+{
+    a = a%m;
+    b = b%m;
+    if(a >= m-b)
+        return a-(m-b);
+    else
+        return a + b;
+}
+
+static uint64_t ref_mod_mul(uint64_t a, uint64_t b, uint64_t m)
+{
+    uint64_t r = 0;
+    while (b > 0) {
+        if (b & 1)
+            r = ref_mod_add(r, a, m);
+        b = b >> 1;
+        a = ref_mod_add(a, a, m);
+    }
+    return r;
+}
+
+static uint64_t ref_mod_pow(uint64_t a, uint64_t b, uint64_t m)
+{
+    uint64_t r = 1;
+    while (b > 0) {
+        if (b & 1)
+            r = ref_mod_mul(r, a, m);
+        b = b >> 1;
+        a = ref_mod_mul(a, a, m);
+    }
+    return r;
+}
+
+/* the previous mod_pow(): one mod_mul() (MUL + DIV) per step */
+static uint64_t div_mod_pow(uint64_t a, uint64_t b, uint64_t m)
+{
+    uint64_t r = 1;
+    while (b > 0) {
+        if (b & 1)
+            r = mod_mul(r, a, m);
+        b = b >> 1;
+        a = mod_mul(a, a, m);
+    }
+    return r;
+}
+
+static const uint64_t ref_a[ALEN] = {2,3,5,7,11,13,17,19,23,29,31,37};
+
+static int ref_miller_rabin(uint64_t n)
+{
+    uint64_t q, k=0;
+    q=n-1;
+    while((q&1)==0){
+        k++;
+        q=q>>1;
+    }
+    if(n!=2 && k==0)
+       return 0;
+    for(int i=0;i<ALEN;i++){
+        int incon = 0;
+        if(ref_a[i]>=n-1) return 1;
+        uint64_t t = ref_mod_pow(ref_a[i],q,n);
+        if(t==1 || t == n-1) continue;
+        for(int j=1;j<k;j++){
+            t = ref_mod_mul(t,t,n);
+            if(t==n-1){
+                incon = 1;
+                break;
+            }
+        }
+        if(incon) continue;
+        return 0;
+    }
+    return 1;
+}
+
+/* the previous miller_rabin(): all 12 bases, no prefilter */
+static int mr12_miller_rabin(uint64_t n)
+{
+    uint64_t q, k=0;
+    q=n-1;
+    while((q&1)==0){
+        k++;
+        q=q>>1;
+    }
+    if(n!=2 && k==0)
+       return 0;
+    for(int i=0;i<ALEN;i++){
+        int incon = 0;
+        if(ref_a[i]>=n-1) return 1;
+        uint64_t t = mod_pow(ref_a[i],q,n);
+        if(t==1 || t == n-1) continue;
+        for(int j=1;j<k;j++){
+            t = mod_mul(t,t,n);
+            if(t==n-1){
+                incon = 1;
+                break;
+            }
+        }
+        if(incon) continue;
+        return 0;
+    }
+    return 1;
+}
+
+static int sum_prime(uint64_t p, void *arg)
+{
+    *(uint64_t *)arg += p;
+    return 0;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void report(const char *name, double t_ref, double t, long n)
+{
+    printf("%-16s %10.1f ns/op -> %8.1f ns/op  (%.1fx)\n", name, t_ref * 1e9 / n, t * 1e9 / n, t_ref / t);
+}
+
+/*
+ * mod_mul(), mod_pow() and miller_rabin() on 64-bit moduli against the
+ * double-and-add baseline; the results must agree
+ */
+int main(void)
+{
+    uint64_t *x = malloc(3 * NMUL * sizeof(uint64_t)), s_ref = 0, s = 0, y;
+    double t, t_ref;
+    long i, p_ref = 0, p = 0;
+
+    arc4random_buf(x, 3 * NMUL * sizeof(uint64_t));
+    for (i = 0; i < NMUL; ++i)
+        x[3*i+2] |= 0x8000000000000000;
+
+    t_ref = now();
+    for (i = 0; i < NMUL / 64; ++i)
+        s_ref += ref_mod_mul(x[3*i], x[3*i+1], x[3*i+2]);
+    t_ref = now() - t_ref;
+    t = now();
+    for (i = 0; i < NMUL / 64; ++i)
+        s += mod_mul(x[3*i], x[3*i+1], x[3*i+2]);
+    t = now() - t;
+    report("mod_mul", t_ref, t, NMUL / 64);
+
+    t_ref = now();
+    for (i = 0; i < NPOW / 64; ++i)
+        s_ref += ref_mod_pow(x[3*i], x[3*i+1], x[3*i+2]);
+    t_ref = now() - t_ref;
+    t = now();
+    for (i = 0; i < NPOW / 64; ++i)
+        s += mod_pow(x[3*i], x[3*i+1], x[3*i+2]);
+    t = now() - t;
+    report("mod_pow", t_ref, t, NPOW / 64);
+
+    /* Montgomery against division, odd moduli */
+    for (i = 0; i < NPOW; ++i)
+        x[3*i+2] |= 1;
+    t_ref = now();
+    for (i = 0; i < NPOW; ++i)
+        s_ref += div_mod_pow(x[3*i], x[3*i+1], x[3*i+2]);
+    t_ref = now() - t_ref;
+    t = now();
+    for (i = 0; i < NPOW; ++i)
+        s += mod_pow(x[3*i], x[3*i+1], x[3*i+2]);
+    t = now() - t;
+    report("mod_pow (div)", t_ref, t, NPOW);
+
+    /* consecutive odd numbers from 2^63: mostly early exits, some primes */
+    t_ref = now();
+    for (i = 0; i < NMR / 16; ++i)
+        p_ref += ref_miller_rabin(0x8000000000000001 + 2*i);
+    t_ref = now() - t_ref;
+    t = now();
+    for (i = 0; i < NMR / 16; ++i)
+        p += miller_rabin(0x8000000000000001 + 2*i);
+    t = now() - t;
+    report("miller_rabin", t_ref, t, NMR / 16);
+
+    /* the fast path against the 12-base test, 64- and 32-bit odd n */
+    t_ref = now();
+    for (i = 0; i < NMR * 16; ++i)
+        p_ref += mr12_miller_rabin(0x8000000000000001 + 2*i);
+    t_ref = now() - t_ref;
+    t = now();
+    for (i = 0; i < NMR * 16; ++i)
+        p += miller_rabin(0x8000000000000001 + 2*i);
+    t = now() - t;
+    report("mr 64-bit (12)", t_ref, t, NMR * 16);
+
+    t_ref = now();
+    for (i = 0; i < NMR * 16; ++i)
+        p_ref += mr12_miller_rabin(0x80000001 + 2*i);
+    t_ref = now() - t_ref;
+    t = now();
+    for (i = 0; i < NMR * 16; ++i)
+        p += miller_rabin(0x80000001 + 2*i);
+    t = now() - t;
+    report("mr 32-bit (12)", t_ref, t, NMR * 16);
+
+    /* primes only: every base runs */
+    for (i = 0, y = 0x8000000000000001; i < 64; y += 2)
+        if (ref_miller_rabin(y))
+            x[i++] = y;
+    t_ref = now();
+    for (i = 0; i < NMR; ++i)
+        p_ref += mr12_miller_rabin(x[i % 64]);
+    t_ref = now() - t_ref;
+    t = now();
+    for (i = 0; i < NMR; ++i)
+        p += miller_rabin(x[i % 64]);
+    t = now() - t;
+    report("mr primes (12)", t_ref, t, NMR);
+
+    /* enumerating primes: miller_rabin() on every integer against the sieve */
+    t_ref = now();
+    for (y = 0; y < NSIEVE; ++y)
+        if (miller_rabin(y))
+            s_ref += y;
+    t_ref = now() - t_ref;
+    t = now();
+    prime_sieve(0, NSIEVE, 1, sum_prime, &s);
+    t = now() - t;
+    report("sieve [0,2^25)", t_ref, t, NSIEVE);
+
+    t_ref = now();
+    for (y = 0x8000000000000000; y < 0x8000000000000000 + NSIEVE / 16; ++y)
+        if (miller_rabin(y))
+            s_ref += y;
+    t_ref = now() - t_ref;
+    t = now();
+    prime_sieve(0x8000000000000000, 0x8000000000000000 + NSIEVE / 16, 1, sum_prime, &s);
+    t = now() - t;
+    report("sieve 2^63", t_ref, t, NSIEVE / 16);
+
+    /* one thread against all of them */
+    i = sysconf(_SC_NPROCESSORS_ONLN);
+    t_ref = now();
+    p_ref += prime_count(0x8000000000000000, 0x8000000000000000 + NSIEVE, 1);
+    t_ref = now() - t_ref;
+    t = now();
+    p += prime_count(0x8000000000000000, 0x8000000000000000 + NSIEVE, i);
+    t = now() - t;
+    printf("prime_count 2^63 %ld threads: %.1f ms -> %.1f ms\n", i, t_ref * 1e3, t * 1e3);
+
+    /* walking to the next prime: one candidate at a time against next_prime() */
+    t_ref = now();
+    for (i = 0, y = 0x8000000000000000; i < NMR / 4; ++i) {
+        for (++y; !miller_rabin(y); ++y)
+            ;
+        s_ref += y;
+    }
+    t_ref = now() - t_ref;
+    t = now();
+    for (i = 0, y = 0x8000000000000000; i < NMR / 4; ++i)
+        s += y = next_prime(y);
+    t = now() - t;
+    report("next_prime 2^63", t_ref, t, NMR / 4);
+
+    /* the mRSA_generate_key() loop: odd candidates, Fermat base 2, then the test */
+    t_ref = now();
+    for (i = 0, y = 0x80000000; i < NMR; ++i) {
+        for (y += 1 + (y & 1); mod_pow(2, y, y) != 2 || !miller_rabin(y); y += 2)
+            ;
+        s_ref += y;
+    }
+    t_ref = now() - t_ref;
+    t = now();
+    for (i = 0, y = 0x80000000; i < NMR; ++i)
+        s += y = next_prime(y);
+    t = now() - t;
+    report("next_prime 2^31", t_ref, t, NMR);
+
+    if (s != s_ref || p != p_ref) {
+        printf("Logic error: results differ\n");
+        return 1;
+    }
+    free(x);
+    return 0;
+}
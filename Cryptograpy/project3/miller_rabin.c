@@ -8,43 +8,274 @@
  *
  * if n < 3,317,044,064,679,887,385,961,981,
  * it is enough to test a = 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, and 41.
+ *
+ * Seven bases are enough below 2^64 (Jim Sinclair, 2011):
+ * a = 2, 325, 9375, 28178, 450775, 9780504, 1795265022.
+ *
+ * Below 2^32, base 2 plus one base picked by hashing n is enough. The
+ * table was built from an exhaustive list of the strong pseudoprimes to
+ * base 2 below 2^32 with no factor under 257: every one of them in bucket
+ * h fails the base in hash_base[h].
  */
-const uint64_t a[ALEN] = {2,3,5,7,11,13,17,19,23,29,31,37};
+static const uint64_t sinclair[7] = {2, 325, 9375, 28178, 450775, 9780504, 1795265022};
+
+static const uint16_t hash_base[16] = {
+    166, 63, 101, 865, 15, 33, 255, 174, 942, 285, 1419, 937, 583, 2221, 734, 718
+};
 
 /*
- * miller_rabin() - Miller-Rabin Primality Test (deterministic version)
- *
- * n > 3, an odd integer to be tested for primality
- * It returns 1 if n is prime, 0 otherwise.
+ * Odd primes 3..251 as {p^-1 mod 2^64, (2^64-1)/p}: p divides n exactly
+ * when n*p^-1 <= (2^64-1)/p, and then n*p^-1 = n/p.
  */
-int miller_rabin(uint64_t n)
+#define NSMALL 53
+static const uint64_t small_inv[NSMALL][2] = {
+    {0xaaaaaaaaaaaaaaab, 0x5555555555555555}, // 3
+    {0xcccccccccccccccd, 0x3333333333333333}, // 5
+    {0x6db6db6db6db6db7, 0x2492492492492492}, // 7
+    {0x2e8ba2e8ba2e8ba3, 0x1745d1745d1745d1}, // 11
+    {0x4ec4ec4ec4ec4ec5, 0x13b13b13b13b13b1}, // 13
+    {0xf0f0f0f0f0f0f0f1, 0x0f0f0f0f0f0f0f0f}, // 17
+    {0x86bca1af286bca1b, 0x0d79435e50d79435}, // 19
+    {0xd37a6f4de9bd37a7, 0x0b21642c8590b216}, // 23
+    {0x34f72c234f72c235, 0x08d3dcb08d3dcb08}, // 29
+    {0xef7bdef7bdef7bdf, 0x0842108421084210}, // 31
+    {0x14c1bacf914c1bad, 0x06eb3e45306eb3e4}, // 37
+    {0x8f9c18f9c18f9c19, 0x063e7063e7063e70}, // 41
+    {0x82fa0be82fa0be83, 0x05f417d05f417d05}, // 43
+    {0x51b3bea3677d46cf, 0x0572620ae4c415c9}, // 47
+    {0x21cfb2b78c13521d, 0x04d4873ecade304d}, // 53
+    {0xcbeea4e1a08ad8f3, 0x0456c797dd49c341}, // 59
+    {0x4fbcda3ac10c9715, 0x04325c53ef368eb0}, // 61
+    {0xf0b7672a07a44c6b, 0x03d226357e16ece5}, // 67
+    {0x193d4bb7e327a977, 0x039b0ad12073615a}, // 71
+    {0x7e3f1f8fc7e3f1f9, 0x0381c0e070381c0e}, // 73
+    {0x9b8b577e613716af, 0x033d91d2a2067b23}, // 79
+    {0xa3784a062b2e43db, 0x03159721ed7e7534}, // 83
+    {0xf47e8fd1fa3f47e9, 0x02e05c0b81702e05}, // 89
+    {0xa3a0fd5c5f02a3a1, 0x02a3a0fd5c5f02a3}, // 97
+    {0x3a4c0a237c32b16d, 0x0288df0cac5b3f5d}, // 101
+    {0xdab7ec1dd3431b57, 0x027c45979c95204f}, // 103
+    {0x77a04c8f8d28ac43, 0x02647c69456217ec}, // 107
+    {0xa6c0964fda6c0965, 0x02593f69b02593f6}, // 109
+    {0x90fdbc090fdbc091, 0x0243f6f0243f6f02}, // 113
+    {0x7efdfbf7efdfbf7f, 0x0204081020408102}, // 127
+    {0x03e88cb3c9484e2b, 0x01f44659e4a42715}, // 131
+    {0xe21a291c077975b9, 0x01de5d6e3f8868a4}, // 137
+    {0x3aef6ca970586723, 0x01d77b654b82c339}, // 139
+    {0xdf5b0f768ce2cabd, 0x01b7d6c3dda338b2}, // 149
+    {0x6fe4dfc9bf937f27, 0x01b2036406c80d90}, // 151
+    {0x5b4fe5e92c0685b5, 0x01a16d3f97a4b01a}, // 157
+    {0x1f693a1c451ab30b, 0x01920fb49d0e228d}, // 163
+    {0x8d07aa27db35a717, 0x01886e5f0abb0499}, // 167
+    {0x882383b30d516325, 0x017ad2208e0ecc35}, // 173
+    {0xed6866f8d962ae7b, 0x016e1f76b4337c6c}, // 179
+    {0x3454dca410f8ed9d, 0x016a13cd15372904}, // 181
+    {0x1d7ca632ee936f3f, 0x01571ed3c506b39a}, // 191
+    {0x70bf015390948f41, 0x015390948f40feac}, // 193
+    {0xc96bdb9d3d137e0d, 0x014cab88725af6e7}, // 197
+    {0x2697cc8aef46c0f7, 0x0149539e3b2d066e}, // 199
+    {0xc0e8f2a76e68575b, 0x013698df3de07479}, // 211
+    {0x687763dfdb43bb1f, 0x0125e22708092f11}, // 223
+    {0x1b10ea929ba144cb, 0x0120b470c67c0d88}, // 227
+    {0x1d10c4c0478bbced, 0x011e2ef3b3fb8744}, // 229
+    {0x63fb9aeb1fdcd759, 0x0119453808ca29c0}, // 233
+    {0x64afaa4f437b2e0f, 0x0112358e75d30336}, // 239
+    {0xf010fef010fef011, 0x010fef010fef010f}, // 241
+    {0x28cbfbeb9a020a33, 0x0105197f7d734041}, // 251
+};
+
+/*
+ * sprp() - strong probable prime test of n = q*2^k + 1 to base b
+ * b must be below n and not 0.
+ */
+static int sprp(const mont64_ctx *ctx, uint64_t b, uint64_t q, int k)
+{
+    uint64_t one = ctx->one, minus_one = ctx->n - one;
+    uint64_t t = mont_pow(ctx, mont_to(ctx, b), q);
+
+    if(t==one || t==minus_one) return 1; //inconclusive
+    for(int j=1;j<k;j++){
+        t = mont_mul(ctx,t,t);// t^(2^j) == (t*t)^j
+        if(t==minus_one) return 1; // inconclusive
+    }
+    return 0;//composite
+}
+
+/*
+ * strong_test() - the exponentiation part of miller_rabin()
+ * n must be odd and at least 257^2; below that the trial division decides
+ * and the hash table does not cover n under 63001.
+ */
+static int strong_test(uint64_t n)
 {
-    uint64_t q, k=0;
+    mont64_ctx ctx;
+    uint64_t q;
+    int k=0;
+
     q=n-1;
     while((q&1)==0){ // q%2==0
         k++;
         q=q>>1;// q = q/2
     }
+    mont64_init(&ctx, n);
+    if(!sprp(&ctx, 2, q, k))
+        return 0;
+    if(n < ((uint64_t)1 << 32))
+        return sprp(&ctx, hash_base[(uint32_t)n * 0x9e3779b1u >> 28], q, k);
+    for(int i=1;i<7;i++)
+        if(!sprp(&ctx, sinclair[i], q, k))
+            return 0;
+    return 1;
+}
+
+/*
+ * miller_rabin() - Miller-Rabin Primality Test (deterministic version)
+ *
+ * It returns 1 if n is prime, 0 otherwise.
+ * Even numbers and multiples of the odd primes below 257 are rejected
+ * without any modular exponentiation; odd n below 257^2 that survive are
+ * prime. The rest cost one exponentiation to base 2, which stops almost
+ * every composite, then one more below 2^32 and six more above.
+ */
+int miller_rabin(uint64_t n)
+{
+    uint64_t q;
 
-    if(n!=2 && k==0)// k > 0;
-       return 0;
-    
-    for(int i=0;i<ALEN;i++){
-        int incon = 0;
-
-        if(a[i]>=n-1) return 1; // 1 < a < n-1
-        
-        uint64_t t = mod_pow(a[i],q,n);
-        if(t==1 || t == n-1) continue; //inconclusive
-        for(int j=1;j<k;j++){
-            t = mod_mul(t,t,n);// t^(2^j) == (t*t)^j 
-            if(t==n-1){ // inconclusive
-                incon = 1;
-                break;
-            }
-        }
-        if(incon) continue;
-        return 0;//composite
+    if(n < 2)
+        return 0;
+    if((n&1)==0)
+        return n==2;
+    for(int i=0;i<NSMALL;i++){
+        q = n*small_inv[i][0];
+        if(q <= small_inv[i][1])
+            return q==1; // n == p
     }
-    return 1;
+    if(n < 257*257)
+        return 1;
+    return strong_test(n);
+}
+
+/*
+ * next_prime() and prev_prime() step over the numbers prime to 30 and
+ * carry x mod p for the odd primes 7..233 from one candidate to the
+ * next, so a candidate with a small factor costs a few vector additions
+ * and only the rest reach strong_test(). 48 residues of 16 bits fill
+ * whole SSE/AVX registers.
+ */
+#define NRES 48
+static const uint16_t res_p[NRES] = {
+    7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53, 59, 61, 67,
+    71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131, 137, 139, 149,
+    151, 157, 163, 167, 173, 179, 181, 191, 193, 197, 199, 211, 223, 227, 229, 233
+};
+static const int8_t wheel_pos[30] = {
+    -1, 0, -1, -1, -1, -1, -1, 1, -1, -1, -1, 2, -1, 3, -1,
+    -1, -1, 4, -1, 5, -1, -1, -1, 6, -1, -1, -1, -1, -1, 7
+};
+static const uint8_t gap_up[8] = {6, 4, 2, 4, 2, 4, 6, 2};     // 1 -> 7, ..., 29 -> 31
+static const uint8_t gap_down[8] = {2, 6, 4, 2, 4, 2, 4, 6};   // 1 -> -1, ..., 29 -> 23
+
+#define MAX_PRIME64 18446744073709551557u   // 2^64 - 59
+#define FIRST_PRIME_ABOVE_257SQ 66067
+
+/*
+ * res_init() - r[i] = x mod res_p[i]; nonzero if one of them is 0
+ * Unrolled, every % is by a constant and becomes a multiply.
+ */
+static uint16_t res_init(uint16_t *r, uint64_t x)
+{
+    uint16_t z = 0;
+
+#pragma GCC unroll 48
+    for(int i=0;i<NRES;i++){
+        r[i] = x % res_p[i];
+        z |= -(uint16_t)(r[i] == 0);
+    }
+    return z;
+}
+
+/* res_up() - r[i] = r[i] + d mod res_p[i], d < 7; nonzero if one is 0 */
+static inline uint16_t res_up(uint16_t *r, uint16_t d)
+{
+    uint16_t z = 0, t, u;
+
+    for(int i=0;i<NRES;i++){
+        t = r[i] + d;
+        u = t - res_p[i];       // wraps unless t >= p
+        r[i] = t = u < t ? u : t;
+        z |= -(uint16_t)(t == 0);
+    }
+    return z;
+}
+
+/* res_down() - r[i] = r[i] - d mod res_p[i], d < 7; nonzero if one is 0 */
+static inline uint16_t res_down(uint16_t *r, uint16_t d)
+{
+    uint16_t z = 0, t, u;
+
+    for(int i=0;i<NRES;i++){
+        t = r[i] - d;           // wraps if r[i] < d
+        u = t + res_p[i];
+        r[i] = t = u < t ? u : t;
+        z |= -(uint16_t)(t == 0);
+    }
+    return z;
+}
+
+/*
+ * next_prime() - the smallest prime > n, or 0 if that does not fit in 64 bits
+ */
+uint64_t next_prime(uint64_t n)
+{
+    uint16_t r[NRES], z;
+    uint64_t x;
+    int w;
+
+    if(n < 257*257){
+        for(x=n+1;!miller_rabin(x);x++)
+            ;
+        return x;
+    }
+    if(n >= MAX_PRIME64)
+        return 0;
+    for(x=n+1;wheel_pos[x%30]<0;x++)
+        ;
+    w = wheel_pos[x%30];
+    z = res_init(r, x);
+    // x > 257^2, so a zero residue means a proper factor
+    while(z || !strong_test(x)){
+        x += gap_up[w];
+        z = res_up(r, gap_up[w]);
+        w = (w+1) & 7;
+    }
+    return x;
+}
+
+/*
+ * prev_prime() - the largest prime < n, or 0 if n <= 2
+ */
+uint64_t prev_prime(uint64_t n)
+{
+    uint16_t r[NRES], z;
+    uint64_t x;
+    int w;
+
+    if(n <= 2)
+        return 0;
+    if(n <= FIRST_PRIME_ABOVE_257SQ){
+        for(x=n-1;!miller_rabin(x);x--)
+            ;
+        return x;
+    }
+    for(x=n-1;wheel_pos[x%30]<0;x--)
+        ;
+    w = wheel_pos[x%30];
+    z = res_init(r, x);
+    // the answer is at least 66067, so x stays above 257^2
+    while(z || !strong_test(x)){
+        x -= gap_down[w];
+        z = res_down(r, gap_down[w]);
+        w = (w+7) & 7;
+    }
+    return x;
 }
@@ -11,6 +11,25 @@ uint64_t mod_add(uint64_t a, uint64_t b, uint64_t m);
 uint64_t mod_sub(uint64_t a, uint64_t b, uint64_t m);
 uint64_t mod_mul(uint64_t a, uint64_t b, uint64_t m);
 uint64_t mod_pow(uint64_t a, uint64_t b, uint64_t m);
+
+/*
+ * Montgomery arithmetic modulo an odd n with R = 2^64. Values in
+ * Montgomery form are x*R mod n, always fully reduced.
+ */
+typedef struct {
+    uint64_t n;     // odd modulus
+    uint64_t ninv;  // n^-1 mod 2^64
+    uint64_t r2;    // R^2 mod n
+    uint64_t one;   // R mod n, i.e. 1 in Montgomery form
+} mont64_ctx;
+
+int mont64_init(mont64_ctx *ctx, uint64_t n);
+uint64_t mont_to(const mont64_ctx *ctx, uint64_t a);
+uint64_t mont_from(const mont64_ctx *ctx, uint64_t x);
+uint64_t mont_mul(const mont64_ctx *ctx, uint64_t x, uint64_t y);
+uint64_t mont_pow(const mont64_ctx *ctx, uint64_t x, uint64_t e);
 int miller_rabin(uint64_t n);
+uint64_t next_prime(uint64_t n);
+uint64_t prev_prime(uint64_t n);
 
 #endif
@@ -1,5 +1,9 @@
 #include <stdio.h>
 #include <stdint.h>
+#include "miller_rabin.h"
+#if defined(__x86_64__) && defined(__BMI2__)
+#include <immintrin.h>
+#endif
 // mod_add() - computes a+b mod m
 uint64_t mod_add(uint64_t a, uint64_t b, uint64_t m)
 {
@@ -24,6 +28,11 @@ uint64_t mod_sub(uint64_t a, uint64_t b, uint64_t m)
 
 /*
  * mod_mul() - computes a*b mod m
+ * The 128-bit product is formed with one MUL, or MULX via _mulx_u64()
+ * when built with BMI2 (-mbmi2 or -march=native), and reduced with one
+ * 128/64-bit DIV on x86-64, or with unsigned __int128
+ * elsewhere. After a, b < m the high half of a*b is below m, so DIVQ
+ * cannot overflow. Without a 128-bit type it falls back to
  *     r = 0;
  *     while (b > 0) {
  *         if (b & 1)
@@ -31,21 +40,133 @@ uint64_t mod_sub(uint64_t a, uint64_t b, uint64_t m)
  *         b = b >> 1;
  *         a = mod_add(a, a, m);
  *     }
+ * with the additions done without % once a and b are reduced.
  */
 uint64_t mod_mul(uint64_t a, uint64_t b, uint64_t m)
 {
+    if (a >= m)
+        a %= m;
+    if (b >= m)
+        b %= m;
+#if defined(__x86_64__) && defined(__GNUC__)
+    uint64_t hi, lo, q, r;
+#ifdef __BMI2__
+    unsigned long long h;
+    lo = _mulx_u64(a, b, &h);
+    hi = h;
+#else
+    __asm__("mulq %3" : "=a"(lo), "=d"(hi) : "a"(a), "rm"(b) : "cc");
+#endif
+    __asm__("divq %4" : "=a"(q), "=d"(r) : "a"(lo), "d"(hi), "rm"(m) : "cc");
+    (void)q;
+    return r;
+#elif defined(__SIZEOF_INT128__)
+    return (uint64_t)((unsigned __int128)a * b % m);
+#else
     uint64_t r = 0;
     while (b > 0) {
         if (b & 1)
-            r = mod_add(r, a, m);
+            r = r >= m-a ? r-(m-a) : r+a;
         b = b >> 1;
-        a = mod_add(a, a, m);
+        a = a >= m-a ? a-(m-a) : a+a;
+    }
+    return r;
+#endif
+}
+
+/*
+ * mul64() - returns the high half of the 128-bit product a*b, low half in *lo
+ */
+static inline uint64_t mul64(uint64_t a, uint64_t b, uint64_t *lo)
+{
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 p = (unsigned __int128)a * b;
+    *lo = (uint64_t)p;
+    return (uint64_t)(p >> 64);
+#else
+    uint64_t al = a & 0xffffffff, ah = a >> 32, bl = b & 0xffffffff, bh = b >> 32;
+    uint64_t ll = al*bl, lh = al*bh, hl = ah*bl, hh = ah*bh;
+    uint64_t mid = (ll >> 32) + (lh & 0xffffffff) + (hl & 0xffffffff);
+    *lo = (mid << 32) | (ll & 0xffffffff);
+    return hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+#endif
+}
+
+/*
+ * redc() - computes (hi*2^64 + lo) / R mod n for hi < n
+ * With m = lo*n^-1 mod 2^64 the low halves of T and m*n are equal, so
+ * T - m*n = (hi - hi(m*n)) * 2^64 exactly and the result is in (-n, n).
+ * This form never overflows, even for n close to 2^64.
+ */
+static inline uint64_t redc(const mont64_ctx *ctx, uint64_t hi, uint64_t lo)
+{
+    uint64_t t, mnh = mul64(lo * ctx->ninv, ctx->n, &t);
+    return hi < mnh ? hi - mnh + ctx->n : hi - mnh;
+}
+
+/*
+ * mont64_init() - precomputes n^-1 mod 2^64 and R^2 mod n for an odd n
+ * These are the only divisions; everything after runs on multiplies.
+ * It returns 0, or -1 if n is even.
+ */
+int mont64_init(mont64_ctx *ctx, uint64_t n)
+{
+    uint64_t x;
+
+    if ((n & 1) == 0)
+        return -1;
+    x = (3*n) ^ 2;     // 5 bits
+    x *= 2 - n*x;      // 10 bits
+    x *= 2 - n*x;      // 20 bits
+    x *= 2 - n*x;      // 40 bits
+    x *= 2 - n*x;      // 80 bits
+    ctx->n = n;
+    ctx->ninv = x;
+    ctx->one = (0 - n) % n;
+    ctx->r2 = mod_mul(ctx->one, ctx->one, n);
+    return 0;
+}
+
+// mont_to() - converts any a to Montgomery form a*R mod n
+uint64_t mont_to(const mont64_ctx *ctx, uint64_t a)
+{
+    uint64_t lo, hi = mul64(a, ctx->r2, &lo);  // hi < r2 < n
+    return redc(ctx, hi, lo);
+}
+
+// mont_from() - converts x out of Montgomery form
+uint64_t mont_from(const mont64_ctx *ctx, uint64_t x)
+{
+    return redc(ctx, 0, x);
+}
+
+// mont_mul() - computes x*y/R mod n for x, y in Montgomery form
+uint64_t mont_mul(const mont64_ctx *ctx, uint64_t x, uint64_t y)
+{
+    uint64_t lo, hi = mul64(x, y, &lo);
+    return redc(ctx, hi, lo);
+}
+
+/*
+ * mont_pow() - computes x^e in Montgomery form for x in Montgomery form
+ * Multiplying by one on zero bits costs a multiply but removes a branch
+ * that mispredicts on half of the bits of a random exponent.
+ */
+uint64_t mont_pow(const mont64_ctx *ctx, uint64_t x, uint64_t e)
+{
+    uint64_t r = ctx->one;
+    while (e > 0) {
+        r = mont_mul(ctx, r, e & 1 ? x : ctx->one);
+        e = e >> 1;
+        if (e > 0)
+            x = mont_mul(ctx, x, x);
     }
     return r;
 }
 
 /*
  * mod_pow() - computes a^b mod m
+ * Odd moduli go through mont_pow(); even ones use
  *     r = 1;
  *     while (b > 0) {
  *         if (b & 1)
@@ -56,7 +177,13 @@ uint64_t mod_mul(uint64_t a, uint64_t b, uint64_t m)
  */
 uint64_t mod_pow(uint64_t a, uint64_t b, uint64_t m)
 {
+    mont64_ctx ctx;
     uint64_t r = 1;
+
+    if (b == 0)
+        return 1;
+    if (mont64_init(&ctx, m) == 0)
+        return mont_from(&ctx, mont_pow(&ctx, mont_to(&ctx, a), b));
     while (b > 0) {
         if (b & 1)
             r = mod_mul(r, a, m);
@@ -0,0 +1,386 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "miller_rabin.h"
+#include "sieve.h"
+
+/* residues mod 30 prime to 30; bit j of a byte stands for 30*i + wheel[j] */
+static const uint8_t wheel[8] = {1, 7, 11, 13, 17, 19, 23, 29};
+
+/*
+ * wheel_k[w][j] = wheel[j] * p^-1 mod 30 for p = wheel[w] mod 30: the
+ * multiples k*p landing on bit j are those with k = wheel_k[w][j] mod 30
+ */
+static const uint8_t wheel_k[8][8] = {
+    { 1,  7, 11, 13, 17, 19, 23, 29},
+    {13,  1, 23, 19, 11,  7, 29, 17},
+    {11, 17,  1, 23,  7, 29, 13, 19},
+    { 7, 19, 17,  1, 29, 13, 11, 23},
+    {23, 11, 13, 29,  1, 17, 19,  7},
+    {19, 13, 29,  7, 23,  1, 17, 11},
+    {17, 29,  7, 11, 19, 23,  1, 13},
+    {29, 23, 19, 17, 13, 11,  7,  1},
+};
+static const int8_t wheel_idx[30] = {
+    -1, 0, -1, -1, -1, -1, -1, 1, -1, -1, -1, 2, -1, 3, -1,
+    -1, -1, 4, -1, 5, -1, -1, -1, 6, -1, -1, -1, -1, -1, 7
+};
+
+/* multiples of 7, 11, 13 and 17 repeat every 7*11*13*17 bytes */
+#define PRE_BYTES 17017
+#define PRE_MAX 17
+
+static uint8_t presieve[PRE_BYTES];
+static uint8_t word_off[64];        /* bit b of a 64-bit word: 30*(b/8) + wheel[b%8] */
+static uint32_t *base_primes;       /* 7 <= p < SIEVE_MAX_BASE */
+static int nbase_primes;
+static pthread_once_t sieve_once = PTHREAD_ONCE_INIT;
+
+/*
+ * sieve_init() - the presieve pattern, word offsets and base primes, built once
+ * The base primes come from a plain byte sieve up to SIEVE_MAX_BASE.
+ */
+static void sieve_init(void)
+{
+    uint8_t *comp = calloc(SIEVE_MAX_BASE, 1);
+    int i, j, n = 0;
+
+    for(i=0;i<PRE_BYTES;i++){
+        presieve[i] = 0xff;
+        for(j=0;j<8;j++){
+            uint32_t x = 30*i + wheel[j];
+            if(x%7 == 0 || x%11 == 0 || x%13 == 0 || x%17 == 0)
+                presieve[i] &= ~(1 << j);
+        }
+    }
+    for(i=0;i<64;i++)
+        word_off[i] = 30*(i/8) + wheel[i%8];
+    if(!comp)
+        return;
+    for(i=2;i*i<SIEVE_MAX_BASE;i++)
+        if(!comp[i])
+            for(j=i*i;j<SIEVE_MAX_BASE;j+=i)
+                comp[j] = 1;
+    for(i=7;i<SIEVE_MAX_BASE;i++)
+        n += !comp[i];
+    base_primes = malloc(n * sizeof(uint32_t));
+    if(base_primes)
+        for(i=7;i<SIEVE_MAX_BASE;i++)
+            if(!comp[i])
+                base_primes[nbase_primes++] = i;
+    free(comp);
+}
+
+
+struct sv_range {
+    uint64_t lo, hi;            /* [lo, hi) */
+    uint64_t base0;             /* lo rounded down to a multiple of 30 */
+    uint64_t nbytes, nseg;
+    int nbase;                  /* base primes up to sqrt(hi - 1) */
+    uint64_t confirm;           /* survivors >= this go to miller_rabin() */
+};
+
+/* isqrt() - floor(sqrt(x)) */
+static uint64_t isqrt(uint64_t x)
+{
+    uint64_t r = sqrt((double)x);
+
+    while(r > 0xffffffff || r*r > x)
+        r--;
+    while(r < 0xffffffff && (r+1)*(r+1) <= x)
+        r++;
+    return r;
+}
+
+/*
+ * sieve_segment() - sieves segment seq of r into bits
+ * The result has one bit set per prime in range, and is zero padded to a
+ * multiple of 8 bytes. It returns the segment length in bytes.
+ */
+static uint64_t sieve_segment(const struct sv_range *r, uint64_t seq, uint8_t *bits, uint64_t *segbase)
+{
+    uint64_t base = r->base0 + seq * (30 * (uint64_t)SIEVE_SEG_BYTES);
+    uint64_t nbytes = r->nbytes - seq * SIEVE_SEG_BYTES, last, i, g;
+    uint64_t q, rem, kmin, off0, off, idx;
+    size_t n;
+    int j;
+
+    if(nbytes > SIEVE_SEG_BYTES)
+        nbytes = SIEVE_SEG_BYTES;
+    /* the last number in range covered by this segment */
+    last = 30*nbytes - 1 <= r->hi - 1 - base ? base + 30*nbytes - 1 : r->hi - 1;
+    *segbase = base;
+
+    /* start from the 7..17 pattern at this segment's phase */
+    g = (base / 30) % PRE_BYTES;
+    for(i=0;i<nbytes;i+=n){
+        n = PRE_BYTES - g < nbytes - i ? PRE_BYTES - g : nbytes - i;
+        memcpy(bits + i, presieve + g, n);
+        g = 0;
+    }
+    memset(bits + nbytes, 0, (8 - nbytes % 8) % 8);
+
+    for(int k=0;k<r->nbase;k++){
+        uint64_t p = base_primes[k];
+        const uint8_t *kj;
+
+        if(p*p > last)
+            break;
+        if(p <= PRE_MAX)
+            continue;
+        /* the first multiple k*p >= max(p*p, base), as an offset from base */
+        q = base / p;
+        rem = base - q*p;
+        kmin = q + (rem != 0);
+        off0 = rem ? p - rem : 0;
+        if(kmin < p){
+            kmin = p;
+            off0 = p*p - base;
+        }
+        kmin %= 30;
+        kj = wheel_k[wheel_idx[p % 30]];
+        for(j=0;j<8;j++){
+            off = off0 + (kj[j] + 30 - kmin) % 30 * p;
+            for(idx=off/30;idx<nbytes;idx+=p)
+                bits[idx] &= ~(1 << j);
+        }
+    }
+
+    /* the presieve crossed off 7..17 themselves, and 1 is not prime */
+    if(base == 0)
+        bits[0] = (bits[0] & ~1) | 0x1e;
+    /* trim to [lo, hi) */
+    if(seq == 0)
+        for(j=0;j<8;j++)
+            if(base + wheel[j] < r->lo)
+                bits[0] &= ~(1 << j);
+    for(j=0;j<8;j++)
+        if(wheel[j] > last - base - 30*(nbytes-1))  // base + 30*i + wheel[j] may wrap
+            bits[nbytes-1] &= ~(1 << j);
+
+    /* past SIEVE_MAX_BASE^2 the survivors have no small factor but may be composite */
+    if(last >= r->confirm){
+        for(i=0;i<nbytes;i+=8){
+            uint64_t w;
+            memcpy(&w, bits + i, 8);
+            for(uint64_t m=w;m;m&=m-1){
+                int b = __builtin_ctzll(m);
+                uint64_t x = base + 30*i + word_off[b];
+                if(x >= r->confirm && !miller_rabin(x))
+                    w &= ~((uint64_t)1 << b);
+            }
+            memcpy(bits + i, &w, 8);
+        }
+    }
+    return nbytes;
+}
+
+/*
+ * sv_emit() - hands the primes of one sieved segment to cb, or counts them
+ * It returns cb's first nonzero result, or 0.
+ */
+static int sv_emit(const uint8_t *bits, uint64_t nbytes, uint64_t base, sieve_cb cb, void *arg, uint64_t *count)
+{
+    uint64_t w;
+    int ret;
+
+    for(uint64_t i=0;i<nbytes;i+=8){
+        memcpy(&w, bits + i, 8);
+        if(!cb){
+            *count += __builtin_popcountll(w);
+            continue;
+        }
+        for(;w;w&=w-1)
+            if((ret = cb(base + 30*i + word_off[__builtin_ctzll(w)], arg)) != 0)
+                return ret;
+    }
+    return 0;
+}
+
+enum { SLOT_FREE, SLOT_BUSY, SLOT_DONE };
+
+struct sv_slot {
+    int state;
+    uint64_t seq, base, nbytes;
+    uint8_t *bits;
+};
+
+/*
+ * Workers sieve segments into a ring of nslots buffers while the calling
+ * thread hands them to the callback in order, so cb needs no locking and
+ * sees the primes sorted. Segment seq lives in slot seq % nslots, as in
+ * the filecrypt pipeline of project2.
+ */
+struct sv_pipe {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct sv_slot slot[2*SIEVE_MAX_THREADS + 2];
+    int nslots;
+    uint64_t next_work;
+    int stop;
+    const struct sv_range *r;
+};
+
+static void *sv_worker(void *arg)
+{
+    struct sv_pipe *p = arg;
+    struct sv_slot *s;
+    uint64_t seq;
+
+    pthread_mutex_lock(&p->lock);
+    for(;;){
+        seq = p->next_work;
+        s = &p->slot[seq % p->nslots];
+        while(!p->stop && seq < p->r->nseg && s->state != SLOT_FREE){
+            pthread_cond_wait(&p->cond, &p->lock);
+            seq = p->next_work;
+            s = &p->slot[seq % p->nslots];
+        }
+        if(p->stop || seq >= p->r->nseg)
+            break;
+        s->state = SLOT_BUSY;
+        s->seq = seq;
+        p->next_work++;
+        pthread_mutex_unlock(&p->lock);
+        s->nbytes = sieve_segment(p->r, seq, s->bits, &s->base);
+        pthread_mutex_lock(&p->lock);
+        s->state = SLOT_DONE;
+        pthread_cond_broadcast(&p->cond);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+/* sv_run() - runs r on nthreads workers; returns cb's result, or -1 */
+static int sv_run(const struct sv_range *r, int nthreads, sieve_cb cb, void *arg, uint64_t *count)
+{
+    struct sv_pipe *p;
+    pthread_t tid[SIEVE_MAX_THREADS];
+    int started[SIEVE_MAX_THREADS], nstarted = 0, t, ret = 0;
+    struct sv_slot *s;
+
+    if(!(p = calloc(1, sizeof(*p))))
+        return -1;
+    p->nslots = 2*nthreads + 2;
+    p->r = r;
+    for(t=0;t<p->nslots;t++)
+        if(!(p->slot[t].bits = malloc(SIEVE_SEG_BYTES)))
+            ret = -1;
+    if(!ret){
+        pthread_mutex_init(&p->lock, NULL);
+        pthread_cond_init(&p->cond, NULL);
+        for(t=0;t<nthreads;t++){
+            started[t] = pthread_create(&tid[t], NULL, sv_worker, p) == 0;
+            nstarted += started[t];
+        }
+        for(uint64_t seq=0;seq<r->nseg && nstarted;seq++){
+            s = &p->slot[seq % p->nslots];
+            pthread_mutex_lock(&p->lock);
+            while(!(s->state == SLOT_DONE && s->seq == seq))
+                pthread_cond_wait(&p->cond, &p->lock);
+            pthread_mutex_unlock(&p->lock);
+            ret = sv_emit(s->bits, s->nbytes, s->base, cb, arg, count);
+            pthread_mutex_lock(&p->lock);
+            s->state = SLOT_FREE;
+            p->stop = ret != 0;
+            pthread_cond_broadcast(&p->cond);
+            pthread_mutex_unlock(&p->lock);
+            if(ret)
+                break;
+        }
+        if(!nstarted)
+            ret = -1;
+        pthread_mutex_lock(&p->lock);
+        p->stop = 1;
+        pthread_cond_broadcast(&p->cond);
+        pthread_mutex_unlock(&p->lock);
+        for(t=0;t<nthreads;t++)
+            if(started[t])
+                pthread_join(tid[t], NULL);
+        pthread_cond_destroy(&p->cond);
+        pthread_mutex_destroy(&p->lock);
+    }
+    for(t=0;t<p->nslots;t++)
+        free(p->slot[t].bits);
+    free(p);
+    return ret;
+}
+
+/* sv_start() - the common part of prime_sieve() and prime_count() */
+static int sv_start(uint64_t lo, uint64_t hi, int nthreads, sieve_cb cb, void *arg, uint64_t *count)
+{
+    static const uint64_t small[3] = {2, 3, 5};
+    struct sv_range r;
+    uint64_t lim, seq, segbase, nbytes;
+    uint8_t *bits;
+    int ret = 0;
+
+    pthread_once(&sieve_once, sieve_init);
+    if(!base_primes)
+        return -1;
+
+    for(int i=0;i<3;i++){
+        if(small[i] < lo || small[i] >= hi)
+            continue;
+        if(!cb)
+            ++*count;
+        else if((ret = cb(small[i], arg)) != 0)
+            return ret;
+    }
+    if(lo >= hi)
+        return 0;
+
+    r.lo = lo;
+    r.hi = hi;
+    r.base0 = lo / 30 * 30;
+    r.nbytes = (hi - r.base0) / 30 + ((hi - r.base0) % 30 != 0);
+    r.nseg = (r.nbytes + SIEVE_SEG_BYTES - 1) / SIEVE_SEG_BYTES;
+    lim = isqrt(hi - 1);
+    if(lim >= SIEVE_MAX_BASE){
+        r.nbase = nbase_primes;
+        r.confirm = (uint64_t)SIEVE_MAX_BASE * SIEVE_MAX_BASE;
+    }else{
+        for(r.nbase=0;r.nbase<nbase_primes && base_primes[r.nbase]<=lim;r.nbase++)
+            ;
+        r.confirm = UINT64_MAX;
+    }
+
+    if(nthreads > SIEVE_MAX_THREADS)
+        nthreads = SIEVE_MAX_THREADS;
+    if(nthreads > 1 && r.nseg > 1)
+        return sv_run(&r, nthreads, cb, arg, count);
+    /* one thread: no ring, sieve and emit in turn */
+    if(!(bits = malloc(SIEVE_SEG_BYTES)))
+        return -1;
+    for(seq=0;seq<r.nseg && !ret;seq++){
+        nbytes = sieve_segment(&r, seq, bits, &segbase);
+        ret = sv_emit(bits, nbytes, segbase, cb, arg, count);
+    }
+    free(bits);
+    return ret;
+}
+
+/*
+ * prime_sieve() - calls cb(p, arg) for every prime lo <= p < hi, in order
+ * cb runs on the calling thread even when nthreads > 1. It returns 0, the
+ * first nonzero value cb returned, or -1 if memory ran out.
+ */
+int prime_sieve(uint64_t lo, uint64_t hi, int nthreads, sieve_cb cb, void *arg)
+{
+    uint64_t count = 0;
+
+    if(!cb)
+        return -1;
+    return sv_start(lo, hi, nthreads, cb, arg, &count);
+}
+
+// prime_count() - the number of primes lo <= p < hi, or UINT64_MAX if memory ran out
+uint64_t prime_count(uint64_t lo, uint64_t hi, int nthreads)
+{
+    uint64_t count = 0;
+
+    if(sv_start(lo, hi, nthreads, NULL, NULL, &count) != 0)
+        return UINT64_MAX;
+    return count;
+}
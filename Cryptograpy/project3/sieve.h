@@ -0,0 +1,24 @@
+#ifndef SIEVE_H
+#define SIEVE_H
+
+#include <stdint.h>
+
+/*
+ * Segmented sieve of Eratosthenes over [lo, hi), hi <= 2^64 - 1
+ * A segment holds 30 numbers per byte, one bit for each residue mod 30
+ * prime to 30, and is sized to stay in L1. Segments are crossed off by
+ * the primes up to min(sqrt(hi), SIEVE_MAX_BASE); survivors above
+ * SIEVE_MAX_BASE^2 are confirmed with miller_rabin(), so ranges far out
+ * cost one test per survivor instead of one per integer.
+ */
+#define SIEVE_SEG_BYTES 32768       /* 983040 numbers per segment */
+#define SIEVE_MAX_BASE (1 << 20)    /* plain sieve below 2^40 */
+#define SIEVE_MAX_THREADS 64
+
+/* called for each prime in increasing order; a nonzero return stops */
+typedef int (*sieve_cb)(uint64_t p, void *arg);
+
+int prime_sieve(uint64_t lo, uint64_t hi, int nthreads, sieve_cb cb, void *arg);
+uint64_t prime_count(uint64_t lo, uint64_t hi, int nthreads);
+
+#endif
@@ -1,5 +1,89 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include "miller_rabin.h"
+#include "sieve.h"
+
+/*
+ * The plain 12-base miller_rabin() the fast path must agree with
+ */
+static int ref_miller_rabin(uint64_t n)
+{
+    static const uint64_t base[ALEN] = {2,3,5,7,11,13,17,19,23,29,31,37};
+    uint64_t q = n-1, t;
+    int i, j, k = 0;
+
+    if (n < 2)
+        return 0;
+    while ((q & 1) == 0) {
+        k++;
+        q >>= 1;
+    }
+    if (n != 2 && k == 0)
+        return 0;
+    for (i = 0; i < ALEN; ++i) {
+        if (base[i] >= n-1)
+            return 1;
+        t = mod_pow(base[i], q, n);
+        if (t == 1 || t == n-1)
+            continue;
+        for (j = 1; j < k; ++j) {
+            t = mod_mul(t, t, n);
+            if (t == n-1)
+                break;
+        }
+        if (j == k)
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Sieve callbacks: check_prime() walks [next, p] with miller_rabin(),
+ * print_prime() prints primes until it has printed max of them
+ */
+struct sieve_check {
+    uint64_t next;
+    int bad;
+};
+
+static int check_prime(uint64_t p, void *arg)
+{
+    struct sieve_check *c = arg;
+
+    for (; c->next < p; ++c->next)
+        if (miller_rabin(c->next))
+            c->bad = 1;
+    if (!miller_rabin(p))
+        c->bad = 1;
+    c->next = p + 1;
+    return 0;
+}
+
+struct sieve_print {
+    int n, max, per_line;
+};
+
+static int print_prime(uint64_t p, void *arg)
+{
+    struct sieve_print *s = arg;
+
+    printf("%llu ", (unsigned long long)p);
+    if (++s->n % s->per_line == 0)
+        printf("\n");
+    return s->n == s->max;
+}
+
+static int sieve_ok(uint64_t lo, uint64_t hi, int nthreads)
+{
+    struct sieve_check c = {lo, 0};
+
+    if (prime_sieve(lo, hi, nthreads, check_prime, &c) != 0)
+        return 0;
+    for (; c.next < hi; ++c.next)
+        if (miller_rabin(c.next))
+            c.bad = 1;
+    return !c.bad && prime_count(lo, hi, nthreads) == prime_count(lo, hi, 1);
+}
 
 /*
  * test program
@@ -41,34 +125,189 @@ int main(void)
     printf("<지수> ");
     printf("%llu ^ %llu mod %llu = %llu\n", a, b, m, mod_pow(a,b,m));
 
+    printf("\n");
+
     /*
-     * Print 10000 primes from beginning
+     * mod_mul() against double-and-add with mod_add() on random 64-bit
+     * operands and moduli of every size
      */
-    x = 2; i = 0;
-    while (1) {
-        if (miller_rabin(x)) {
-            ++i;
-            printf("%llu ", x);
-            if (i % 10 == 0)
-                printf("\n");
-            if (i == 10000)
-                break;
+    printf("Random testing"); fflush(stdout);
+    for (i = 0; i < 0x10000; ++i) {
+        uint64_t r = 0, s, t;
+        arc4random_buf(&a, sizeof(a));
+        arc4random_buf(&b, sizeof(b));
+        arc4random_buf(&m, sizeof(m));
+        m >>= i % 64;
+        if (m == 0)
+            m = 1;
+        for (s = a, t = b; t > 0; t >>= 1) {
+            if (t & 1)
+                r = mod_add(r, s, m);
+            s = mod_add(s, s, m);
+        }
+        if (mod_mul(a, b, m) != r) {
+            printf("Logic error\n");
+            exit(1);
+        }
+        if (i % 0x1000 == 0) {
+            printf(".");
+            fflush(stdout);
         }
-        ++x;
     }
+    printf("No error found\n");
+
     /*
-     * x = 0x8000000000000000
+     * mont_mul() and mod_pow() on odd moduli against mod_mul(), with
+     * operands both reduced and full 64-bit
      */
-    x = 0x8000000000000000; i = 0;
-    while (1) {
-        if (miller_rabin(x)) {
-            ++i;
-            printf("%llu ", x);
-            if (i % 4 == 0)
-                printf("\n");
-            if (i == 100)
-                break;
+    printf("Montgomery testing"); fflush(stdout);
+    for (i = 0; i < 0x10000; ++i) {
+        mont64_ctx ctx;
+        uint64_t r = 1, s, t;
+        arc4random_buf(&a, sizeof(a));
+        arc4random_buf(&b, sizeof(b));
+        arc4random_buf(&m, sizeof(m));
+        m = (m >> i % 64) | 1;
+        mont64_init(&ctx, m);
+        if (mont_from(&ctx, mont_mul(&ctx, mont_to(&ctx, a), mont_to(&ctx, b))) != mod_mul(a, b, m)) {
+            printf("Logic error\n");
+            exit(1);
+        }
+        if (i & 1)
+            b >>= i % 64;
+        for (s = a, t = b; t > 0; t >>= 1) {
+            if (t & 1)
+                r = mod_mul(r, s, m);
+            s = mod_mul(s, s, m);
         }
-        ++x;
+        if (mod_pow(a, b, m) != r) {
+            printf("Logic error\n");
+            exit(1);
+        }
+        if (i % 0x1000 == 0) {
+            printf(".");
+            fflush(stdout);
+        }
+    }
+    printf("No error found\n");
+
+    /*
+     * miller_rabin() against the 12-base test: every n below 2^20, strong
+     * pseudoprimes to several bases, and random n of every size
+     */
+    printf("Primality testing"); fflush(stdout);
+    {
+        static const uint64_t spsp[] = {
+            2047, 3215031751, 4759123141, 1122004669633, 2152302898747,
+            3474749660383, 341550071728321, 3825123056546413051
+        };
+        for (x = 0; x < 0x100000; ++x)
+            if (miller_rabin(x) != ref_miller_rabin(x)) {
+                printf("Logic error\n");
+                exit(1);
+            }
+        for (i = 0; i < sizeof(spsp) / sizeof(spsp[0]); ++i)
+            if (miller_rabin(spsp[i])) {
+                printf("Logic error\n");
+                exit(1);
+            }
+    }
+    for (i = 0; i < 0x40000; ++i) {
+        arc4random_buf(&x, sizeof(x));
+        x = (x >> i % 64) | 1;
+        if (miller_rabin(x) != ref_miller_rabin(x)) {
+            printf("Logic error\n");
+            exit(1);
+        }
+        if (i % 0x4000 == 0) {
+            printf(".");
+            fflush(stdout);
+        }
+    }
+    printf("No error found\n");
+
+    /*
+     * prime_sieve() against miller_rabin() on small, 32-bit, 2^40 (where
+     * sieving alone stops) and 64-bit ranges, with and without threads
+     */
+    printf("Sieve testing"); fflush(stdout);
+    if (prime_count(0, 100000000, 1) != 5761455 || !sieve_ok(0, 0x100000, 1) ||
+        !sieve_ok(0xfff00000, 0x100100000, 4) ||
+        !sieve_ok(0xfffff00000, 0x10000100000, 3) ||
+        !sieve_ok(0xffffffffffff0000, 0xffffffffffffffff, 2)) {
+        printf("Logic error\n");
+        exit(1);
+    }
+    for (i = 0; i < 0x40; ++i) {
+        uint64_t len = arc4random_uniform(0x40000);
+        arc4random_buf(&x, sizeof(x));
+        x >>= i;
+        if (x > UINT64_MAX - len)
+            x -= len;
+        if (!sieve_ok(x, x + len, i % 4 + 1)) {
+            printf("Logic error\n");
+            exit(1);
+        }
+        if (i % 4 == 0) {
+            printf(".");
+            fflush(stdout);
+        }
+    }
+    printf("No error found\n");
+
+    /*
+     * next_prime() and prev_prime() against stepping with miller_rabin(),
+     * at both ends of the 64-bit range and on random n of every size
+     */
+    printf("Next prime testing"); fflush(stdout);
+    if (next_prime(0) != 2 || next_prime(2) != 3 || prev_prime(2) != 0 ||
+        prev_prime(3) != 2 || next_prime(0xffffffffffffffc4) != 0xffffffffffffffc5 ||
+        next_prime(0xffffffffffffffc5) != 0 || prev_prime(0xffffffffffffffff) != 0xffffffffffffffc5) {
+        printf("Logic error\n");
+        exit(1);
+    }
+    for (i = 0; i < 0x10000; ++i) {
+        uint64_t y;
+        if (i < 0x1000)
+            x = i;
+        else {
+            arc4random_buf(&x, sizeof(x));
+            x = (x >> i % 64) | 0x100;
+        }
+        for (y = x + 1; y != 0 && !miller_rabin(y); ++y)
+            ;
+        if (next_prime(x) != y) {
+            printf("Logic error\n");
+            exit(1);
+        }
+        for (y = x - 1; x > 2 && !miller_rabin(y); --y)
+            ;
+        if (prev_prime(x) != (x > 2 ? y : 0)) {
+            printf("Logic error\n");
+            exit(1);
+        }
+        if (i % 0x1000 == 0) {
+            printf(".");
+            fflush(stdout);
+        }
+    }
+    printf("No error found\n");
+
+    /*
+     * Print 10000 primes from beginning
+     */
+    {
+        struct sieve_print sp = {0, 10000, 10};
+        prime_sieve(2, UINT64_MAX, 1, print_prime, &sp);
+    }
+    /*
+     * x = 0x8000000000000000
+     */
+    x = next_prime(0x8000000000000000 - 1);
+    for (i = 1; i <= 100; ++i) {
+        printf("%llu ", (unsigned long long)x);
+        if (i % 4 == 0)
+            printf("\n");
+        x = next_prime(x);
     }
 }
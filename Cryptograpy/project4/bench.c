@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "mRSA.h"
+
+#define NCIPHER 0x4000
+#define NKEYS 0x400
+
+/*
+ * The original double-and-add modular arithmetic of mRSA.c, kept here
+ * only as the baseline mRSA_cipher() is measured against
+ */
+static uint64_t ref_mod_add(uint64_t a, uint64_t b, uint64_t m)
+{
+    a = a%m;
+    b = b%m;
+    if(a >= m-b)
+        return a-(m-b);
+    else
+        return a + b;
+}
+
+static uint64_t ref_mod_mul(uint64_t a, uint64_t b, uint64_t m)
+{
+    uint64_t r = 0;
+    while (b > 0) {
+        if (b & 1)
+            r = ref_mod_add(r, a, m);
+        b = b >> 1;
+        a = ref_mod_add(a, a, m);
+    }
+    return r;
+}
+
+static uint64_t ref_mod_pow(uint64_t a, uint64_t b, uint64_t m)
+{
+    uint64_t r = 1;
+    while (b > 0) {
+        if (b & 1)
+            r = ref_mod_mul(r, a, m);
+        b = b >> 1;
+        a = ref_mod_mul(a, a, m);
+    }
+    return r;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * mRSA_cipher() with the private exponent against the baseline, then
+ * key generation, whose cost is mostly miller_rabin()
+ */
+int main(void)
+{
+    uint64_t e, d, n, m, *msg, ref[NCIPHER / 64], out[NCIPHER / 64];
+    double t, t_ref;
+    int i, bad = 0;
+
+    mRSA_generate_key(&e, &d, &n);
+    msg = malloc(NCIPHER * sizeof(uint64_t));
+    for (i = 0; i < NCIPHER; ++i) {
+        arc4random_buf(&msg[i], sizeof(uint64_t));
+        msg[i] %= n;
+    }
+    t_ref = now();
+    for (i = 0; i < NCIPHER / 64; ++i)
+        ref[i] = ref_mod_pow(msg[i], d, n);
+    t_ref = now() - t_ref;
+    t = now();
+    for (i = 0; i < NCIPHER / 64; ++i) {
+        m = msg[i];
+        mRSA_cipher(&m, d, n);
+        out[i] = m;
+    }
+    t = now() - t;
+    for (i = 0; i < NCIPHER / 64; ++i)
+        bad |= out[i] != ref[i];
+    printf("%-16s %10.1f us/op -> %8.2f us/op  (%.1fx)\n", "mRSA_cipher",
+           t_ref * 1e6 / (NCIPHER / 64), t * 1e6 / (NCIPHER / 64), t_ref / t);
+    t = now();
+    for (i = 0; i < NCIPHER; ++i) {
+        m = msg[i];
+        mRSA_cipher(&m, d, n);
+    }
+    t = now() - t;
+    printf("%-16s %10.2f us/op over %d messages\n", "mRSA_cipher", t * 1e6 / NCIPHER, NCIPHER);
+    t = now();
+    for (i = 0; i < NKEYS; ++i)
+        mRSA_generate_key(&e, &d, &n);
+    t = now() - t;
+    printf("%-16s %10.2f us/key\n", "generate_key", t * 1e6 / NKEYS);
+    free(msg);
+    if (bad) {
+        printf("Logic error: results differ\n");
+        return 1;
+    }
+    return 0;
+}
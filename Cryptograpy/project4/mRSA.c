@@ -2,19 +2,33 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include "mRSA.h"
+#if defined(__x86_64__) && defined(__BMI2__)
+#include <immintrin.h>
+#endif
 
 #define ALEN 12
 const uint64_t a[ALEN] = {2,3,5,7,11,13,17,19,23,29,31,37};
 
+/*
+ * gcd() - binary (Stein) gcd, no division in the loop
+ */
 static uint64_t gcd(uint64_t a, uint64_t b)
 {
-    uint64_t k;
-    while(b!=0){
-        k = a % b;
-        a = b;
-        b = k;
+    int k;
+    uint64_t d, m;
+
+    if(a==0 || b==0)
+        return a|b;
+    k = __builtin_ctzll(a|b);
+    a >>= __builtin_ctzll(a);
+    while(b != 0){
+        b >>= __builtin_ctzll(b);
+        d = b - a;
+        m = -(uint64_t)(b < a);
+        a += d & m;           // a = min(a, b)
+        b = (d ^ m) - m;      // b = |b - a|
     }
-    return a;
+    return a << k;
 }
 
 static uint64_t mul_inv(uint64_t a, uint64_t m){
@@ -34,31 +48,121 @@ static uint64_t mul_inv(uint64_t a, uint64_t m){
         return 0;
 }
 
-static uint64_t mod_add(uint64_t a, uint64_t b, uint64_t m)
-{
-    a = a%m;
-    b = b%m;
-    if(a >= m-b)
-        return a-(m-b);
-    else
-        return a + b;
-}
-
+/*
+ * mod_mul() - a*b mod m with one MUL and one DIV, as in project3/mod.c
+ * The portable fallback is double-and-add without %.
+ */
 static uint64_t mod_mul(uint64_t a, uint64_t b, uint64_t m)
 {
+    if (a >= m)
+        a %= m;
+    if (b >= m)
+        b %= m;
+#if defined(__x86_64__) && defined(__GNUC__)
+    uint64_t hi, lo, q, r;
+#ifdef __BMI2__
+    unsigned long long h;
+    lo = _mulx_u64(a, b, &h);
+    hi = h;
+#else
+    __asm__("mulq %3" : "=a"(lo), "=d"(hi) : "a"(a), "rm"(b) : "cc");
+#endif
+    __asm__("divq %4" : "=a"(q), "=d"(r) : "a"(lo), "d"(hi), "rm"(m) : "cc");
+    (void)q;
+    return r;
+#elif defined(__SIZEOF_INT128__)
+    return (uint64_t)((unsigned __int128)a * b % m);
+#else
     uint64_t r = 0;
     while (b > 0) {
         if (b & 1)
-            r = mod_add(r, a, m);
+            r = r >= m-a ? r-(m-a) : r+a;
         b = b >> 1;
-        a = mod_add(a, a, m);
+        a = a >= m-a ? a-(m-a) : a+a;
+    }
+    return r;
+#endif
+}
+
+/*
+ * Montgomery arithmetic modulo an odd n with R = 2^64, as in project3/mod.c
+ */
+typedef struct {
+    uint64_t n;     // odd modulus
+    uint64_t ninv;  // n^-1 mod 2^64
+    uint64_t r2;    // R^2 mod n
+    uint64_t one;   // R mod n
+} mont64_ctx;
+
+static inline uint64_t mul64(uint64_t a, uint64_t b, uint64_t *lo)
+{
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 p = (unsigned __int128)a * b;
+    *lo = (uint64_t)p;
+    return (uint64_t)(p >> 64);
+#else
+    uint64_t al = a & 0xffffffff, ah = a >> 32, bl = b & 0xffffffff, bh = b >> 32;
+    uint64_t ll = al*bl, lh = al*bh, hl = ah*bl, hh = ah*bh;
+    uint64_t mid = (ll >> 32) + (lh & 0xffffffff) + (hl & 0xffffffff);
+    *lo = (mid << 32) | (ll & 0xffffffff);
+    return hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+#endif
+}
+
+// redc() - (hi*2^64 + lo) / R mod n for hi < n, without overflow
+static inline uint64_t redc(const mont64_ctx *ctx, uint64_t hi, uint64_t lo)
+{
+    uint64_t t, mnh = mul64(lo * ctx->ninv, ctx->n, &t);
+    return hi < mnh ? hi - mnh + ctx->n : hi - mnh;
+}
+
+// mont64_init() - n must be odd
+static void mont64_init(mont64_ctx *ctx, uint64_t n)
+{
+    uint64_t x = (3*n) ^ 2;
+    x *= 2 - n*x;
+    x *= 2 - n*x;
+    x *= 2 - n*x;
+    x *= 2 - n*x;
+    ctx->n = n;
+    ctx->ninv = x;
+    ctx->one = (0 - n) % n;
+    ctx->r2 = mod_mul(ctx->one, ctx->one, n);
+}
+
+static inline uint64_t mont_mul(const mont64_ctx *ctx, uint64_t x, uint64_t y)
+{
+    uint64_t lo, hi = mul64(x, y, &lo);
+    return redc(ctx, hi, lo);
+}
+
+static uint64_t mont_pow(const mont64_ctx *ctx, uint64_t x, uint64_t e)
+{
+    uint64_t r = ctx->one;
+    while (e > 0) {
+        r = mont_mul(ctx, r, e & 1 ? x : ctx->one);  // no branch on e
+        e = e >> 1;
+        if (e > 0)
+            x = mont_mul(ctx, x, x);
     }
     return r;
 }
 
+/*
+ * mod_pow() - a^b mod m, through Montgomery form when m is odd
+ */
 static uint64_t mod_pow(uint64_t a, uint64_t b, uint64_t m)
 {
+    mont64_ctx ctx;
     uint64_t r = 1;
+
+    if (b == 0)
+        return 1;
+    if (m & 1) {
+        mont64_init(&ctx, m);
+        r = mont_pow(&ctx, mont_mul(&ctx, a % m, ctx.r2), b);
+        return mont_mul(&ctx, r, 1);
+    }
     while (b > 0) {
         if (b & 1)
             r = mod_mul(r, a, m);
@@ -70,7 +174,10 @@ static uint64_t mod_pow(uint64_t a, uint64_t b, uint64_t m)
 
 static int miller_rabin(uint64_t n)
 {
-    uint64_t q, k=0;
+    mont64_ctx ctx;
+    uint64_t q, k=0, one, minus_one;
+    if(n < 2)  // q = n-1 would have no factor 2 to strip at n = 1
+       return 0;
     q=n-1;
     while((q&1)==0){ // q%2==0
         k++;
@@ -79,17 +186,22 @@ static int miller_rabin(uint64_t n)
 
     if(n!=2 && k==0)// k > 0;
        return 0;
-    
+    if(n==2)
+       return 1;
+
+    mont64_init(&ctx, n);
+    one = ctx.one;
+    minus_one = n - one;
     for(int i=0;i<ALEN;i++){
         int incon = 0;
 
         if(a[i]>=n-1) return 1; // 1 < a < n-1
         
-        uint64_t t = mod_pow(a[i],q,n);
-        if(t==1 || t == n-1) continue; //inconclusive
+        uint64_t t = mont_pow(&ctx, mont_mul(&ctx, a[i], ctx.r2), q);
+        if(t==one || t == minus_one) continue; //inconclusive
         for(int j=1;j<k;j++){
-            t = mod_mul(t,t,n);// t^(2^j) == (t*t)^j 
-            if(t==n-1){ // inconclusive
+            t = mont_mul(&ctx,t,t);// t^(2^j) == (t*t)^j 
+            if(t==minus_one){ // inconclusive
                 incon = 1;
                 break;
             }
@@ -100,6 +212,56 @@ static int miller_rabin(uint64_t n)
     return 1;
 }
 
+/*
+ * next_prime() - the smallest prime > n, n < 2^64 - 59, as in project3
+ * It walks the numbers prime to 30 carrying x mod p for the odd primes
+ * 7..233, and runs miller_rabin() only on candidates without such a
+ * factor.
+ */
+#define NRES 48
+static const uint16_t res_p[NRES] = {
+    7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53, 59, 61, 67,
+    71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131, 137, 139, 149,
+    151, 157, 163, 167, 173, 179, 181, 191, 193, 197, 199, 211, 223, 227, 229, 233
+};
+static const int8_t wheel_pos[30] = {
+    -1, 0, -1, -1, -1, -1, -1, 1, -1, -1, -1, 2, -1, 3, -1,
+    -1, -1, 4, -1, 5, -1, -1, -1, 6, -1, -1, -1, -1, -1, 7
+};
+static const uint8_t gap_up[8] = {6, 4, 2, 4, 2, 4, 6, 2};
+
+static uint64_t next_prime(uint64_t n)
+{
+    uint16_t r[NRES], z = 0, t, u;
+    uint64_t x;
+    int w;
+
+    if(n < 257){
+        for(x=n+1;!miller_rabin(x);x++)
+            ;
+        return x;
+    }
+    for(x=n+1;wheel_pos[x%30]<0;x++)
+        ;
+    w = wheel_pos[x%30];
+#pragma GCC unroll 48
+    for(int i=0;i<NRES;i++){
+        r[i] = x % res_p[i];
+        z |= -(uint16_t)(r[i] == 0);
+    }
+    while(z || !miller_rabin(x)){
+        x += gap_up[w];
+        z = 0;
+        for(int i=0;i<NRES;i++){
+            t = r[i] + gap_up[w];
+            u = t - res_p[i];
+            r[i] = t = u < t ? u : t;
+            z |= -(uint16_t)(t == 0);
+        }
+        w = (w+1) & 7;
+    }
+    return x;
+}
 
 /*
  * mRSA_generate_key() - generates mini RSA keys e, d and n
@@ -108,34 +270,23 @@ static int miller_rabin(uint64_t n)
 void mRSA_generate_key(uint64_t *e, uint64_t *d, uint64_t *n)
 {
     uint64_t p,q,lcm,min;
-    //create prime p
-    while(1){
+    //create prime p, the first prime after a random 32-bit number >= 3
+    do{
+        p = 0; // only the low 32 bits are filled in
         arc4random_buf(&p,sizeof(uint32_t));
-        /*
-            fermat theorem( 2^p mod p != 2 -> p is not prime)
-            (p&1) == 1 is odd, (p&1) == 0 is even
-         */
-        if(p < 3 || (p&1)==0 || mod_pow(2,p,p)!=2)
-            continue;
-        if(miller_rabin(p))
-            break;
-    }
+        if(p >= 3) // a draw of 0 or 1 would give p = 2 or less
+            p = next_prime(p);
+    }while(p < 3 || p > 0xffffffff);
     /* 
         create prime q
         2^63 <= p*q < 2^64, 2^63/p <= q < 2^64/p
         0 <= q_range < 2^64/p - 2^63/p == 2^63/p
      */
     min = (MINIMUM_N-1)/p;//(2^63-1)/p 
-    while(1){
+    do{
         q = arc4random_uniform(min); // 0 <= q_range < (2^63-1)/p
-        q += min + 1; // (2^63-1)/p < q < (2^64)/p
-        if(p==q)
-            continue;
-        if((q&1)==0 || mod_pow(2,q,q)!=2)
-            continue;
-        if(miller_rabin(q))
-            break;
-    }
+        q = next_prime(q + min); // (2^63-1)/p < q
+    }while(p==q || q > UINT64_MAX/p); // q < (2^64)/p
     
     *n = p*q;
     lcm = (p-1)*(q-1)/gcd(p-1,q-1);
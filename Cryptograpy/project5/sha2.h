@@ -86,6 +86,12 @@ void sha256_final(sha256_ctx *ctx, unsigned char *digest);
 void sha256(const unsigned char *message, unsigned int len,
             unsigned char *digest);
 
+/* compression function and constants, for callers that stream blocks themselves */
+extern uint32 sha256_h0[8];
+extern uint32 sha256_k[64];
+void sha256_transf(sha256_ctx *ctx, const unsigned char *message,
+                   unsigned int block_nb);
+
 void sha384_init(sha384_ctx *ctx);
 void sha384_update(sha384_ctx *ctx, const unsigned char *message,
                    unsigned int len);